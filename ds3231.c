@@ -12,6 +12,10 @@
 #include "ds3231.h"
 #include "hal/hal.h"
 
+/* Register helpers of the feature groups */
+#define NEED_GET_FLAG (DS3231_CFG_FLAGS || DS3231_CFG_ALARMS || DS3231_CFG_SQUAREWAVE)
+#define NEED_SET_FLAG (NEED_GET_FLAG || DS3231_CFG_32KHZ || DS3231_CFG_AGING)
+
 /* Convert binary coded decimal to normal decimal */
 static uint8_t bcd2dec(uint8_t val)
 {
@@ -24,12 +28,47 @@ static uint8_t dec2bcd(uint8_t val)
     return ((val / 10) << 4) + (val % 10);
 }
 
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static int32_t days_from_civil(int32_t y, uint32_t m, uint32_t d)
+{
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);
+    uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+/* Proleptic Gregorian date of a count of days since 1970-01-01 */
+static void civil_from_days(int32_t z, int32_t *y, uint32_t *m, uint32_t *d)
+{
+    z += 719468;
+    int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+    uint32_t doe = (uint32_t)(z - era * 146097);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int32_t)yoe + era * 400 + (*m <= 2);
+}
+
+/* Day of week, 0 is Sunday, of a count of days since 1970-01-01 (a Thursday) */
+static int weekday_from_days(int32_t z)
+{
+    return z >= -4 ? (z + 4) % 7 : (z + 5) % 7 + 6;
+}
+
 bool ds3231_init(i2c_dev_t *dev, uint8_t port, uint8_t sda_gpio, uint8_t scl_gpio)
 {
-    dev->port = port;
+    *dev = (i2c_dev_t){ .port = port, .sda_io_num = sda_gpio, .scl_io_num = scl_gpio };
+
+    return ds3231_init_dev(dev);
+}
+
+bool ds3231_init_dev(i2c_dev_t *dev)
+{
     dev->addr = DS3231_ADDR;
-    dev->sda_io_num = sda_gpio;
-    dev->scl_io_num = scl_gpio;
 
     return hal_i2c_init(dev);
 }
@@ -42,34 +81,35 @@ bool ds3231_free(i2c_dev_t *dev)
 bool ds3231_set_time(i2c_dev_t *dev, struct tm *time)
 {
     uint8_t data[7];
+    int year = time->tm_year + 1900;
+
+    if (year < DS3231_YEAR_MIN || year > DS3231_YEAR_MAX) {
+        return false;
+    }
 
     /* time/date data */
     data[0] = dec2bcd(time->tm_sec);
     data[1] = dec2bcd(time->tm_min);
     data[2] = dec2bcd(time->tm_hour);
     /* The week data must be in the range 1 to 7, and to keep the start on the
-     * same day as for tm_wday have it start at 1 on Sunday. */
-    data[3] = dec2bcd(time->tm_wday + 1);
+     * same day as for tm_wday have it start at 1 on Sunday. It is derived from
+     * the date so the chip never holds a day that disagrees with it. */
+    data[3] = weekday_from_days(days_from_civil(year, time->tm_mon + 1, time->tm_mday)) + 1;
     data[4] = dec2bcd(time->tm_mday);
-    data[5] = dec2bcd(time->tm_mon + 1);
-    data[6] = dec2bcd(time->tm_year - 2000);
+    data[5] = dec2bcd(time->tm_mon + 1) | (year >= 2100 ? DS3231_CENTURY_FLAG : 0);
+    data[6] = dec2bcd(year % 100);
 
     return hal_i2c_write_reg(dev, DS3231_ADDR_TIME, data, 7);
 }
 
-bool ds3231_get_time(i2c_dev_t *dev, struct tm *time)
+/* Convert the 7 time registers to unix time structure */
+static void ds3231_decode_time(const uint8_t *data, struct tm *time)
 {
-    uint8_t data[7];
-
-    /* read time */
-    hal_i2c_read_reg(dev, DS3231_ADDR_TIME, data, 7);
-
-    /* convert to unix time structure */
     time->tm_sec = bcd2dec(data[0]);
     time->tm_min = bcd2dec(data[1]);
     if (data[2] & DS3231_12HOUR_FLAG) {
-        /* 12H */
-        time->tm_hour = bcd2dec(data[2] & DS3231_12HOUR_MASK) - 1;
+        /* 12H, 12 AM is midnight */
+        time->tm_hour = bcd2dec(data[2] & DS3231_12HOUR_MASK) % 12;
         /* AM/PM? */
         if (data[2] & DS3231_PM_FLAG) {
             time->tm_hour += 12;
@@ -80,38 +120,387 @@ bool ds3231_get_time(i2c_dev_t *dev, struct tm *time)
     time->tm_wday = bcd2dec(data[3]) - 1;
     time->tm_mday = bcd2dec(data[4]);
     time->tm_mon  = bcd2dec(data[5] & DS3231_MONTH_MASK) - 1;
-    time->tm_year = bcd2dec(data[6]) + 2000;
+    /* years since 1900, the century flag selects 2100-2199 */
+    time->tm_year = bcd2dec(data[6]) + ((data[5] & DS3231_CENTURY_FLAG) ? 200 : 100);
+    time->tm_yday = days_from_civil(time->tm_year + 1900, time->tm_mon + 1, time->tm_mday)
+        - days_from_civil(time->tm_year + 1900, 1, 1);
     time->tm_isdst = 0;
+}
+
+/* The chip takes every year divisible by 4 as a leap year, so it counts
+ * 2100-02-29. Report such a date as 2100-03-01 in the read registers
+ * only, the day register already holds the right weekday. Returns true
+ * if the date was moved. */
+static bool ds3231_leap_2100(uint8_t *date)
+{
+    if (date[2] != 0x00 || date[1] != (DS3231_CENTURY_FLAG | 0x02) || date[0] != 0x29) {
+        return false;
+    }
+
+    date[0] = 0x01;
+    date[1] = DS3231_CENTURY_FLAG | 0x03;
 
     return true;
 }
 
-bool ds3231_set_alarm(i2c_dev_t *dev, ds3231_alarm_t alarms, struct tm *time1, ds3231_alarm1_rate_t option1,
-        struct tm *time2, ds3231_alarm2_rate_t option2)
+bool ds3231_get_time(i2c_dev_t *dev, struct tm *time)
+{
+    uint8_t data[7];
+
+    /* read time */
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_TIME, data, 7) != true) {
+        return false;
+    }
+
+    ds3231_leap_2100(data + 4);
+    ds3231_decode_time(data, time);
+
+    return true;
+}
+
+bool ds3231_fix_leap_2100(i2c_dev_t *dev)
+{
+    uint8_t date[3];
+
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_TIME + 4, date, 3) != true) {
+        return false;
+    }
+
+    /* writing the date does not reset the seconds */
+    return ds3231_leap_2100(date) != true || hal_i2c_write_reg(dev, DS3231_ADDR_TIME + 4, date, 2);
+}
+
+#if DS3231_CFG_CHECKED
+/* Bytes of the time registers packed into one word, register 0 lowest */
+#define TIME_BYTES(b0, b1, b2, b3, b4, b5, b6) \
+    ((uint64_t)(b0) | (uint64_t)(b1) << 8 | (uint64_t)(b2) << 16 | (uint64_t)(b3) << 24 \
+    | (uint64_t)(b4) << 32 | (uint64_t)(b5) << 40 | (uint64_t)(b6) << 48)
+
+#define TIME_ONES(x) TIME_BYTES(x, x, x, x, x, x, x)
+
+/* Bits that can be set, and bits of the BCD fields without the flags */
+#define TIME_ALLOWED TIME_BYTES(0x7f, 0x7f, 0x7f, 0x07, 0x3f, 0x9f, 0xff)
+#define TIME_FIELDS  TIME_BYTES(0x7f, 0x7f, 0x3f, 0x07, 0x3f, 0x1f, 0xff)
+
+/* Range limits of the BCD fields, hour for 24-hour mode, year unchecked */
+#define TIME_MAX     TIME_BYTES(0x59, 0x59, 0x23, 0x07, 0x31, 0x12, 0x00)
+#define TIME_MIN     TIME_BYTES(0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x00)
+#define TIME_RANGED  TIME_BYTES(0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00)
+
+/* Check the 7 time registers for bits that can not be set, invalid BCD and
+ * out of range fields, without branches on the data. Once all fields are
+ * valid the date is checked against the month and the day of week. */
+static bool ds3231_valid_time(const uint8_t *data)
+{
+    uint64_t v = TIME_BYTES(data[0], data[1], data[2], data[3], data[4], data[5], data[6]);
+
+    /* 12-hour mode: hour field is 5 bits, 1 to 12 */
+    uint64_t h12 = (v >> 22) & 1;
+    uint64_t fields = (v & TIME_FIELDS) & ~(h12 << 21);
+    uint64_t max = TIME_MAX - (h12 * 0x11 << 16);
+    uint64_t min = TIME_MIN | (h12 << 16);
+
+    /* a nibble above 9 carries into bit 4 when 6 is added */
+    uint64_t bad = v & ~TIME_ALLOWED;
+    bad |= ((fields & TIME_ONES(0x0f)) + TIME_ONES(0x06)) & TIME_ONES(0x10);
+    bad |= (((fields >> 4) & TIME_ONES(0x0f)) + TIME_ONES(0x06)) & TIME_ONES(0x10);
+
+    /* per byte compares, the ranged fields are below 0x80 so setting bit 7
+     * before subtracting keeps the borrow within the byte */
+    uint64_t ranged = fields & TIME_RANGED & TIME_ONES(0x7f);
+    bad |= ~((max | TIME_ONES(0x80)) - ranged) & TIME_RANGED & TIME_ONES(0x80);
+    bad |= ~((ranged | TIME_ONES(0x80)) - min) & TIME_RANGED & TIME_ONES(0x80);
+
+    if (bad) {
+        return false;
+    }
+
+    /* the chip takes every year divisible by 4 as a leap year */
+    static const uint8_t days[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int year = bcd2dec(data[6]) + ((data[5] & DS3231_CENTURY_FLAG) ? 2100 : 2000);
+    int mon = bcd2dec(data[5] & DS3231_MONTH_MASK);
+    int mday = bcd2dec(data[4]);
+
+    if (mday > days[mon - 1] || (mon == 2 && mday == 29 && year % 4 != 0)) {
+        return false;
+    }
+
+    return bcd2dec(data[3]) == weekday_from_days(days_from_civil(year, mon, mday)) + 1;
+}
+
+bool ds3231_get_time_checked(i2c_dev_t *dev, struct tm *time)
 {
-    int i = 0;
     uint8_t data[7];
 
+    for (int i = 0; i < DS3231_READ_ATTEMPTS; i++) {
+        if (hal_i2c_read_reg(dev, DS3231_ADDR_TIME, data, 7) != true) {
+            continue;
+        }
+        if (ds3231_valid_time(data)) {
+            ds3231_leap_2100(data + 4);
+            ds3231_decode_time(data, time);
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
+#if DS3231_CFG_FAST
+bool ds3231_fast_init(ds3231_fast_t *f, i2c_dev_t *dev)
+{
+    uint8_t status;
+
+    f->dev = dev;
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_STATUS, &status, 1) != true) {
+        return false;
+    }
+
+    /* writing 1 keeps a flag, 0 clears the alarm flags, the 32kHz enable
+     * is kept as read */
+    status = DS3231_STAT_OSCILLATOR | (status & DS3231_STAT_32KHZ);
+
+    return hal_i2c_prepare(dev, &f->time, false, DS3231_ADDR_TIME, f->time_data, sizeof(f->time_data))
+        && hal_i2c_prepare(dev, &f->status, false, DS3231_ADDR_STATUS, &f->status_data, 1)
+        && hal_i2c_prepare(dev, &f->clear, true, DS3231_ADDR_STATUS, &status, 1);
+}
+
+bool ds3231_fast_get_time(ds3231_fast_t *f, struct tm *time)
+{
+    if (hal_i2c_run(&f->time) != true) {
+        return false;
+    }
+
+    ds3231_leap_2100(f->time_data + 4);
+    ds3231_decode_time(f->time_data, time);
+
+    return true;
+}
+
+bool ds3231_fast_get_status(ds3231_fast_t *f, uint8_t *status)
+{
+    if (hal_i2c_run(&f->status) != true) {
+        return false;
+    }
+
+    *status = f->status_data;
+
+    return true;
+}
+
+bool ds3231_fast_clear_alarm_flags(ds3231_fast_t *f)
+{
+    return hal_i2c_run(&f->clear);
+}
+
+#if DS3231_CFG_32KHZ
+bool ds3231_fast_set_32khz(ds3231_fast_t *f, bool enable)
+{
+    uint8_t status = DS3231_STAT_OSCILLATOR | (enable ? DS3231_STAT_32KHZ : 0);
+    bool res = enable ? ds3231_enable_32khz(f->dev) : ds3231_disable_32khz(f->dev);
+
+    /* the clearing write carries the new enable from now on */
+    return res && hal_i2c_prepare(f->dev, &f->clear, true, DS3231_ADDR_STATUS, &status, 1);
+}
+#endif
+#endif
+
+bool ds3231_get_snapshot(i2c_dev_t *dev, ds3231_snapshot_t *snap)
+{
+    uint8_t data[DS3231_REG_COUNT];
+
+    /* One burst from the first register, the chip serves the whole transfer
+     * from the user buffers latched on START, so time and flags can not
+     * straddle a second rollover */
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_TIME, data, sizeof(data)) != true) {
+        return false;
+    }
+
+    ds3231_leap_2100(data + 4);
+    ds3231_decode_time(data, &snap->time);
+    snap->control = data[DS3231_ADDR_CONTROL];
+    snap->status = data[DS3231_ADDR_STATUS];
+    snap->aging = (int8_t)data[DS3231_ADDR_AGING];
+    snap->temp = (int16_t)(int8_t)data[DS3231_ADDR_TEMP] << 2 | data[DS3231_ADDR_TEMP + 1] >> 6;
+
+    return true;
+}
+
+bool ds3231_get_epoch(i2c_dev_t *dev, time_t *epoch)
+{
+    struct tm time;
+
+    if (ds3231_get_time(dev, &time) != true) {
+        return false;
+    }
+
+    *epoch = ds3231_tm_to_epoch(&time);
+
+    return true;
+}
+
+time_t ds3231_tm_to_epoch(const struct tm *time)
+{
+    return (time_t)days_from_civil(time->tm_year + 1900, time->tm_mon + 1, time->tm_mday) * 86400
+        + time->tm_hour * 3600 + time->tm_min * 60 + time->tm_sec;
+}
+
+void ds3231_epoch_to_tm(time_t epoch, struct tm *time)
+{
+    int32_t days = (int32_t)(epoch / 86400);
+    int32_t secs = (int32_t)(epoch % 86400);
+    int32_t year;
+    uint32_t mon, mday;
+
+    if (secs < 0) {
+        secs += 86400;
+        days--;
+    }
+    civil_from_days(days, &year, &mon, &mday);
+
+    time->tm_sec = secs % 60;
+    time->tm_min = secs / 60 % 60;
+    time->tm_hour = secs / 3600;
+    time->tm_mday = mday;
+    time->tm_mon = mon - 1;
+    time->tm_year = year - 1900;
+    time->tm_wday = weekday_from_days(days);
+    time->tm_yday = days - days_from_civil(year, 1, 1);
+    time->tm_isdst = 0;
+}
+
+/* Offsets of the alarms in the alarm registers, alarm 2 directly follows
+ * the 4 registers of alarm 1 */
+#if DS3231_CFG_ALARMS
+#define ALARM1_OFFSET 0
+#define ALARM2_OFFSET (DS3231_ADDR_ALARM2 - DS3231_ADDR_ALARM1)
+
+/* Unchanged known registers written to join two changed ranges in one
+ * transaction, about the cost of the address and register bytes saved */
+#define ALARM_MERGE_GAP 2
+
+/* Build the alarm register image, only the registers of the selected alarms
+ * are filled, returns a bit per register filled */
+static uint8_t ds3231_alarm_image(uint8_t *data, ds3231_alarm_t alarms, struct tm *time1,
+        ds3231_alarm1_rate_t option1, struct tm *time2, ds3231_alarm2_rate_t option2)
+{
+    uint8_t *p;
+    uint8_t mask = 0;
+
     /* alarm 1 data */
-    if (alarms != DS3231_ALARM_2) {
-        data[i++] = (option1 >= DS3231_ALARM1_MATCH_SEC ? dec2bcd(time1->tm_sec) : DS3231_ALARM_NOTSET);
-        data[i++] = (option1 >= DS3231_ALARM1_MATCH_SECMIN ? dec2bcd(time1->tm_min) : DS3231_ALARM_NOTSET);
-        data[i++] = (option1 >= DS3231_ALARM1_MATCH_SECMINHOUR ? dec2bcd(time1->tm_hour) : DS3231_ALARM_NOTSET);
-        data[i++] = (option1 == DS3231_ALARM1_MATCH_SECMINHOURDAY ? (dec2bcd(time1->tm_wday + 1) & DS3231_ALARM_WDAY) :
+    if (alarms == DS3231_ALARM_1 || alarms == DS3231_ALARM_BOTH) {
+        p = data + ALARM1_OFFSET;
+        p[0] = (option1 >= DS3231_ALARM1_MATCH_SEC ? dec2bcd(time1->tm_sec) : DS3231_ALARM_NOTSET);
+        p[1] = (option1 >= DS3231_ALARM1_MATCH_SECMIN ? dec2bcd(time1->tm_min) : DS3231_ALARM_NOTSET);
+        p[2] = (option1 >= DS3231_ALARM1_MATCH_SECMINHOUR ? dec2bcd(time1->tm_hour) : DS3231_ALARM_NOTSET);
+        p[3] = (option1 == DS3231_ALARM1_MATCH_SECMINHOURDAY ? (dec2bcd(time1->tm_wday + 1) | DS3231_ALARM_WDAY) :
             (option1 == DS3231_ALARM1_MATCH_SECMINHOURDATE ? dec2bcd(time1->tm_mday) : DS3231_ALARM_NOTSET));
+        mask |= 0x0f << ALARM1_OFFSET;
     }
 
     /* alarm 2 data */
-    if (alarms != DS3231_ALARM_1) {
-        data[i++] = (option2 >= DS3231_ALARM2_MATCH_MIN ? dec2bcd(time2->tm_min) : DS3231_ALARM_NOTSET);
-        data[i++] = (option2 >= DS3231_ALARM2_MATCH_MINHOUR ? dec2bcd(time2->tm_hour) : DS3231_ALARM_NOTSET);
-        data[i++] = (option2 == DS3231_ALARM2_MATCH_MINHOURDAY ? (dec2bcd(time2->tm_wday + 1) & DS3231_ALARM_WDAY) :
+    if (alarms == DS3231_ALARM_2 || alarms == DS3231_ALARM_BOTH) {
+        p = data + ALARM2_OFFSET;
+        p[0] = (option2 >= DS3231_ALARM2_MATCH_MIN ? dec2bcd(time2->tm_min) : DS3231_ALARM_NOTSET);
+        p[1] = (option2 >= DS3231_ALARM2_MATCH_MINHOUR ? dec2bcd(time2->tm_hour) : DS3231_ALARM_NOTSET);
+        p[2] = (option2 == DS3231_ALARM2_MATCH_MINHOURDAY ? (dec2bcd(time2->tm_wday + 1) | DS3231_ALARM_WDAY) :
             (option2 == DS3231_ALARM2_MATCH_MINHOURDATE ? dec2bcd(time2->tm_mday) : DS3231_ALARM_NOTSET));
+        mask |= 0x07 << ALARM2_OFFSET;
+    }
+
+    return mask;
+}
+
+bool ds3231_set_alarm(i2c_dev_t *dev, ds3231_alarm_t alarms, struct tm *time1, ds3231_alarm1_rate_t option1,
+        struct tm *time2, ds3231_alarm2_rate_t option2)
+{
+    uint8_t data[DS3231_ALARM_BYTES];
+    uint8_t first, last;
+
+    uint8_t mask = ds3231_alarm_image(data, alarms, time1, option1, time2, option2);
+    if (mask == 0) {
+        return true;
+    }
+
+    /* the filled registers are contiguous */
+    for (first = 0; !(mask & (1 << first)); first++);
+    for (last = DS3231_ALARM_BYTES - 1; !(mask & (1 << last)); last--);
+
+    return hal_i2c_write_reg(dev, DS3231_ADDR_ALARM1 + first, data + first, last - first + 1);
+}
+
+void ds3231_alarm_cache_init(ds3231_alarm_cache_t *cache)
+{
+    cache->known = 0;
+}
+
+bool ds3231_alarm_cache_load(i2c_dev_t *dev, ds3231_alarm_cache_t *cache)
+{
+    cache->known = 0;
+
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_ALARM1, cache->image, DS3231_ALARM_BYTES) != true) {
+        return false;
+    }
+
+    cache->known = (1 << DS3231_ALARM_BYTES) - 1;
+    return true;
+}
+
+bool ds3231_set_alarm_cached(i2c_dev_t *dev, ds3231_alarm_cache_t *cache, ds3231_alarm_t alarms,
+        struct tm *time1, ds3231_alarm1_rate_t option1, struct tm *time2, ds3231_alarm2_rate_t option2)
+{
+    uint8_t data[DS3231_ALARM_BYTES];
+    uint8_t dirty = 0;
+
+    uint8_t mask = ds3231_alarm_image(data, alarms, time1, option1, time2, option2);
+    for (uint8_t i = 0; i < DS3231_ALARM_BYTES; i++) {
+        if ((mask & (1 << i)) && (!(cache->known & (1 << i)) || cache->image[i] != data[i])) {
+            dirty |= 1 << i;
+        }
     }
 
-    return hal_i2c_write_reg(dev, (alarms == DS3231_ALARM_2 ? DS3231_ADDR_ALARM2 : DS3231_ADDR_ALARM1), data, i);
+    /* write runs of changed registers, joined over short gaps of known ones */
+    uint8_t i = 0;
+    while (dirty >> i) {
+        if (!(dirty & (1 << i))) {
+            i++;
+            continue;
+        }
+
+        uint8_t first = i, last = i;
+        for (i++; i < DS3231_ALARM_BYTES; i++) {
+            if (dirty & (1 << i)) {
+                last = i;
+            } else if (i - last > ALARM_MERGE_GAP || !(cache->known & (1 << i))) {
+                break;
+            }
+        }
+
+        /* gap registers keep their known value */
+        for (uint8_t j = first; j <= last; j++) {
+            if (!(dirty & (1 << j))) {
+                data[j] = cache->image[j];
+            }
+        }
+
+        uint8_t run = ((1 << (last + 1)) - 1) & ~((1 << first) - 1);
+        if (hal_i2c_write_reg(dev, DS3231_ADDR_ALARM1 + first, data + first, last - first + 1) != true) {
+            cache->known &= ~run;
+            return false;
+        }
+        for (uint8_t j = first; j <= last; j++) {
+            cache->image[j] = data[j];
+        }
+        cache->known |= run;
+        i = last + 1;
+    }
+
+    return true;
 }
+#endif
 
+#if NEED_GET_FLAG
 /* Get a byte containing just the requested bits
  * pass the register address to read, a mask to apply to the register and
  * an uint* for the output
@@ -133,7 +522,9 @@ static bool ds3231_get_flag(i2c_dev_t *dev, uint8_t addr, uint8_t mask, uint8_t
     *flag = (data & mask);
     return true;
 }
+#endif
 
+#if NEED_SET_FLAG
 /* Set/clear bits in a byte register, or replace the byte altogether
  * pass the register address to modify, a byte to replace the existing
  * value with or containing the bits to set/clear and one of
@@ -158,9 +549,11 @@ static uint8_t ds3231_set_flag(i2c_dev_t *dev, uint8_t addr, uint8_t bits, uint8
         data &= ~bits;
     }
 
-    return hal_i2c_read_reg(dev, addr, &data, 1);
+    return hal_i2c_write_reg(dev, addr, &data, 1);
 }
+#endif
 
+#if DS3231_CFG_FLAGS
 bool ds3231_get_oscillator_stop_flag(i2c_dev_t *dev, bool *flag)
 {
     uint8_t f = 0;
@@ -176,7 +569,9 @@ bool ds3231_clear_oscillator_stop_flag(i2c_dev_t *dev)
 {
     return ds3231_set_flag(dev, DS3231_ADDR_STATUS, DS3231_STAT_OSCILLATOR, DS3231_CLEAR);
 }
+#endif
 
+#if DS3231_CFG_ALARMS
 bool ds3231_get_alarm_flags(i2c_dev_t *dev, ds3231_alarm_t *alarms)
 {
     return ds3231_get_flag(dev, DS3231_ADDR_STATUS, DS3231_ALARM_BOTH, (uint8_t *)alarms);
@@ -200,7 +595,9 @@ bool ds3231_disable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms)
      */
     return ds3231_set_flag(dev, DS3231_ADDR_CONTROL, alarms, DS3231_CLEAR);
 }
+#endif
 
+#if DS3231_CFG_32KHZ
 bool ds3231_enable_32khz(i2c_dev_t *dev)
 {
     return ds3231_set_flag(dev, DS3231_ADDR_STATUS, DS3231_STAT_32KHZ, DS3231_SET);
@@ -210,7 +607,9 @@ bool ds3231_disable_32khz(i2c_dev_t *dev)
 {
     return ds3231_set_flag(dev, DS3231_ADDR_STATUS, DS3231_STAT_32KHZ, DS3231_CLEAR);
 }
+#endif
 
+#if DS3231_CFG_SQUAREWAVE
 bool ds3231_enable_squarewave(i2c_dev_t *dev)
 {
     return ds3231_set_flag(dev, DS3231_ADDR_CONTROL, DS3231_CTRL_ALARM_INTS, DS3231_CLEAR);
@@ -232,7 +631,39 @@ bool ds3231_set_squarewave_freq(i2c_dev_t *dev, ds3231_sqwave_freq_t freq)
 
     return true;
 }
+#endif
 
+#if DS3231_CFG_POWER
+bool ds3231_set_power_profile(i2c_dev_t *dev, ds3231_power_profile_t profile, ds3231_alarm_t alarms)
+{
+    uint8_t data[2];
+
+    /* control, with INTCN set squarewave is off and RS selects 1Hz */
+    data[0] = DS3231_CTRL_ALARM_INTS;
+    /* status, writing 1 to a flag leaves it unchanged */
+    data[1] = DS3231_STAT_OSCILLATOR | DS3231_ALARM_BOTH;
+
+    switch (profile) {
+    case DS3231_POWER_RUN:
+        data[0] |= alarms;
+        data[1] |= DS3231_STAT_32KHZ;
+        break;
+    case DS3231_POWER_SLEEP:
+        data[0] |= DS3231_CTRL_BATTERY_SQW | alarms;
+        data[1] &= ~alarms;
+        break;
+    case DS3231_POWER_SHELF:
+        data[0] |= DS3231_CTRL_OSCILLATOR;
+        break;
+    default:
+        return false;
+    }
+
+    return hal_i2c_write_reg(dev, DS3231_ADDR_CONTROL, data, sizeof(data));
+}
+#endif
+
+#if DS3231_CFG_TEMPERATURE
 bool ds3231_get_raw_temp(i2c_dev_t *dev, int16_t *temp)
 {
     uint8_t data[2];
@@ -256,7 +687,9 @@ bool ds3231_get_temp_integer(i2c_dev_t *dev, int8_t *temp)
 
     return res;
 }
+#endif
 
+#if DS3231_CFG_TEMP_FLOAT
 bool ds3231_get_temp_float(i2c_dev_t *dev, float *temp)
 {
     int16_t t_int;
@@ -267,3 +700,31 @@ bool ds3231_get_temp_float(i2c_dev_t *dev, float *temp)
 
     return res;
 }
+#endif
+
+#if DS3231_CFG_AGING
+bool ds3231_get_aging_offset(i2c_dev_t *dev, int8_t *age)
+{
+    uint8_t data;
+
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_AGING, &data, 1) == true) {
+        *age = (int8_t)data;
+        return true;
+    }
+
+    return false;
+}
+
+bool ds3231_set_aging_offset(i2c_dev_t *dev, int8_t age)
+{
+    uint8_t data = (uint8_t)age;
+
+    if (hal_i2c_write_reg(dev, DS3231_ADDR_AGING, &data, 1) != true) {
+        return false;
+    }
+
+    /* The new value is applied at the next temperature conversion,
+     * force one instead of waiting up to 64 seconds */
+    return ds3231_set_flag(dev, DS3231_ADDR_CONTROL, DS3231_CTRL_TEMPCONV, DS3231_SET);
+}
+#endif
@@ -21,14 +21,56 @@
 extern "C" {
 #endif
 
+/**
+ * Feature groups, set to 0 to compile a group out, e.g. `-DDS3231_CFG_ALARMS=0`.
+ * Time, snapshot and epoch functions are always built. See tools/ds3231_size.sh
+ * for the size of each group.
+ */
+#ifndef DS3231_CFG_ALARMS
+#define DS3231_CFG_ALARMS      1  //!< Alarms, alarm flags and interrupts
+#endif
+#ifndef DS3231_CFG_FLAGS
+#define DS3231_CFG_FLAGS       1  //!< Oscillator stop flag
+#endif
+#ifndef DS3231_CFG_SQUAREWAVE
+#define DS3231_CFG_SQUAREWAVE  1  //!< Squarewave output and frequency
+#endif
+#ifndef DS3231_CFG_32KHZ
+#define DS3231_CFG_32KHZ       1  //!< 32kHz output
+#endif
+#ifndef DS3231_CFG_POWER
+#define DS3231_CFG_POWER       1  //!< Power profiles
+#endif
+#ifndef DS3231_CFG_TEMPERATURE
+#define DS3231_CFG_TEMPERATURE 1  //!< Raw and integer temperature
+#endif
+#ifndef DS3231_CFG_TEMP_FLOAT
+#define DS3231_CFG_TEMP_FLOAT  DS3231_CFG_TEMPERATURE  //!< Float temperature, pulls in soft float without an FPU
+#endif
+#ifndef DS3231_CFG_AGING
+#define DS3231_CFG_AGING       1  //!< Aging offset
+#endif
+#ifndef DS3231_CFG_CHECKED
+#define DS3231_CFG_CHECKED     1  //!< Time reads checked for corruption
+#endif
+#ifndef DS3231_CFG_FAST
+#define DS3231_CFG_FAST        1  //!< Prepared transfers for low jitter reads
+#endif
+
+#if DS3231_CFG_TEMP_FLOAT && !DS3231_CFG_TEMPERATURE
+#error "DS3231_CFG_TEMP_FLOAT needs DS3231_CFG_TEMPERATURE"
+#endif
+
 #define DS3231_ADDR 0x68
 
 #define DS3231_STAT_OSCILLATOR 0x80
 #define DS3231_STAT_32KHZ      0x08
+#define DS3231_STAT_BUSY       0x04
 #define DS3231_STAT_ALARM_2    0x02
 #define DS3231_STAT_ALARM_1    0x01
 
 #define DS3231_CTRL_OSCILLATOR    0x80
+#define DS3231_CTRL_BATTERY_SQW   0x40
 #define DS3231_CTRL_TEMPCONV      0x20
 #define DS3231_CTRL_ALARM_INTS    0x04
 #define DS3231_CTRL_ALARM2_INT    0x02
@@ -45,10 +87,27 @@ extern "C" {
 #define DS3231_ADDR_AGING   0x10
 #define DS3231_ADDR_TEMP    0x11
 
+#define DS3231_REG_COUNT    0x13
+
+#define DS3231_ALARM_BYTES  (DS3231_ADDR_CONTROL - DS3231_ADDR_ALARM1)
+
 #define DS3231_12HOUR_FLAG  0x40
 #define DS3231_12HOUR_MASK  0x1f
 #define DS3231_PM_FLAG      0x20
 #define DS3231_MONTH_MASK   0x1f
+#define DS3231_CENTURY_FLAG 0x80
+
+#define DS3231_YEAR_MIN     2000
+#define DS3231_YEAR_MAX     2199
+
+#define DS3231_AGING_PPB_PER_LSB 100
+
+/**
+ * Reads of `ds3231_get_time_checked` before giving up
+ */
+#ifndef DS3231_READ_ATTEMPTS
+#define DS3231_READ_ATTEMPTS 3
+#endif
 
 enum {
     DS3231_SET = 0,
@@ -99,8 +158,55 @@ typedef enum {
     DS3231_SQWAVE_8192HZ = 0x18
 } ds3231_sqwave_freq_t;
 
+/**
+ * Power profile, see `ds3231_set_power_profile`
+ */
+typedef enum {
+    DS3231_POWER_RUN = 0, //!< Oscillator and 32kHz output on, alarm interrupts on VCC only
+    DS3231_POWER_SLEEP,   //!< 32kHz output off, alarm interrupts kept on battery to wake the host
+    DS3231_POWER_SHELF    //!< Oscillator stopped on battery, all outputs off
+} ds3231_power_profile_t;
+
+/**
+ * Coherent copy of the device state
+ */
+typedef struct {
+    struct tm time;   //!< RTC time
+    uint8_t control;  //!< Control register
+    uint8_t status;   //!< Status register, `DS3231_STAT_*` flags
+    int8_t aging;     //!< Aging offset
+    int16_t temp;     //!< Raw temperature, 0.25 degrees Celsius units
+} ds3231_snapshot_t;
+
+/**
+ * Last alarm registers written to a device, see `ds3231_set_alarm_cached`
+ */
+typedef struct {
+    uint8_t image[DS3231_ALARM_BYTES];  //!< Alarm registers from `DS3231_ADDR_ALARM1`
+    uint8_t known;                      //!< Bit per register, set if `image` holds its value
+} ds3231_alarm_cache_t;
+
+#if DS3231_CFG_FAST
+/**
+ * Prepared transfers of the hot operations, see `ds3231_fast_init`
+ */
+typedef struct {
+    i2c_dev_t *dev;
+    hal_xfer_t time;        //!< Read of the time registers
+    hal_xfer_t status;      //!< Read of the status register
+    hal_xfer_t clear;       //!< Write of the status register clearing the alarm flags
+    uint8_t time_data[7];   //!< Read buffer of `time`
+    uint8_t status_data;    //!< Read buffer of `status`
+} ds3231_fast_t;
+#endif
+
 /**
  * @brief Initialize device descriptor
+ *
+ * Every other field of the descriptor is cleared: the default backend
+ * (HAL_DEFAULT_OPS), the default speed, no mux and no statistics. Use
+ * `ds3231_init_dev` to choose them.
+ *
  * @param dev I2C device descriptor
  * @param port I2C port
  * @param sda_gpio SDA GPIO
@@ -109,12 +215,26 @@ typedef enum {
  */
 bool ds3231_init(i2c_dev_t *dev, uint8_t port, uint8_t sda_gpio, uint8_t scl_gpio);
 
+/**
+ * @brief Initialize a device descriptor filled in by the caller
+ *
+ * Sets the address and keeps every other field, so unused ones must be
+ * zero, e.g. from a designated initializer:
+ *
+ *     i2c_dev_t dev = { .port = 1, .ops = &hal_linux_ops };
+ *     ds3231_init_dev(&dev);
+ *
+ * @param dev I2C device descriptor with port, pins, backend, speed and mux
+ * @return true to indicate success
+ */
+bool ds3231_init_dev(i2c_dev_t *dev);
+
 /**
  * @brief Free device descriptor
  * @param dev I2C device descriptor
  * @return true to indicate success
  */
-bool ds3231_free_desc(i2c_dev_t *dev);
+bool ds3231_free(i2c_dev_t *dev);
 
 /**
  * @brief Set the time on the RTC
@@ -122,18 +242,173 @@ bool ds3231_free_desc(i2c_dev_t *dev);
  * Timezone agnostic, pass whatever you like.
  * I suggest using GMT and applying timezone and DST when read back.
  *
- * @return true to indicate success
+ * `tm_year` counts years since 1900 as usual, years 2000 to 2199 are
+ * supported using the century flag. The day of week is derived from the
+ * date, `tm_wday` is ignored.
+ *
+ * @return true to indicate success, false for a year out of range
  */
 bool ds3231_set_time(i2c_dev_t *dev, struct tm *time);
 
 /**
  * @brief Get the time from the RTC, populates a supplied tm struct
+ *
+ * The chip takes 2100 for a leap year, its 2100-02-29 is returned as
+ * 2100-03-01. Reads never write to the RTC, see `ds3231_fix_leap_2100`
+ * for correcting the RTC itself.
+ *
  * @param dev Device descriptor
  * @param[out] time RTC time
  * @return true to indicate success
  */
 bool ds3231_get_time(i2c_dev_t *dev, struct tm *time);
 
+/**
+ * @brief Move the RTC from 2100-02-29 to 2100-03-01
+ *
+ * The chip counts 2100-02-29, from the next day on it is a day behind for
+ * the rest of the century. Call this at least once during that day, e.g.
+ * from a daily task, or set the time again afterwards. Only the date is
+ * written, the seconds keep running.
+ *
+ * @param dev Device descriptor
+ * @return true to indicate success, also if the date needed no correction
+ */
+bool ds3231_fix_leap_2100(i2c_dev_t *dev);
+
+#if DS3231_CFG_CHECKED
+/**
+ * @brief Get the time from the RTC, rejecting corrupted reads
+ *
+ * Like `ds3231_get_time`, but the registers are checked for bits that can
+ * not be set, invalid BCD digits, fields out of range, a date past the end
+ * of the month and a day of week that disagrees with the date. A failed
+ * check or transfer is read again, up to `DS3231_READ_ATTEMPTS` reads.
+ *
+ * The day of week must have been set from the date, as `ds3231_set_time` does,
+ * with 1 for Sunday. An RTC set by other software that counts from Monday, or
+ * leaves the day of week unset, fails every read until the time is set again.
+ * 2100-02-29 is returned as 2100-03-01 like `ds3231_get_time` does.
+ *
+ * @param dev Device descriptor
+ * @param[out] time RTC time
+ * @return true to indicate success, false if no read passed the checks
+ */
+bool ds3231_get_time_checked(i2c_dev_t *dev, struct tm *time);
+#endif
+
+/**
+ * @brief Get time, flags and temperature in a single transaction
+ *
+ * All registers are read in one burst, so the time is coherent, the
+ * same as from `ds3231_get_time`. The status register is not latched,
+ * its flags are those at the moment it is read and may already belong
+ * to the next second, e.g. an alarm flag set by the rollover that the
+ * time does not show yet. 2100-02-29 is returned as 2100-03-01 like
+ * `ds3231_get_time` does.
+ *
+ * @param dev Device descriptor
+ * @param[out] snap Device state
+ * @return true to indicate success
+ */
+bool ds3231_get_snapshot(i2c_dev_t *dev, ds3231_snapshot_t *snap);
+
+/**
+ * @brief Get the time from the RTC as seconds since the Unix epoch
+ *
+ * Assumes the RTC holds UTC.
+ *
+ * @param dev Device descriptor
+ * @param[out] epoch Seconds since 1970-01-01 00:00:00
+ * @return true to indicate success
+ */
+bool ds3231_get_epoch(i2c_dev_t *dev, time_t *epoch);
+
+/**
+ * @brief Convert a time read from the RTC to seconds since the Unix epoch
+ * @param time RTC time, e.g. from `ds3231_get_snapshot`
+ * @return Seconds since 1970-01-01 00:00:00
+ */
+time_t ds3231_tm_to_epoch(const struct tm *time);
+
+/**
+ * @brief Convert seconds since the Unix epoch to a time
+ *
+ * Fills every field of `time` including `tm_wday` and `tm_yday`, like `gmtime_r`.
+ *
+ * @param epoch Seconds since 1970-01-01 00:00:00
+ * @param[out] time Time
+ */
+void ds3231_epoch_to_tm(time_t epoch, struct tm *time);
+
+#if DS3231_CFG_FAST
+/**
+ * @brief Prepare the transfers of the hot operations
+ *
+ * Buffers and backend descriptors are built once, every `ds3231_fast_*`
+ * call then only starts its transfer, without setup work or copies, for
+ * a constant latency around the bus transaction. Backends without
+ * prepared transfers run the same calls through `hal_i2c_read_reg` and
+ * `hal_i2c_write_reg`.
+ *
+ * The status register is read once to keep the 32kHz output as it is in
+ * the alarm flag clearing write. Change the output with
+ * `ds3231_fast_set_32khz`, or prepare again after changing it otherwise,
+ * else the next clearing write restores it.
+ *
+ * @param f Prepared transfers, must stay in place, and in RAM, while in use
+ * @param dev Device descriptor, must outlive `f`
+ * @return true to indicate success
+ */
+bool ds3231_fast_init(ds3231_fast_t *f, i2c_dev_t *dev);
+
+/**
+ * @brief Get the time from the RTC with a prepared transfer
+ *
+ * Like `ds3231_get_time`, the transfer is started as soon as it is called
+ * and the RTC is never written.
+ *
+ * @param f Prepared transfers
+ * @param[out] time RTC time
+ * @return true to indicate success
+ */
+bool ds3231_fast_get_time(ds3231_fast_t *f, struct tm *time);
+
+/**
+ * @brief Get the status register with a prepared transfer
+ * @param f Prepared transfers
+ * @param[out] status Status register, `DS3231_STAT_*` flags
+ * @return true to indicate success
+ */
+bool ds3231_fast_get_status(ds3231_fast_t *f, uint8_t *status);
+
+/**
+ * @brief Clear both alarm flags with a prepared transfer
+ *
+ * Writes the status register without reading it first, the oscillator
+ * stop flag is kept.
+ *
+ * @param f Prepared transfers
+ * @return true to indicate success
+ */
+bool ds3231_fast_clear_alarm_flags(ds3231_fast_t *f);
+
+#if DS3231_CFG_32KHZ
+/**
+ * @brief Enable or disable the 32khz output and keep it in the prepared
+ * alarm flag clearing write
+ *
+ * **Supported only by DS3231**
+ *
+ * @param f Prepared transfers
+ * @param enable true to enable the output
+ * @return true to indicate success
+ */
+bool ds3231_fast_set_32khz(ds3231_fast_t *f, bool enable);
+#endif
+#endif
+
+#if DS3231_CFG_ALARMS
 /**
  * @brief Set alarms
  *
@@ -154,6 +429,41 @@ bool ds3231_get_time(i2c_dev_t *dev, struct tm *time);
 bool ds3231_set_alarm(i2c_dev_t *dev, ds3231_alarm_t alarms, struct tm *time1,
         ds3231_alarm1_rate_t option1, struct tm *time2, ds3231_alarm2_rate_t option2);
 
+/**
+ * @brief Forget the alarm registers of a cache
+ *
+ * The next `ds3231_set_alarm_cached` writes every selected register.
+ * Call after anything else wrote the alarms, or to resynchronize.
+ *
+ * @param cache Alarm cache
+ */
+void ds3231_alarm_cache_init(ds3231_alarm_cache_t *cache);
+
+/**
+ * @brief Fill an alarm cache from the device in one read
+ * @param dev Device descriptor
+ * @param cache Alarm cache
+ * @return true to indicate success
+ */
+bool ds3231_alarm_cache_load(i2c_dev_t *dev, ds3231_alarm_cache_t *cache);
+
+/**
+ * @brief Set alarms, writing only the registers that changed
+ *
+ * Same as `ds3231_set_alarm`, but the registers are compared with the last
+ * ones written through `cache` and only the changed range is written, in one
+ * transaction when the unchanged registers in between are known. Re-arming
+ * an unchanged alarm costs no bus traffic.
+ *
+ * @param dev Device descriptor
+ * @param cache Alarm cache of the device
+ * @return true to indicate success, on failure the registers written are forgotten
+ */
+bool ds3231_set_alarm_cached(i2c_dev_t *dev, ds3231_alarm_cache_t *cache, ds3231_alarm_t alarms,
+        struct tm *time1, ds3231_alarm1_rate_t option1, struct tm *time2, ds3231_alarm2_rate_t option2);
+#endif
+
+#if DS3231_CFG_FLAGS
 /**
  * @brief Check if oscillator has previously stopped
  *
@@ -172,7 +482,9 @@ bool ds3231_get_oscillator_stop_flag(i2c_dev_t *dev, bool *flag);
  * @return true to indicate success
  */
 bool ds3231_clear_oscillator_stop_flag(i2c_dev_t *dev);
+#endif
 
+#if DS3231_CFG_ALARMS
 /**
  * @brief Check which alarm(s) have past
  *
@@ -220,12 +532,17 @@ bool ds3231_enable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms);
  * @return true to indicate success
  */
 bool ds3231_disable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms);
+#endif
 
+#if DS3231_CFG_32KHZ
 /**
  * @brief Enable the output of 32khz signal
  *
  * **Supported only by DS3231**
  *
+ * A `ds3231_fast_t` of the device keeps the previous state in its alarm
+ * flag clearing write, use `ds3231_fast_set_32khz` with it instead.
+ *
  * @param dev Device descriptor
  * @return true to indicate success
  */
@@ -236,11 +553,16 @@ bool ds3231_enable_32khz(i2c_dev_t *dev);
  *
  * **Supported only by DS3231**
  *
+ * A `ds3231_fast_t` of the device keeps the previous state in its alarm
+ * flag clearing write, use `ds3231_fast_set_32khz` with it instead.
+ *
  * @param dev Device descriptor
  * @return true to indicate success
  */
 bool ds3231_disable_32khz(i2c_dev_t *dev);
+#endif
 
+#if DS3231_CFG_SQUAREWAVE
 /**
  * @brief Enable the squarewave output
  *
@@ -272,7 +594,36 @@ bool ds3231_disable_squarewave(i2c_dev_t *dev);
  * @return true to indicate success
  */
 bool ds3231_set_squarewave_freq(i2c_dev_t *dev, ds3231_sqwave_freq_t freq);
+#endif
+
+#if DS3231_CFG_POWER
+/**
+ * @brief Apply a power profile
+ *
+ * Writes the complete control and status configuration in one transaction,
+ * without reading it first:
+ *
+ * - `DS3231_POWER_RUN` runs the oscillator, outputs 32kHz and enables the
+ *   interrupts of `alarms`, INT/SQW stays inactive on battery.
+ * - `DS3231_POWER_SLEEP` turns the 32kHz output off, enables the interrupts
+ *   of `alarms` with INT/SQW also driven on battery and clears their past
+ *   flags so they do not fire immediately.
+ * - `DS3231_POWER_SHELF` stops the oscillator once on battery, the time is
+ *   lost and the oscillator stop flag is set on the next power up, for the
+ *   lowest battery drain in storage. `alarms` is ignored.
+ *
+ * Squarewave output is disabled and its frequency reset to 1Hz, other past
+ * flags and the oscillator stop flag are kept.
+ *
+ * @param dev Device descriptor
+ * @param profile Power profile
+ * @param alarms Alarm interrupts to enable
+ * @return true to indicate success
+ */
+bool ds3231_set_power_profile(i2c_dev_t *dev, ds3231_power_profile_t profile, ds3231_alarm_t alarms);
+#endif
 
+#if DS3231_CFG_TEMPERATURE
 /**
  * @brief Get the raw temperature value
  *
@@ -294,7 +645,9 @@ bool ds3231_get_raw_temp(i2c_dev_t *dev, int16_t *temp);
  * @return true to indicate success
  */
 bool ds3231_get_temp_integer(i2c_dev_t *dev, int8_t *temp);
+#endif
 
+#if DS3231_CFG_TEMP_FLOAT
 /**
  * @brief Get the temperature as a float
  *
@@ -305,6 +658,34 @@ bool ds3231_get_temp_integer(i2c_dev_t *dev, int8_t *temp);
  * @return true to indicate success
  */
 bool ds3231_get_temp_float(i2c_dev_t *dev, float *temp);
+#endif
+
+#if DS3231_CFG_AGING
+/**
+ * @brief Get the aging offset
+ *
+ * Signed trim value of the crystal load capacitance, one LSB is
+ * about 0.1 ppm at 25 degrees Celsius (`DS3231_AGING_PPB_PER_LSB`).
+ * Positive values slow the oscillator down.
+ *
+ * @param dev Device descriptor
+ * @param[out] age Aging offset
+ * @return true to indicate success
+ */
+bool ds3231_get_aging_offset(i2c_dev_t *dev, int8_t *age);
+
+/**
+ * @brief Set the aging offset
+ *
+ * Also starts a temperature conversion so the new offset takes effect
+ * immediately instead of at the next automatic conversion.
+ *
+ * @param dev Device descriptor
+ * @param age Aging offset
+ * @return true to indicate success
+ */
+bool ds3231_set_aging_offset(i2c_dev_t *dev, int8_t age);
+#endif
 
 #ifdef	__cplusplus
 }
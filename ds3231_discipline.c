@@ -0,0 +1,160 @@
+/*
+ * Aging offset calibration for DS3231
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_discipline.h"
+#include "hal/hal.h"
+
+#if !DS3231_CFG_AGING
+#error "ds3231_discipline needs DS3231_CFG_AGING"
+#endif
+
+#define NS_PER_SEC 1000000000ULL
+
+#define DISCIPLINE_MIN_SAMPLES 16
+#define DISCIPLINE_MIN_SPAN_NS (3600ULL * NS_PER_SEC)
+
+bool ds3231_discipline_init(ds3231_discipline_t *d, i2c_dev_t *dev, ds3231_ref_clock_t ref_clock, void *ref_arg)
+{
+    d->dev = dev;
+    d->ref_clock = ref_clock;
+    d->ref_arg = ref_arg;
+    d->min_samples = DISCIPLINE_MIN_SAMPLES;
+    d->min_span_ns = DISCIPLINE_MIN_SPAN_NS;
+    d->ppm = 0;
+    d->tempcomp = NULL;
+    d->temp = 0;
+    ds3231_discipline_reset(d);
+
+    return ds3231_get_aging_offset(dev, &d->aging);
+}
+
+void ds3231_discipline_reset(ds3231_discipline_t *d)
+{
+    d->samples = 0;
+    d->first_ns = 0;
+    d->last_ns = 0;
+    d->sx = d->sy = d->sxx = d->sxy = 0;
+}
+
+void ds3231_discipline_add_edge(ds3231_discipline_t *d, uint64_t ref_ns)
+{
+    if (d->samples == 0) {
+        d->first_ns = ref_ns;
+    }
+
+    /* Edges fall on whole RTC seconds, so the elapsed RTC time is the
+     * reference interval rounded to seconds as long as the accumulated
+     * error stays below half a second (~2.9 days at 2 ppm).
+     * x is elapsed reference time, y is how far the RTC is ahead of it. */
+    uint64_t elapsed = ref_ns - d->first_ns;
+    uint64_t rtc_elapsed = (elapsed + NS_PER_SEC / 2) / NS_PER_SEC * NS_PER_SEC;
+    double x = (double)elapsed;
+    double y = (double)(int64_t)(rtc_elapsed - elapsed);
+
+    d->sx += x;
+    d->sy += y;
+    d->sxx += x * x;
+    d->sxy += x * y;
+    d->last_ns = ref_ns;
+    d->samples++;
+}
+
+bool ds3231_discipline_capture(ds3231_discipline_t *d, uint32_t max_polls)
+{
+    uint8_t first, sec;
+    uint64_t before, after;
+
+    if (hal_i2c_read_reg(d->dev, DS3231_ADDR_TIME, &first, 1) != true) {
+        return false;
+    }
+    before = d->ref_clock(d->ref_arg);
+
+    while (max_polls--) {
+        if (hal_i2c_read_reg(d->dev, DS3231_ADDR_TIME, &sec, 1) != true) {
+            return false;
+        }
+        after = d->ref_clock(d->ref_arg);
+        if (sec != first) {
+            ds3231_discipline_add_edge(d, before + (after - before) / 2);
+            return true;
+        }
+        before = after;
+    }
+
+    return false;
+}
+
+/* Learn the estimate at the current temperature and start over */
+static bool discipline_learn(ds3231_discipline_t *d, bool *adjusted)
+{
+#if DS3231_CFG_TEMPERATURE
+    double ppb = d->ppm * 1000.0;
+
+    ds3231_discipline_reset(d);
+    if (ds3231_get_raw_temp(d->dev, &d->temp) != true) {
+        return false;
+    }
+    if (ds3231_tempcomp_learn(d->tempcomp, d->temp, (int32_t)(ppb < 0 ? ppb - 0.5 : ppb + 0.5)) && adjusted) {
+        *adjusted = true;
+    }
+
+    return true;
+#else
+    (void)adjusted;
+    ds3231_discipline_reset(d);
+    return false;
+#endif
+}
+
+bool ds3231_discipline_update(ds3231_discipline_t *d, bool *adjusted)
+{
+    if (adjusted) {
+        *adjusted = false;
+    }
+    if (d->samples < d->min_samples || d->samples < 2 || d->last_ns - d->first_ns < d->min_span_ns) {
+        return true;
+    }
+
+    double n = d->samples;
+    double den = n * d->sxx - d->sx * d->sx;
+    if (den <= 0) {
+        return true;
+    }
+
+    /* slope of the offset is the fractional frequency error */
+    d->ppm = (n * d->sxy - d->sx * d->sy) / den * 1e6;
+
+    if (d->tempcomp) {
+        return discipline_learn(d, adjusted);
+    }
+
+    double lsb = d->ppm * 1000.0 / DS3231_AGING_PPB_PER_LSB;
+    int32_t step = (int32_t)(lsb < 0 ? lsb - 0.5 : lsb + 0.5);
+    int32_t aging = d->aging + step;
+
+    if (aging > INT8_MAX) {
+        aging = INT8_MAX;
+    } else if (aging < INT8_MIN) {
+        aging = INT8_MIN;
+    }
+
+    ds3231_discipline_reset(d);
+    if (aging == d->aging) {
+        return true;
+    }
+
+    if (ds3231_set_aging_offset(d->dev, (int8_t)aging) != true) {
+        return false;
+    }
+    d->aging = (int8_t)aging;
+    if (adjusted) {
+        *adjusted = true;
+    }
+
+    return true;
+}
@@ -0,0 +1,117 @@
+/**
+ * Aging offset calibration for DS3231
+ *
+ * Estimates the frequency error of the RTC against a reference clock
+ * (host monotonic clock, GPS PPS, NTP disciplined clock...) with a
+ * least-squares fit over second edges and writes the aging register
+ * to null it.
+ *
+ * With a temperature compensation table attached, each fit is learned into
+ * the table at the current temperature instead, and the aging register is
+ * left alone, as changing it would shift every bin learned so far.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_DISCIPLINE_H__
+#define __DS3231_DISCIPLINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ds3231.h"
+#include "ds3231_tempcomp.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reference clock, returns nanoseconds of a monotonic timescale
+ */
+typedef uint64_t (*ds3231_ref_clock_t)(void *arg);
+
+/**
+ * Discipline state
+ */
+typedef struct {
+    i2c_dev_t *dev;
+    ds3231_ref_clock_t ref_clock;
+    void *ref_arg;
+    uint32_t min_samples;  //!< Samples required before the aging register is adjusted
+    uint64_t min_span_ns;  //!< Reference time the fit must cover before the aging register is adjusted
+    int8_t aging;          //!< Current aging offset
+    double ppm;            //!< Last frequency error estimate, positive if the RTC is fast
+    ds3231_tempcomp_t *tempcomp;  //!< Table learning the fits, NULL to write the aging register
+    int16_t temp;          //!< Raw temperature of the last fit learned into `tempcomp`
+    /* least-squares accumulators */
+    uint32_t samples;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    double sx, sy, sxx, sxy;
+} ds3231_discipline_t;
+
+/**
+ * @brief Initialize discipline state
+ *
+ * Reads the current aging offset, requires 16 samples over one hour by
+ * default and writes the aging register, set `tempcomp` to learn instead.
+ *
+ * @param d Discipline state
+ * @param dev Device descriptor
+ * @param ref_clock Reference clock
+ * @param ref_arg Argument passed to `ref_clock`
+ * @return true to indicate success
+ */
+bool ds3231_discipline_init(ds3231_discipline_t *d, i2c_dev_t *dev, ds3231_ref_clock_t ref_clock, void *ref_arg);
+
+/**
+ * @brief Add a second edge sample
+ *
+ * `ref_ns` is the reference time at which the RTC seconds register changed,
+ * e.g. a timestamp of the falling edge of the 1Hz squarewave.
+ *
+ * @param d Discipline state
+ * @param ref_ns Reference time of the edge
+ */
+void ds3231_discipline_add_edge(ds3231_discipline_t *d, uint64_t ref_ns);
+
+/**
+ * @brief Capture a second edge by polling the seconds register
+ *
+ * The edge is timestamped halfway between the last read that saw the old
+ * value and the first read that saw the new one.
+ *
+ * @param d Discipline state
+ * @param max_polls Number of reads after which to give up
+ * @return true to indicate success
+ */
+bool ds3231_discipline_capture(ds3231_discipline_t *d, uint32_t max_polls);
+
+/**
+ * @brief Estimate the frequency error and adjust the aging offset
+ *
+ * Does nothing until enough samples have been collected. After the aging
+ * register has been written the fit starts over, as the frequency changed.
+ * With `tempcomp` set the estimate is learned at the temperature read at the
+ * end of the fit, keep `min_span_ns` short against the temperature swings.
+ *
+ * @param d Discipline state
+ * @param[out] adjusted Set to true if the aging register was written or the
+ * table learned, may be NULL
+ * @return true to indicate success
+ */
+bool ds3231_discipline_update(ds3231_discipline_t *d, bool *adjusted);
+
+/**
+ * @brief Drop collected samples
+ * @param d Discipline state
+ */
+void ds3231_discipline_reset(ds3231_discipline_t *d);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_DISCIPLINE_H__ */
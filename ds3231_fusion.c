@@ -0,0 +1,304 @@
+/*
+ * Consensus time of redundant DS3231s
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_fusion.h"
+#include <math.h>
+
+#define NS_PER_SEC 1000000000LL
+
+/* Standard deviation of a read uniformly spread over a second, ns */
+#define READ_SIGMA_NS (NS_PER_SEC / 3.4641016151377544)
+
+typedef struct {
+    int64_t at;
+    int8_t type;  /* +1 interval start, -1 interval end */
+} fusion_edge_t;
+
+/* Marzullo's algorithm: the interval covered by most of the given ones,
+ * touching intervals overlap */
+static uint8_t fusion_marzullo(const int64_t *lo, const int64_t *hi, uint8_t mask, int64_t *best_lo, int64_t *best_hi)
+{
+    fusion_edge_t edges[2 * DS3231_FUSION_MAX];
+    uint8_t n = 0, count = 0, best = 0;
+
+    for (uint8_t i = 0; i < DS3231_FUSION_MAX; i++) {
+        if (mask & (1 << i)) {
+            edges[n++] = (fusion_edge_t){ lo[i], +1 };
+            edges[n++] = (fusion_edge_t){ hi[i], -1 };
+        }
+    }
+
+    /* insertion sort, starts before ends at the same point */
+    for (uint8_t i = 1; i < n; i++) {
+        fusion_edge_t e = edges[i];
+        uint8_t j = i;
+        while (j > 0 && (edges[j - 1].at > e.at || (edges[j - 1].at == e.at && edges[j - 1].type < e.type))) {
+            edges[j] = edges[j - 1];
+            j--;
+        }
+        edges[j] = e;
+    }
+
+    for (uint8_t i = 0; i < n; i++) {
+        if (edges[i].type > 0) {
+            if (++count > best) {
+                best = count;
+                *best_lo = edges[i].at;
+                *best_hi = edges[i + 1].at;
+            }
+        } else {
+            count--;
+        }
+    }
+
+    return best;
+}
+
+static uint8_t fusion_popcount(uint8_t mask)
+{
+    uint8_t n = 0;
+
+    for (; mask; mask &= mask - 1) {
+        n++;
+    }
+    return n;
+}
+
+void ds3231_fusion_reset_drift(ds3231_fusion_t *f, uint8_t index)
+{
+    ds3231_fusion_rtc_t *r = &f->rtc[index];
+
+    r->rate_ppm = 0;
+    r->drift_ppm = 0;
+    r->sigma_ppm = 0;
+    r->samples = 0;
+    r->sx = r->sy = r->sxx = r->sxy = 0;
+    r->flags &= ~DS3231_FUSION_DRIFT;
+}
+
+/* Add a read to the fit of the RTC time against the local time. x is the
+ * local time in seconds, y how far the RTC got ahead of it in ns, so the
+ * slope is in ppb. */
+static void fusion_fit(ds3231_fusion_rtc_t *r, uint64_t local)
+{
+    if (r->samples == 0) {
+        r->first_sec = r->sec;
+        r->first_local = local;
+    }
+
+    double x = (double)(local - r->first_local) / NS_PER_SEC;
+    double y = (double)((int64_t)(r->sec - r->first_sec) * NS_PER_SEC - (int64_t)(local - r->first_local));
+
+    r->sx += x;
+    r->sy += y;
+    r->sxx += x * x;
+    r->sxy += x * y;
+    r->last_local = local;
+    r->samples++;
+}
+
+static bool fusion_rate(const ds3231_fusion_t *f, ds3231_fusion_rtc_t *r)
+{
+    double n = r->samples;
+    double den = n * r->sxx - r->sx * r->sx;
+
+    if (r->samples < 2 || r->last_local - r->first_local < f->drift_span_ns || den <= 0) {
+        return false;
+    }
+    r->rate_ppm = (n * r->sxy - r->sx * r->sy) / den / 1000.0;
+    r->sigma_ppm = READ_SIGMA_NS * sqrt(n / den) / 1000.0;
+    return true;
+}
+
+/* Flag the RTCs whose rate is off the median rate of the fitted RTCs */
+static void fusion_drift(ds3231_fusion_t *f)
+{
+    double rates[DS3231_FUSION_MAX];
+    uint8_t fitted = 0, n = 0;
+
+    for (uint8_t i = 0; i < f->count; i++) {
+        if (fusion_rate(f, &f->rtc[i])) {
+            fitted |= 1 << i;
+            rates[n++] = f->rtc[i].rate_ppm;
+        }
+    }
+    if (n < 2) {
+        return;
+    }
+
+    for (uint8_t i = 1; i < n; i++) {
+        double v = rates[i];
+        uint8_t j = i;
+        while (j > 0 && rates[j - 1] > v) {
+            rates[j] = rates[j - 1];
+            j--;
+        }
+        rates[j] = v;
+    }
+    double median = n % 2 ? rates[n / 2] : (rates[n / 2 - 1] + rates[n / 2]) / 2;
+
+    for (uint8_t i = 0; i < f->count; i++) {
+        ds3231_fusion_rtc_t *r = &f->rtc[i];
+
+        if (!(fitted & (1 << i))) {
+            continue;
+        }
+        r->drift_ppm = r->rate_ppm - median;
+        double limit = f->max_drift_ppm + 3 * r->sigma_ppm;
+        if (f->max_drift_ppm > 0 && (r->drift_ppm > limit || r->drift_ppm < -limit)) {
+            r->flags |= DS3231_FUSION_DRIFT;
+        } else {
+            r->flags &= ~DS3231_FUSION_DRIFT;
+        }
+    }
+}
+
+bool ds3231_fusion_init(ds3231_fusion_t *f, ds3231_monotonic_t *clock, i2c_dev_t **devs, uint8_t count)
+{
+    if (count > DS3231_FUSION_MAX) {
+        return false;
+    }
+
+    f->clock = clock;
+    f->count = count;
+    f->tolerance_ns = 0;
+    f->max_drift_ppm = DS3231_FUSION_MAX_DRIFT_PPM;
+    f->drift_span_ns = DS3231_FUSION_DRIFT_SPAN_NS;
+    f->used = 0;
+    f->fused_ns = 0;
+    f->uncertainty_ns = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        f->rtc[i] = (ds3231_fusion_rtc_t){ .dev = devs[i] };
+        ds3231_fusion_reset_drift(f, i);
+    }
+
+    return true;
+}
+
+bool ds3231_fusion_sync(ds3231_fusion_t *f)
+{
+    ds3231_monotonic_t *m = f->clock;
+    int64_t lo[DS3231_FUSION_MAX], hi[DS3231_FUSION_MAX];
+    int64_t wide_lo[DS3231_FUSION_MAX], wide_hi[DS3231_FUSION_MAX];
+    uint64_t local0 = 0;
+    time_t ref = 0;
+    uint8_t voters = 0;
+
+    /* Intervals of the true time at the local time of the first read,
+     * relative to the seconds of the first RTC read */
+    for (uint8_t i = 0; i < f->count; i++) {
+        ds3231_fusion_rtc_t *r = &f->rtc[i];
+        ds3231_snapshot_t snap;
+
+        /* the chip latches the time on START */
+        uint64_t local = m->clock(m->clock_arg);
+
+        r->flags = (r->strikes >= DS3231_FUSION_STRIKES ? DS3231_FUSION_DIVERGED : 0)
+            | (r->flags & DS3231_FUSION_DRIFT);
+        if (ds3231_get_snapshot(r->dev, &snap) != true) {
+            r->flags |= DS3231_FUSION_BUS;
+            continue;
+        }
+        if (snap.status & DS3231_STAT_OSCILLATOR) {
+            ds3231_fusion_reset_drift(f, i);
+            r->flags |= DS3231_FUSION_OSF;
+            continue;
+        }
+
+        r->sec = ds3231_tm_to_epoch(&snap.time);
+        fusion_fit(r, local);
+        if (voters == 0) {
+            local0 = local;
+            ref = r->sec;
+        }
+        lo[i] = (int64_t)(r->sec - ref) * NS_PER_SEC - (int64_t)(local - local0);
+        hi[i] = lo[i] + NS_PER_SEC;
+        wide_lo[i] = lo[i] - (int64_t)f->tolerance_ns;
+        wide_hi[i] = hi[i] + (int64_t)f->tolerance_ns;
+        voters |= 1 << i;
+    }
+
+    fusion_drift(f);
+
+    if (voters == 0) {
+        return false;
+    }
+
+    int64_t best_lo = 0, best_hi = 0;
+    uint8_t best = fusion_marzullo(wide_lo, wide_hi, voters, &best_lo, &best_hi);
+    uint8_t agree = 0;
+
+    if (best * 2 > fusion_popcount(voters)) {
+        for (uint8_t i = 0; i < f->count; i++) {
+            if ((voters & (1 << i)) && wide_lo[i] <= best_lo && wide_hi[i] >= best_hi) {
+                agree |= 1 << i;
+            }
+        }
+    } else {
+        /* no majority, follow the first RTC of the previous consensus */
+        for (uint8_t i = 0; i < f->count && agree == 0; i++) {
+            if (voters & f->used & (1 << i)) {
+                agree = 1 << i;
+                best_lo = wide_lo[i];
+                best_hi = wide_hi[i];
+            }
+        }
+    }
+
+    if (agree == 0) {
+        return false;
+    }
+
+    /* middle of the intersection of the agreeing RTCs, of the widened
+     * consensus if they only agree within the tolerance */
+    int64_t in_lo = INT64_MIN, in_hi = INT64_MAX;
+    for (uint8_t i = 0; i < f->count; i++) {
+        if (agree & (1 << i)) {
+            in_lo = lo[i] > in_lo ? lo[i] : in_lo;
+            in_hi = hi[i] < in_hi ? hi[i] : in_hi;
+        }
+    }
+    if (in_lo > in_hi) {
+        in_lo = best_lo;
+        in_hi = best_hi;
+    }
+    int64_t mid = in_lo + (in_hi - in_lo) / 2;
+
+    for (uint8_t i = 0; i < f->count; i++) {
+        ds3231_fusion_rtc_t *r = &f->rtc[i];
+
+        if (!(voters & (1 << i))) {
+            continue;
+        }
+        r->offset_ns = lo[i] + NS_PER_SEC / 2 - mid;
+        if (agree & (1 << i)) {
+            r->strikes = 0;
+            r->flags &= ~DS3231_FUSION_DIVERGED;
+        } else {
+            r->flags |= DS3231_FUSION_OUTLIER;
+            if (r->strikes < UINT8_MAX) {
+                r->strikes++;
+            }
+            if (r->strikes >= DS3231_FUSION_STRIKES) {
+                r->flags |= DS3231_FUSION_DIVERGED;
+            }
+        }
+    }
+
+    f->used = agree;
+    f->fused_ns = (uint64_t)ref * NS_PER_SEC + mid;
+    f->uncertainty_ns = (uint64_t)(in_hi - in_lo) / 2;
+    ds3231_monotonic_update(m, f->fused_ns, f->uncertainty_ns, local0);
+
+    return true;
+}
+
+uint64_t ds3231_fusion_now(ds3231_fusion_t *f)
+{
+    return ds3231_monotonic_now(f->clock);
+}
@@ -0,0 +1,160 @@
+/**
+ * Consensus time of redundant DS3231s
+ *
+ * Each sync reads every RTC once, time and flags in one burst, tagged with
+ * the local clock of a `ds3231_monotonic_t`. An RTC read at second `t` puts
+ * the true time in [t, t + 1 s), shifted by the local time between the
+ * reads. Marzullo's algorithm finds the interval that most RTCs agree on,
+ * widened by a tolerance, and the fused time is the middle of the
+ * intersection of those RTCs. RTCs that failed the read or have the
+ * oscillator stop flag set do not vote, RTCs outside the consensus are
+ * marked as outliers, and as diverged after `DS3231_FUSION_STRIKES` syncs
+ * in a row.
+ *
+ * A drifting RTC stays within the consensus until its offset reaches a
+ * second, hours at tens of ppm. The rate of every RTC against the local
+ * clock is therefore fitted by least squares, and an RTC whose rate is
+ * off the median rate of the RTCs by more than `max_drift_ppm` plus three
+ * standard deviations of its fit is flagged, once the fit covers
+ * `drift_span_ns`. The deviation takes every read as uniformly spread over
+ * its second, which holds for syncs that are not locked to the RTC second.
+ * With two RTCs the median is their mean, both are flagged.
+ *
+ * The fused time steers the monotonic clock and is served from it, so
+ * `ds3231_fusion_now` costs no bus traffic and the loss of an RTC takes
+ * effect at the next sync without any additional read.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_FUSION_H__
+#define __DS3231_FUSION_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "ds3231.h"
+#include "ds3231_monotonic.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Largest number of RTCs fused
+ */
+#ifndef DS3231_FUSION_MAX
+#define DS3231_FUSION_MAX 4
+#endif
+
+/**
+ * Syncs in a row outside the consensus that mark an RTC as diverged
+ */
+#ifndef DS3231_FUSION_STRIKES
+#define DS3231_FUSION_STRIKES 3
+#endif
+
+/**
+ * Drift against the consensus that flags an RTC, ppm, and the local time
+ * the fit must cover first
+ */
+#ifndef DS3231_FUSION_MAX_DRIFT_PPM
+#define DS3231_FUSION_MAX_DRIFT_PPM 10.0
+#endif
+
+#ifndef DS3231_FUSION_DRIFT_SPAN_NS
+#define DS3231_FUSION_DRIFT_SPAN_NS (3600ULL * 1000000000ULL)
+#endif
+
+/**
+ * RTC flags, from the last sync
+ */
+#define DS3231_FUSION_BUS      0x01  //!< Read failed
+#define DS3231_FUSION_OSF      0x02  //!< Oscillator stop flag set
+#define DS3231_FUSION_OUTLIER  0x04  //!< Outside the consensus
+#define DS3231_FUSION_DIVERGED 0x08  //!< Outside the consensus for `DS3231_FUSION_STRIKES` syncs
+#define DS3231_FUSION_DRIFT    0x10  //!< Drift against the consensus beyond `max_drift_ppm`
+
+/**
+ * RTC state
+ */
+typedef struct {
+    i2c_dev_t *dev;
+    uint8_t flags;       //!< `DS3231_FUSION_*` flags
+    uint8_t strikes;     //!< Syncs in a row outside the consensus
+    time_t sec;          //!< Time read, seconds since the Unix epoch
+    int64_t offset_ns;   //!< Middle of its interval minus the fused time
+    double rate_ppm;     //!< Rate against the local clock, positive if the RTC is fast
+    double drift_ppm;    //!< Rate against the median rate, both valid once the fit covers `drift_span_ns`
+    double sigma_ppm;    //!< Standard deviation of the rate
+    /* least-squares fit of the RTC time against the local time */
+    uint32_t samples;
+    time_t first_sec;
+    uint64_t first_local;
+    uint64_t last_local;
+    double sx, sy, sxx, sxy;
+} ds3231_fusion_rtc_t;
+
+/**
+ * Fusion state
+ */
+typedef struct {
+    ds3231_monotonic_t *clock;  //!< Steered by the fused time, provides the local clock
+    ds3231_fusion_rtc_t rtc[DS3231_FUSION_MAX];
+    uint8_t count;
+    uint64_t tolerance_ns;      //!< Disagreement taken as agreement, 0 by default
+    double max_drift_ppm;       //!< Drift that flags an RTC, `DS3231_FUSION_MAX_DRIFT_PPM` by default, 0 disables
+    uint64_t drift_span_ns;     //!< Local time the drift fit must cover, `DS3231_FUSION_DRIFT_SPAN_NS` by default
+    uint8_t used;               //!< Bit per RTC in the last consensus
+    uint64_t fused_ns;          //!< Last fused time, nanoseconds since the Unix epoch
+    uint64_t uncertainty_ns;    //!< Its half width
+} ds3231_fusion_t;
+
+/**
+ * @brief Initialize the fusion
+ * @param f Fusion
+ * @param clock Monotonic clock, initialized with the local clock
+ * @param devs Device descriptors, one per RTC
+ * @param count Number of RTCs, up to `DS3231_FUSION_MAX`
+ * @return false if there are too many RTCs
+ */
+bool ds3231_fusion_init(ds3231_fusion_t *f, ds3231_monotonic_t *clock, i2c_dev_t **devs, uint8_t count);
+
+/**
+ * @brief Read all RTCs and steer the clock to the consensus
+ *
+ * A consensus needs a majority of the RTCs that could be read without the
+ * oscillator stop flag. Without one, e.g. two RTCs that disagree, the RTC
+ * that was in the previous consensus is followed, otherwise the clock
+ * keeps running on the local clock.
+ *
+ * @param f Fusion
+ * @return false if no time could be fused
+ */
+bool ds3231_fusion_sync(ds3231_fusion_t *f);
+
+/**
+ * @brief Restart the drift fit of an RTC
+ *
+ * Call after setting the time of an RTC, which steps it against the local
+ * clock. The fit also restarts when the RTC reports an oscillator stop.
+ *
+ * @param f Fusion
+ * @param index RTC, in the order given to `ds3231_fusion_init`
+ */
+void ds3231_fusion_reset_drift(ds3231_fusion_t *f, uint8_t index);
+
+/**
+ * @brief Get the fused time, without bus traffic
+ * @param f Fusion
+ * @return Nanoseconds since the Unix epoch, 0 until the first fused time
+ */
+uint64_t ds3231_fusion_now(ds3231_fusion_t *f);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_FUSION_H__ */
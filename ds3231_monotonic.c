@@ -0,0 +1,160 @@
+/*
+ * Monotonic clock disciplined by DS3231
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_monotonic.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+#define MONOTONIC_MAX_SLEW_PPM 500
+#define MONOTONIC_STEP_NS      (2 * NS_PER_SEC)
+
+typedef struct {
+    bool valid;
+    uint64_t base_local;
+    uint64_t base_out;
+    int64_t slew_ns;
+    int32_t slew_ppm;
+} monotonic_params_t;
+
+/* Output at a local time: elapsed local time plus the part of the
+ * pending correction applied so far */
+static uint64_t monotonic_eval(const monotonic_params_t *p, uint64_t local_ns)
+{
+    int64_t dt = (int64_t)(local_ns - p->base_local);
+    int64_t corr = dt / 1000000 * p->slew_ppm + dt % 1000000 * p->slew_ppm / 1000000;
+
+    if ((p->slew_ns >= 0 && corr > p->slew_ns) || (p->slew_ns < 0 && corr < p->slew_ns)) {
+        corr = p->slew_ns;
+    }
+    return p->base_out + dt + corr;
+}
+
+static void monotonic_load(const ds3231_monotonic_t *m, monotonic_params_t *p)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+        p->valid = m->valid;
+        p->base_local = m->base_local;
+        p->base_out = m->base_out;
+        p->slew_ns = m->slew_ns;
+        p->slew_ppm = m->slew_ppm;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&m->seq, __ATOMIC_RELAXED));
+}
+
+static void monotonic_store(ds3231_monotonic_t *m, const monotonic_params_t *p)
+{
+    uint32_t seq = m->seq;
+
+    __atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    m->valid = p->valid;
+    m->base_local = p->base_local;
+    m->base_out = p->base_out;
+    m->slew_ns = p->slew_ns;
+    m->slew_ppm = p->slew_ppm;
+    __atomic_store_n(&m->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void ds3231_monotonic_init(ds3231_monotonic_t *m, ds3231_local_clock_t clock, void *clock_arg)
+{
+    m->clock = clock;
+    m->clock_arg = clock_arg;
+    m->max_slew_ppm = MONOTONIC_MAX_SLEW_PPM;
+    m->step_ns = MONOTONIC_STEP_NS;
+    m->osf = false;
+    m->seq = 0;
+    m->valid = false;
+    m->base_local = 0;
+    m->base_out = 0;
+    m->slew_ns = 0;
+    m->slew_ppm = 0;
+    m->last = 0;
+}
+
+void ds3231_monotonic_update(ds3231_monotonic_t *m, uint64_t rtc_ns, uint64_t uncertainty_ns, uint64_t local_ns)
+{
+    monotonic_params_t p;
+
+    monotonic_load(m, &p);
+
+    if (!p.valid) {
+        p.valid = true;
+        p.base_local = local_ns;
+        p.base_out = rtc_ns;
+        p.slew_ns = 0;
+        p.slew_ppm = 0;
+        monotonic_store(m, &p);
+        return;
+    }
+
+    /* rebase on the sample, keeping what has been applied */
+    uint64_t out = monotonic_eval(&p, local_ns);
+    int64_t err = (int64_t)(rtc_ns - out);
+    uint64_t abs_err = err < 0 ? -(uint64_t)err : (uint64_t)err;
+
+    p.base_local = local_ns;
+    p.base_out = out;
+    p.slew_ns = 0;
+    p.slew_ppm = 0;
+
+    if (abs_err <= uncertainty_ns) {
+        /* within the noise of the sample */
+    } else if (err > 0 && abs_err >= m->step_ns) {
+        p.base_out += err;
+    } else {
+        p.slew_ns = err;
+        p.slew_ppm = err > 0 ? (int32_t)m->max_slew_ppm : -(int32_t)m->max_slew_ppm;
+    }
+
+    monotonic_store(m, &p);
+}
+
+bool ds3231_monotonic_sync(ds3231_monotonic_t *m, i2c_dev_t *dev)
+{
+    ds3231_snapshot_t snap;
+
+    if (ds3231_get_snapshot(dev, &snap) != true) {
+        return false;
+    }
+    uint64_t local_ns = m->clock(m->clock_arg);
+
+    m->osf = (snap.status & DS3231_STAT_OSCILLATOR) != 0;
+    if (m->osf) {
+        return false;
+    }
+
+    uint64_t rtc_ns = (uint64_t)ds3231_tm_to_epoch(&snap.time) * NS_PER_SEC + NS_PER_SEC / 2;
+    ds3231_monotonic_update(m, rtc_ns, NS_PER_SEC / 2, local_ns);
+
+    return true;
+}
+
+uint64_t ds3231_monotonic_now(ds3231_monotonic_t *m)
+{
+    monotonic_params_t p;
+
+    monotonic_load(m, &p);
+    if (!p.valid) {
+        return 0;
+    }
+
+    uint64_t now = monotonic_eval(&p, m->clock(m->clock_arg));
+    uint64_t last = __atomic_load_n(&m->last, __ATOMIC_RELAXED);
+
+    /* strictly increasing across all callers */
+    do {
+        if (now <= last) {
+            now = last + 1;
+        }
+    } while (!__atomic_compare_exchange_n(&m->last, &last, now, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return now;
+}
@@ -0,0 +1,100 @@
+/**
+ * Monotonic clock disciplined by DS3231
+ *
+ * Hands out strictly increasing 64-bit nanoseconds since the Unix epoch,
+ * extrapolated from a free running local clock and steered towards the RTC.
+ * Backwards steps of the RTC (`ds3231_set_time`, oscillator stop) are
+ * slewed out at a bounded rate instead of stepping, samples taken while
+ * the oscillator stop flag is set are ignored.
+ *
+ * `ds3231_monotonic_now` is lock-free and does no bus traffic. It uses 64-bit
+ * atomics, on cores without them (Cortex-M) the `__atomic_*_8` helpers
+ * must be provided.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_MONOTONIC_H__
+#define __DS3231_MONOTONIC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ds3231.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Local clock, returns nanoseconds of a free running counter
+ */
+typedef uint64_t (*ds3231_local_clock_t)(void *arg);
+
+/**
+ * Monotonic clock state
+ */
+typedef struct {
+    ds3231_local_clock_t clock;
+    void *clock_arg;
+    uint32_t max_slew_ppm;  //!< Steering rate, 500 ppm by default
+    uint64_t step_ns;       //!< Forward errors of at least this are stepped, 2 s by default
+    bool osf;               //!< Oscillator stop flag seen by the last sync
+    /* steering parameters, published with a sequence lock */
+    volatile uint32_t seq;
+    bool valid;
+    uint64_t base_local;    //!< Local clock at the last update
+    uint64_t base_out;      //!< Output at the last update
+    int64_t slew_ns;        //!< Correction still to apply
+    int32_t slew_ppm;       //!< Rate at which it is applied
+    uint64_t last;          //!< Last value handed out
+} ds3231_monotonic_t;
+
+/**
+ * @brief Initialize the clock
+ * @param m Monotonic clock
+ * @param clock Local clock
+ * @param clock_arg Argument passed to `clock`
+ */
+void ds3231_monotonic_init(ds3231_monotonic_t *m, ds3231_local_clock_t clock, void *clock_arg);
+
+/**
+ * @brief Steer the clock towards an RTC sample
+ *
+ * The first sample sets the clock, later ones are stepped only forward by
+ * at least `step_ns`, every other error outside of `uncertainty_ns` is slewed.
+ *
+ * @param m Monotonic clock
+ * @param rtc_ns RTC time, nanoseconds since the Unix epoch
+ * @param uncertainty_ns Errors within this are ignored
+ * @param local_ns Local clock when the RTC had `rtc_ns`
+ */
+void ds3231_monotonic_update(ds3231_monotonic_t *m, uint64_t rtc_ns, uint64_t uncertainty_ns, uint64_t local_ns);
+
+/**
+ * @brief Sample the RTC and steer the clock
+ *
+ * The RTC time is known to the second only, the sample is taken as the
+ * middle of the second with half a second of uncertainty. Samples taken
+ * at a second edge can be passed to `ds3231_monotonic_update` instead.
+ *
+ * @param m Monotonic clock
+ * @param dev Device descriptor
+ * @return false on a bus error or if the oscillator stop flag is set
+ */
+bool ds3231_monotonic_sync(ds3231_monotonic_t *m, i2c_dev_t *dev);
+
+/**
+ * @brief Get the time
+ * @param m Monotonic clock
+ * @return Nanoseconds since the Unix epoch, greater than any value returned before,
+ * 0 until the first sample
+ */
+uint64_t ds3231_monotonic_now(ds3231_monotonic_t *m);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_MONOTONIC_H__ */
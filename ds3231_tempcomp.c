@@ -0,0 +1,178 @@
+/*
+ * Temperature dependent drift compensation for DS3231
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_tempcomp.h"
+#include <string.h>
+
+#define TEMPCOMP_VERSION 1
+
+/* Raw temperature units per bin */
+#define TEMPCOMP_BIN_RAW 4
+
+static const uint8_t m_magic[3] = { 'D', 'T', 'C' };
+
+/* The blob stores the bin count and the weights in one byte each */
+typedef char tempcomp_bins_fit[DS3231_TEMPCOMP_BINS <= 255 ? 1 : -1];
+typedef char tempcomp_weight_fits[DS3231_TEMPCOMP_MAX_WEIGHT <= 255 ? 1 : -1];
+
+/* Offset from the start of the table in raw units, bin i is centered on
+ * i * TEMPCOMP_BIN_RAW */
+static int32_t tempcomp_pos(int16_t raw_temp)
+{
+    return (int32_t)raw_temp - DS3231_TEMPCOMP_MIN_TEMP * TEMPCOMP_BIN_RAW;
+}
+
+static uint16_t crc16_ccitt(const uint8_t *data, size_t size)
+{
+    uint16_t crc = 0xffff;
+
+    while (size--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+void ds3231_tempcomp_init(ds3231_tempcomp_t *tc)
+{
+    memset(tc, 0, sizeof(*tc));
+}
+
+bool ds3231_tempcomp_learn(ds3231_tempcomp_t *tc, int16_t raw_temp, int32_t ppb)
+{
+    int32_t pos = tempcomp_pos(raw_temp) + TEMPCOMP_BIN_RAW / 2;
+
+    if (pos < 0 || pos / TEMPCOMP_BIN_RAW >= DS3231_TEMPCOMP_BINS) {
+        return false;
+    }
+    if (ppb > INT16_MAX) {
+        ppb = INT16_MAX;
+    } else if (ppb < INT16_MIN) {
+        ppb = INT16_MIN;
+    }
+
+    int32_t i = pos / TEMPCOMP_BIN_RAW;
+    int32_t w = tc->weight[i];
+    int32_t sum = tc->ppb[i] * w + ppb;
+
+    /* cumulative average, then exponential once the weight saturates,
+     * rounded to nearest so a saturated bin is not pulled towards 0 */
+    if (sum >= 0) {
+        tc->ppb[i] = (int16_t)((sum + (w + 1) / 2) / (w + 1));
+    } else {
+        tc->ppb[i] = (int16_t)((sum - (w + 1) / 2) / (w + 1));
+    }
+    if (w < DS3231_TEMPCOMP_MAX_WEIGHT) {
+        tc->weight[i]++;
+    }
+
+    return true;
+}
+
+int32_t ds3231_tempcomp_lookup(const ds3231_tempcomp_t *tc, int16_t raw_temp)
+{
+    int32_t pos = tempcomp_pos(raw_temp);
+    int32_t lo = -1, hi = -1;
+
+    /* nearest learned bins at or below and above the temperature */
+    for (int32_t i = 0; i < DS3231_TEMPCOMP_BINS; i++) {
+        if (tc->weight[i] == 0) {
+            continue;
+        }
+        if (i * TEMPCOMP_BIN_RAW <= pos) {
+            lo = i;
+        } else {
+            hi = i;
+            break;
+        }
+    }
+
+    if (lo < 0 && hi < 0) {
+        return 0;
+    }
+    if (lo < 0) {
+        return tc->ppb[hi];
+    }
+    if (hi < 0) {
+        return tc->ppb[lo];
+    }
+
+    int32_t span = (hi - lo) * TEMPCOMP_BIN_RAW;
+    int32_t off = pos - lo * TEMPCOMP_BIN_RAW;
+    return tc->ppb[lo] + (tc->ppb[hi] - tc->ppb[lo]) * off / span;
+}
+
+uint64_t ds3231_tempcomp_correct(const ds3231_tempcomp_t *tc, int16_t raw_temp, uint64_t elapsed_ns)
+{
+    int64_t ppb = ds3231_tempcomp_lookup(tc, raw_temp);
+
+    /* a fast RTC counts more than the true interval */
+    int64_t err = (int64_t)(elapsed_ns / 1000000000ULL) * ppb
+        + (int64_t)(elapsed_ns % 1000000000ULL) * ppb / 1000000000LL;
+
+    return elapsed_ns - err;
+}
+
+size_t ds3231_tempcomp_save(const ds3231_tempcomp_t *tc, uint8_t *buf, size_t size)
+{
+    uint8_t *p = buf;
+
+    if (size < DS3231_TEMPCOMP_BLOB_SIZE) {
+        return 0;
+    }
+
+    memcpy(p, m_magic, sizeof(m_magic));
+    p += sizeof(m_magic);
+    *p++ = TEMPCOMP_VERSION;
+    *p++ = (uint8_t)(int8_t)DS3231_TEMPCOMP_MIN_TEMP;
+    *p++ = DS3231_TEMPCOMP_BINS;
+    *p++ = 0;
+    *p++ = 0;
+
+    for (int i = 0; i < DS3231_TEMPCOMP_BINS; i++) {
+        uint16_t v = (uint16_t)tc->ppb[i];
+        *p++ = v & 0xff;
+        *p++ = v >> 8;
+        *p++ = tc->weight[i];
+    }
+
+    uint16_t crc = crc16_ccitt(buf, p - buf);
+    *p++ = crc & 0xff;
+    *p++ = crc >> 8;
+
+    return p - buf;
+}
+
+bool ds3231_tempcomp_load(ds3231_tempcomp_t *tc, const uint8_t *buf, size_t size)
+{
+    const uint8_t *p = buf;
+
+    if (size < DS3231_TEMPCOMP_BLOB_SIZE) {
+        return false;
+    }
+    if (memcmp(p, m_magic, sizeof(m_magic)) != 0 || p[3] != TEMPCOMP_VERSION
+            || (int8_t)p[4] != DS3231_TEMPCOMP_MIN_TEMP || p[5] != DS3231_TEMPCOMP_BINS) {
+        return false;
+    }
+
+    size_t len = DS3231_TEMPCOMP_BLOB_SIZE - 2;
+    if (crc16_ccitt(buf, len) != (buf[len] | (uint16_t)buf[len + 1] << 8)) {
+        return false;
+    }
+
+    p += 8;
+    for (int i = 0; i < DS3231_TEMPCOMP_BINS; i++) {
+        tc->ppb[i] = (int16_t)(p[0] | (uint16_t)p[1] << 8);
+        tc->weight[i] = p[2];
+        p += 3;
+    }
+
+    return true;
+}
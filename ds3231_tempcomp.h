@@ -0,0 +1,120 @@
+/**
+ * Temperature dependent drift compensation for DS3231
+ *
+ * Per-unit table of the residual frequency error left by the TCXO,
+ * learned against a reference and indexed by the raw temperature of
+ * `ds3231_get_raw_temp`, with a compact binary format for persistence.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_TEMPCOMP_H__
+#define __DS3231_TEMPCOMP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Lowest temperature covered by the table, degrees Celsius
+ */
+#ifndef DS3231_TEMPCOMP_MIN_TEMP
+#define DS3231_TEMPCOMP_MIN_TEMP (-40)
+#endif
+
+/**
+ * Number of 1 degree Celsius bins
+ */
+#ifndef DS3231_TEMPCOMP_BINS
+#define DS3231_TEMPCOMP_BINS 128
+#endif
+
+/**
+ * Weight after which learning turns into an exponential moving average
+ */
+#ifndef DS3231_TEMPCOMP_MAX_WEIGHT
+#define DS3231_TEMPCOMP_MAX_WEIGHT 64
+#endif
+
+/**
+ * Size of a serialized table in bytes
+ */
+#define DS3231_TEMPCOMP_BLOB_SIZE (8 + DS3231_TEMPCOMP_BINS * 3 + 2)
+
+/**
+ * Compensation table
+ */
+typedef struct {
+    int16_t ppb[DS3231_TEMPCOMP_BINS];    //!< Frequency error, parts per billion, positive if the RTC is fast
+    uint8_t weight[DS3231_TEMPCOMP_BINS]; //!< Number of samples, 0 for an empty bin
+} ds3231_tempcomp_t;
+
+/**
+ * @brief Clear all bins
+ * @param tc Compensation table
+ */
+void ds3231_tempcomp_init(ds3231_tempcomp_t *tc);
+
+/**
+ * @brief Add a frequency error measurement
+ * @param tc Compensation table
+ * @param raw_temp Temperature in 0.25 degrees Celsius units
+ * @param ppb Measured frequency error, parts per billion
+ * @return false if the temperature is outside of the table
+ */
+bool ds3231_tempcomp_learn(ds3231_tempcomp_t *tc, int16_t raw_temp, int32_t ppb);
+
+/**
+ * @brief Get the frequency error at a temperature
+ *
+ * Interpolates linearly between the nearest learned bins,
+ * returns 0 if nothing was learned yet.
+ *
+ * @param tc Compensation table
+ * @param raw_temp Temperature in 0.25 degrees Celsius units
+ * @return Frequency error, parts per billion
+ */
+int32_t ds3231_tempcomp_lookup(const ds3231_tempcomp_t *tc, int16_t raw_temp);
+
+/**
+ * @brief Correct a time interval extrapolated from the RTC
+ * @param tc Compensation table
+ * @param raw_temp Temperature over the interval, 0.25 degrees Celsius units
+ * @param elapsed_ns Interval as counted by the RTC
+ * @return Interval in true time
+ */
+uint64_t ds3231_tempcomp_correct(const ds3231_tempcomp_t *tc, int16_t raw_temp, uint64_t elapsed_ns);
+
+/**
+ * @brief Serialize the table
+ *
+ * Little-endian blob: "DTC" magic, version, minimum temperature, bin count,
+ * two reserved bytes, 3 bytes (ppb, weight) per bin and a CRC-16/CCITT.
+ *
+ * @param tc Compensation table
+ * @param[out] buf Output buffer
+ * @param size Size of `buf`, at least `DS3231_TEMPCOMP_BLOB_SIZE`
+ * @return Number of bytes written, 0 if the buffer is too small
+ */
+size_t ds3231_tempcomp_save(const ds3231_tempcomp_t *tc, uint8_t *buf, size_t size);
+
+/**
+ * @brief Deserialize the table
+ * @param[out] tc Compensation table
+ * @param buf Serialized table
+ * @param size Size of `buf`
+ * @return false if the blob is corrupt or was built with a different layout
+ */
+bool ds3231_tempcomp_load(ds3231_tempcomp_t *tc, const uint8_t *buf, size_t size);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_TEMPCOMP_H__ */
@@ -0,0 +1,136 @@
+/*
+ * High resolution timebase from the DS3231 32kHz output
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_timebase.h"
+#include "hal/hal_counter.h"
+
+#if !DS3231_CFG_32KHZ
+#error "ds3231_timebase needs DS3231_CFG_32KHZ"
+#endif
+
+#define NS_PER_SEC 1000000000ULL
+
+static uint64_t timebase_count(ds3231_timebase_t *tb)
+{
+    uint32_t raw = hal_counter_read(tb->counter);
+
+    tb->count += (uint32_t)(raw - tb->last);
+    tb->last = raw;
+
+    return tb->count;
+}
+
+bool ds3231_timebase_init(ds3231_timebase_t *tb, i2c_dev_t *dev, uint8_t counter, uint8_t pin)
+{
+    tb->dev = dev;
+    tb->counter = counter;
+    tb->valid = false;
+    tb->base_sec = 0;
+    tb->base_count = 0;
+    tb->window = 0;
+    tb->count = 0;
+
+    if (ds3231_enable_32khz(dev) != true || hal_counter_init(counter, pin) != true) {
+        return false;
+    }
+    tb->last = hal_counter_read(counter);
+
+    return true;
+}
+
+bool ds3231_timebase_sync(ds3231_timebase_t *tb, uint32_t max_polls)
+{
+    ds3231_snapshot_t snap;
+    uint8_t first, sec;
+    uint64_t lo, hi, before;
+
+    lo = timebase_count(tb);
+    if (hal_i2c_read_reg(tb->dev, DS3231_ADDR_TIME, &first, 1) != true) {
+        return false;
+    }
+
+    /* The chip latches the registers on START, somewhere within each read.
+     * The edge came after the START of the last read that saw the old
+     * second, so after the count taken before it, and before the START of
+     * the read that sees the new one, so before the count taken after it. */
+    for (;;) {
+        if (max_polls-- == 0) {
+            return false;
+        }
+        before = timebase_count(tb);
+        if (hal_i2c_read_reg(tb->dev, DS3231_ADDR_TIME, &sec, 1) != true) {
+            return false;
+        }
+        hi = timebase_count(tb);
+        if (sec != first) {
+            break;
+        }
+        lo = before;
+    }
+
+    if (ds3231_get_snapshot(tb->dev, &snap) != true) {
+        return false;
+    }
+    /* edges were lost while the output was off, e.g. turned off by a
+     * clearing write prepared before it was enabled */
+    if ((snap.status & DS3231_STAT_OSCILLATOR) || !(snap.status & DS3231_STAT_32KHZ)) {
+        tb->valid = false;
+        return false;
+    }
+    if (snap.time.tm_sec != (sec >> 4) * 10 + (sec & 0x0f)) {
+        /* another edge passed before the time was read */
+        return false;
+    }
+    time_t rtc_sec = ds3231_tm_to_epoch(&snap.time);
+
+    if (tb->valid && rtc_sec >= tb->base_sec) {
+        uint64_t hi_p = tb->base_count + (uint64_t)(rtc_sec - tb->base_sec) * DS3231_TIMEBASE_HZ;
+        uint64_t lo_p = hi_p - tb->window;
+
+        /* both brackets hold the edge, it is in their overlap */
+        if (lo <= hi_p && lo_p <= hi) {
+            lo = lo > lo_p ? lo : lo_p;
+            hi = hi < hi_p ? hi : hi_p;
+        }
+    }
+
+    tb->base_sec = rtc_sec;
+    tb->base_count = hi;
+    tb->window = (uint32_t)(hi - lo);
+    tb->valid = true;
+
+    return true;
+}
+
+bool ds3231_timebase_now(ds3231_timebase_t *tb, time_t *sec, uint32_t *ticks)
+{
+    if (!tb->valid) {
+        return false;
+    }
+
+    uint64_t elapsed = timebase_count(tb) - tb->base_count;
+
+    *sec = tb->base_sec + (time_t)(elapsed / DS3231_TIMEBASE_HZ);
+    if (ticks) {
+        *ticks = (uint32_t)(elapsed % DS3231_TIMEBASE_HZ);
+    }
+
+    return true;
+}
+
+uint64_t ds3231_timebase_now_ns(ds3231_timebase_t *tb)
+{
+    time_t sec;
+    uint32_t ticks;
+
+    if (ds3231_timebase_now(tb, &sec, &ticks) != true) {
+        return 0;
+    }
+
+    return (uint64_t)sec * NS_PER_SEC + (uint64_t)ticks * NS_PER_SEC / DS3231_TIMEBASE_HZ;
+}
@@ -0,0 +1,105 @@
+/**
+ * High resolution timebase from the DS3231 32kHz output
+ *
+ * Counts the edges of the TCXO driven 32.768kHz output with a hardware
+ * counter (hal/hal_counter.h) and combines the count with the RTC seconds
+ * captured once at a second edge. The time then has 1/32768 s (~30.5 us)
+ * resolution and the accuracy of the RTC, and reading it costs no bus traffic.
+ *
+ * The 32kHz output and the seconds come from the same oscillator, so every
+ * second starts on a count boundary. A sync brackets it between the counts
+ * around the polls that saw the second change, later syncs narrow the
+ * bracket, and one that misses it (time set, oscillator stopped) starts
+ * over. The time is taken from the latest end of the bracket, so it may
+ * be late by the bracket width but is never ahead of the RTC. Syncs at
+ * random phases narrow the bracket to about the bus time of a poll.
+ *
+ * The counter is extended to 64 bits on every read. Read the time at
+ * least every 2^32 edges (~36 hours) and from one context at a time.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_TIMEBASE_H__
+#define __DS3231_TIMEBASE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "ds3231.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Edges per second of the 32kHz output
+ */
+#define DS3231_TIMEBASE_HZ 32768
+
+/**
+ * Timebase state
+ */
+typedef struct {
+    i2c_dev_t *dev;
+    uint8_t counter;      //!< Counter id, see `hal_counter_init`
+    bool valid;           //!< Set by the first successful sync
+    time_t base_sec;      //!< RTC second starting at `base_count`
+    uint64_t base_count;  //!< Extended count at the start of `base_sec`, the latest it may be
+    uint32_t window;      //!< Edges since the earliest the start may be
+    uint64_t count;       //!< Extended count at the last read
+    uint32_t last;        //!< Raw count at the last read
+} ds3231_timebase_t;
+
+/**
+ * @brief Enable the 32kHz output and start counting it
+ *
+ * A `ds3231_fast_t` of the device prepared before would turn the output
+ * off again on its next alarm flag clearing write, prepare it again after
+ * this or enable the output with `ds3231_fast_set_32khz` first.
+ *
+ * @param tb Timebase
+ * @param dev Device descriptor
+ * @param counter Counter id, see `hal_counter_init`
+ * @param pin GPIO connected to the 32kHz output
+ * @return true to indicate success
+ */
+bool ds3231_timebase_init(ds3231_timebase_t *tb, i2c_dev_t *dev, uint8_t counter, uint8_t pin);
+
+/**
+ * @brief Align the count with the RTC seconds
+ *
+ * Polls the seconds register until it changes and reads the time, a bus
+ * read per poll, so it takes up to a second. The faster the polls, the
+ * narrower the bracket of a single sync.
+ *
+ * @param tb Timebase
+ * @param max_polls Polls before giving up
+ * @return false on a bus error, no second edge within `max_polls`, or if
+ * the oscillator stop flag is set or the 32kHz output is off
+ */
+bool ds3231_timebase_sync(ds3231_timebase_t *tb, uint32_t max_polls);
+
+/**
+ * @brief Get the time, without bus traffic
+ * @param tb Timebase
+ * @param[out] sec Seconds since the Unix epoch
+ * @param[out] ticks Edges into the second, 0 to `DS3231_TIMEBASE_HZ` - 1, may be NULL
+ * @return false until synced
+ */
+bool ds3231_timebase_now(ds3231_timebase_t *tb, time_t *sec, uint32_t *ticks);
+
+/**
+ * @brief Get the time in nanoseconds, without bus traffic
+ * @param tb Timebase
+ * @return Nanoseconds since the Unix epoch, 0 until synced
+ */
+uint64_t ds3231_timebase_now_ns(ds3231_timebase_t *tb);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_TIMEBASE_H__ */
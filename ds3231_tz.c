@@ -0,0 +1,108 @@
+/*
+ * Time zone and DST conversion for DS3231
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_tz.h"
+
+static const ds3231_tz_type_t m_utc_types[] = {
+    { 0, 0, 0 },
+};
+
+const ds3231_tz_t ds3231_tz_utc = {
+    .name = "UTC",
+    .count = 0,
+    .times = NULL,
+    .indices = NULL,
+    .types = m_utc_types,
+    .abbrs = "UTC",
+};
+
+const ds3231_tz_type_t *ds3231_tz_lookup(const ds3231_tz_t *tz, time_t utc)
+{
+    uint16_t lo = 0, hi = tz->count;
+
+    /* number of transitions at or before utc */
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (tz->times[mid] <= utc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo == 0 ? &tz->types[0] : &tz->types[tz->indices[lo - 1]];
+}
+
+const char *ds3231_tz_abbr(const ds3231_tz_t *tz, const ds3231_tz_type_t *type)
+{
+    return tz->abbrs + type->abbr;
+}
+
+const ds3231_tz_type_t *ds3231_tz_localtime(const ds3231_tz_t *tz, time_t utc, struct tm *local)
+{
+    const ds3231_tz_type_t *type = ds3231_tz_lookup(tz, utc);
+
+    ds3231_epoch_to_tm(utc + type->utoff, local);
+    local->tm_isdst = type->isdst;
+
+    return type;
+}
+
+time_t ds3231_tz_to_utc(const ds3231_tz_t *tz, const struct tm *local)
+{
+    time_t wall = ds3231_tm_to_epoch(local);
+
+    /* Offsets a day either side, transitions are further apart than that.
+     * Each gives a candidate that is valid if it maps back to the same offset. */
+    const ds3231_tz_type_t *before = ds3231_tz_lookup(tz, wall - 86400);
+    const ds3231_tz_type_t *after = ds3231_tz_lookup(tz, wall + 86400);
+    time_t utc_before = wall - before->utoff;
+    time_t utc_after = wall - after->utoff;
+    bool before_ok = ds3231_tz_lookup(tz, utc_before)->utoff == before->utoff;
+    bool after_ok = ds3231_tz_lookup(tz, utc_after)->utoff == after->utoff;
+
+    if (before_ok && after_ok && utc_before != utc_after) {
+        /* repeated local time */
+        if (local->tm_isdst == before->isdst && local->tm_isdst != after->isdst) {
+            return utc_before;
+        }
+        if (local->tm_isdst == after->isdst && local->tm_isdst != before->isdst) {
+            return utc_after;
+        }
+        return utc_before < utc_after ? utc_before : utc_after;
+    }
+
+    if (!before_ok && after_ok) {
+        return utc_after;
+    }
+
+    /* unique, or skipped local time */
+    return utc_before;
+}
+
+bool ds3231_get_localtime(i2c_dev_t *dev, const ds3231_tz_t *tz, struct tm *local)
+{
+    time_t utc;
+
+    if (ds3231_get_epoch(dev, &utc) != true) {
+        return false;
+    }
+
+    ds3231_tz_localtime(tz, utc, local);
+
+    return true;
+}
+
+bool ds3231_set_localtime(i2c_dev_t *dev, const ds3231_tz_t *tz, const struct tm *local)
+{
+    struct tm time;
+
+    ds3231_epoch_to_tm(ds3231_tz_to_utc(tz, local), &time);
+
+    return ds3231_set_time(dev, &time);
+}
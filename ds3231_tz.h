@@ -0,0 +1,119 @@
+/**
+ * Time zone and DST conversion for DS3231
+ *
+ * Keep the RTC on UTC and convert on read with a precomputed table of
+ * transitions, laid out like the data block of a TZif file: ascending
+ * transition times, the local time type in effect from each of them, the
+ * types and their abbreviations. Lookup is a binary search over the times,
+ * there is no heap, no filesystem and no TZ database on the target.
+ *
+ * Tables are generated at build time from the host's zoneinfo with
+ * tools/ds3231_tzgen.py, which expands the rules into explicit transitions
+ * for the years the RTC can hold.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_TZ_H__
+#define __DS3231_TZ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "ds3231.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Local time type, as the ttinfo of TZif
+ */
+typedef struct {
+    int32_t utoff;  //!< Seconds east of UTC
+    uint8_t isdst;  //!< 1 if daylight saving time
+    uint8_t abbr;   //!< Index of the abbreviation in `abbrs`
+} ds3231_tz_type_t;
+
+/**
+ * Time zone
+ *
+ * Before the first transition, or with no transitions at all, `types[0]` applies.
+ */
+typedef struct {
+    const char *name;               //!< Zone name, e.g. "Europe/Berlin"
+    uint16_t count;                 //!< Number of transitions
+    const int64_t *times;           //!< Transition times, UTC seconds since the epoch, ascending
+    const uint8_t *indices;         //!< Type in effect from each transition
+    const ds3231_tz_type_t *types;  //!< Local time types, at least one
+    const char *abbrs;              //!< NUL separated abbreviations
+} ds3231_tz_t;
+
+/**
+ * UTC, without transitions
+ */
+extern const ds3231_tz_t ds3231_tz_utc;
+
+/**
+ * @brief Find the local time type in effect at a time
+ * @param tz Time zone
+ * @param utc UTC seconds since the epoch
+ * @return Local time type
+ */
+const ds3231_tz_type_t *ds3231_tz_lookup(const ds3231_tz_t *tz, time_t utc);
+
+/**
+ * @brief Abbreviation of a local time type, e.g. "CEST"
+ * @param tz Time zone
+ * @param type Local time type of `tz`
+ * @return Abbreviation
+ */
+const char *ds3231_tz_abbr(const ds3231_tz_t *tz, const ds3231_tz_type_t *type);
+
+/**
+ * @brief Convert UTC to local time, like `localtime_r`
+ * @param tz Time zone
+ * @param utc UTC seconds since the epoch
+ * @param[out] local Local time, with `tm_isdst` set
+ * @return Local time type applied
+ */
+const ds3231_tz_type_t *ds3231_tz_localtime(const ds3231_tz_t *tz, time_t utc, struct tm *local);
+
+/**
+ * @brief Convert local time to UTC, like `mktime`
+ *
+ * A local time repeated at the end of DST is resolved by `tm_isdst` when it
+ * is 0 or 1, otherwise the earlier one is taken. A local time skipped at the
+ * start of DST is taken with the offset before the transition.
+ *
+ * @param tz Time zone
+ * @param local Local time
+ * @return UTC seconds since the epoch
+ */
+time_t ds3231_tz_to_utc(const ds3231_tz_t *tz, const struct tm *local);
+
+/**
+ * @brief Get the local time from the RTC, which must hold UTC
+ * @param dev Device descriptor
+ * @param tz Time zone
+ * @param[out] local Local time
+ * @return true to indicate success
+ */
+bool ds3231_get_localtime(i2c_dev_t *dev, const ds3231_tz_t *tz, struct tm *local);
+
+/**
+ * @brief Set the RTC to UTC from a local time
+ * @param dev Device descriptor
+ * @param tz Time zone
+ * @param local Local time, see `ds3231_tz_to_utc`
+ * @return true to indicate success
+ */
+bool ds3231_set_localtime(i2c_dev_t *dev, const ds3231_tz_t *tz, const struct tm *local);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_TZ_H__ */
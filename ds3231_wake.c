@@ -0,0 +1,188 @@
+/*
+ * Wake scheduler for low-power hosts
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_wake.h"
+
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_US  1000ULL
+
+void ds3231_wake_init(ds3231_wake_t *w, i2c_dev_t *dev, const ds3231_wake_config_t *config)
+{
+    w->dev = dev;
+    w->config = config;
+    ds3231_alarm_cache_init(&w->cache);
+    w->count = 0;
+    w->ints_enabled = false;
+    w->flag_clear = false;
+    w->alarm_armed = false;
+    w->alarm_ns = 0;
+    w->timer_wakes = 0;
+    w->alarm_wakes = 0;
+}
+
+bool ds3231_wake_add(ds3231_wake_t *w, uint64_t deadline_ns, uint64_t slack_ns, uint32_t id)
+{
+    uint8_t i;
+
+    if (w->count >= DS3231_WAKE_MAX) {
+        return false;
+    }
+
+    /* kept in deadline order */
+    for (i = w->count; i > 0 && w->entries[i - 1].deadline_ns > deadline_ns; i--) {
+        w->entries[i] = w->entries[i - 1];
+    }
+    w->entries[i].deadline_ns = deadline_ns;
+    w->entries[i].latest_ns = deadline_ns + slack_ns;
+    w->entries[i].id = id;
+    w->count++;
+
+    return true;
+}
+
+/* Charge above the INT/SQW sleep current, nA us */
+static uint64_t wake_timer_cost(const ds3231_wake_config_t *c, uint64_t sleep_ns)
+{
+    uint64_t wakes = c->timer_max_ns ? (sleep_ns + c->timer_max_ns - 1) / c->timer_max_ns : 1;
+    uint32_t extra_na = c->timer_sleep_na > c->alarm_sleep_na ? c->timer_sleep_na - c->alarm_sleep_na : 0;
+
+    return (uint64_t)extra_na * (sleep_ns / NS_PER_US)
+        + wakes * c->active_na * (c->timer_wake_ns / NS_PER_US);
+}
+
+static uint64_t wake_alarm_cost(const ds3231_wake_config_t *c, uint64_t rest_ns)
+{
+    uint64_t cost = (uint64_t)c->active_na * ((c->alarm_program_ns + c->alarm_wake_ns) / NS_PER_US);
+
+    return rest_ns ? cost + wake_timer_cost(c, rest_ns) : cost;
+}
+
+static bool wake_arm(ds3231_wake_t *w, time_t sec)
+{
+    struct tm time;
+
+    ds3231_epoch_to_tm(sec, &time);
+    if (ds3231_set_alarm_cached(w->dev, &w->cache, DS3231_ALARM_1, &time, DS3231_ALARM1_MATCH_SECMINHOURDATE,
+            NULL, DS3231_ALARM2_EVERY_MIN) != true) {
+        return false;
+    }
+    if (!w->flag_clear) {
+        if (ds3231_clear_alarm_flags(w->dev, DS3231_ALARM_1) != true) {
+            return false;
+        }
+        w->flag_clear = true;
+    }
+    if (!w->ints_enabled) {
+        if (ds3231_enable_alarm_ints(w->dev, DS3231_ALARM_1) != true) {
+            return false;
+        }
+        w->ints_enabled = true;
+    }
+
+    return true;
+}
+
+bool ds3231_wake_plan(ds3231_wake_t *w, uint64_t now_ns, ds3231_wake_plan_t *plan)
+{
+    const ds3231_wake_config_t *c = w->config;
+
+    plan->source = DS3231_WAKE_NONE;
+    plan->count = 0;
+    if (w->count == 0) {
+        return true;
+    }
+
+    /* an alarm that may have fired unseen left its past flag set */
+    if (w->alarm_armed && now_ns + NS_PER_SEC >= w->alarm_ns) {
+        w->flag_clear = false;
+    }
+
+    /* as late as the most urgent deadline allows, serving all due by then */
+    uint64_t wake = UINT64_MAX;
+    for (uint8_t i = 0; i < w->count; i++) {
+        if (w->entries[i].latest_ns < wake) {
+            wake = w->entries[i].latest_ns;
+        }
+    }
+    if (wake < now_ns) {
+        wake = now_ns;
+    }
+    while (plan->count < w->count && w->entries[plan->count].deadline_ns <= wake) {
+        plan->count++;
+    }
+    plan->wake_ns = wake;
+
+    /* last second edge leaving the wake latency, after the alarm is written */
+    uint64_t sleep = wake - now_ns;
+    uint64_t alarm_sec = wake > c->alarm_wake_ns ? (wake - c->alarm_wake_ns) / NS_PER_SEC : 0;
+    bool res = true;
+
+    if (alarm_sec > now_ns / NS_PER_SEC + DS3231_WAKE_ALARM_MAX_S) {
+        alarm_sec = now_ns / NS_PER_SEC + DS3231_WAKE_ALARM_MAX_S;
+    }
+    if (alarm_sec * NS_PER_SEC > now_ns + c->alarm_program_ns) {
+        uint64_t alarm_ns = alarm_sec * NS_PER_SEC;
+        uint64_t up_ns = alarm_ns + c->alarm_wake_ns;
+
+        if (wake_alarm_cost(c, wake > up_ns ? wake - up_ns : 0) < wake_timer_cost(c, sleep)) {
+            if (wake_arm(w, (time_t)alarm_sec)) {
+                plan->source = DS3231_WAKE_ALARM;
+                plan->fire_ns = alarm_ns;
+                w->alarm_armed = true;
+                w->alarm_ns = alarm_ns;
+                w->alarm_wakes++;
+                return true;
+            }
+            w->flag_clear = false;
+            w->ints_enabled = false;
+            res = false;
+        }
+    }
+
+    /* an alarm left armed would fire during the timer sleep, the flag it
+     * sets has to be cleared before the next arm */
+    if (w->alarm_armed) {
+        w->flag_clear = false;
+        if (ds3231_disable_alarm_ints(w->dev, DS3231_ALARM_1)) {
+            w->alarm_armed = false;
+        } else {
+            res = false;
+        }
+        w->ints_enabled = false;
+    }
+
+    plan->source = DS3231_WAKE_TIMER;
+    plan->fire_ns = sleep > c->timer_wake_ns ? wake - c->timer_wake_ns : now_ns;
+    if (c->timer_max_ns && plan->fire_ns - now_ns > c->timer_max_ns) {
+        plan->fire_ns = now_ns + c->timer_max_ns;
+    }
+    w->timer_wakes++;
+
+    return res;
+}
+
+size_t ds3231_wake_due(ds3231_wake_t *w, uint64_t now_ns, uint32_t *ids, size_t max)
+{
+    size_t n = 0;
+
+    if (w->alarm_armed && now_ns >= w->alarm_ns) {
+        w->alarm_armed = false;
+        w->flag_clear = ds3231_clear_alarm_flags(w->dev, DS3231_ALARM_1);
+    }
+
+    while (n < w->count && n < max && w->entries[n].deadline_ns <= now_ns) {
+        ids[n] = w->entries[n].id;
+        n++;
+    }
+    for (uint8_t i = n; i < w->count; i++) {
+        w->entries[i - n] = w->entries[i];
+    }
+    w->count -= n;
+
+    return n;
+}
@@ -0,0 +1,168 @@
+/**
+ * Wake scheduler for low-power hosts
+ *
+ * Plans the next wake-up from a set of deadlines and chooses its source:
+ * the MCU timer, which keeps the MCU in a light sleep, or ALARM1 on the
+ * INT/SQW pin, which allows the deepest sleep the host has but costs the
+ * alarm programming and a slower wake-up. The choice compares the charge
+ * of both from the configured currents and latencies, so short sleeps
+ * stay on the timer and long ones go to the RTC without per application
+ * tuning.
+ *
+ * ALARM1 has a resolution of one second. It is set to the last second
+ * edge that leaves the alarm wake latency before the deadline, and the
+ * rest is covered by the MCU timer after the wake-up.
+ *
+ * Every deadline can be served late by its slack. A wake-up is planned
+ * at the latest time the most urgent deadline allows, and serves every
+ * deadline due by then, so nearby deadlines share one wake-up.
+ *
+ * Times are nanoseconds since the Unix epoch on the RTC timescale, e.g.
+ * from `ds3231_monotonic_now`.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_WAKE_H__
+#define __DS3231_WAKE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ds3231.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#if !DS3231_CFG_ALARMS
+#error "ds3231_wake needs DS3231_CFG_ALARMS"
+#endif
+
+/**
+ * Largest number of pending deadlines
+ */
+#ifndef DS3231_WAKE_MAX
+#define DS3231_WAKE_MAX 8
+#endif
+
+/**
+ * Longest sleep on one alarm. ALARM1 matches the date, so it must fire
+ * within the shortest month, longer sleeps wake up and plan again.
+ */
+#define DS3231_WAKE_ALARM_MAX_S (27 * 86400)
+
+/**
+ * Wake-up source
+ */
+typedef enum {
+    DS3231_WAKE_NONE = 0,  //!< Nothing to wait for
+    DS3231_WAKE_TIMER,     //!< Sleep on the MCU timer
+    DS3231_WAKE_ALARM      //!< Sleep until INT/SQW, ALARM1 has been armed
+} ds3231_wake_source_t;
+
+/**
+ * Host power model, currents in nA and times in ns
+ */
+typedef struct {
+    uint32_t timer_sleep_na;    //!< Sleep current with the MCU timer running
+    uint32_t alarm_sleep_na;    //!< Sleep current waiting for INT/SQW only
+    uint32_t active_na;         //!< Current while awake
+    uint32_t timer_wake_ns;     //!< Wake-up latency from the timer sleep
+    uint32_t alarm_wake_ns;     //!< Wake-up latency from the INT/SQW sleep, e.g. a boot from System OFF
+    uint32_t alarm_program_ns;  //!< Time awake to program the alarm
+    uint64_t timer_max_ns;      //!< Longest delay of the MCU timer, longer sleeps take several wake-ups
+} ds3231_wake_config_t;
+
+/**
+ * Wake-up plan
+ */
+typedef struct {
+    ds3231_wake_source_t source;
+    uint64_t wake_ns;   //!< Time the batch is due
+    uint64_t fire_ns;   //!< Time the source fires, the MCU timer delay follows from it
+    uint8_t count;      //!< Deadlines served by this wake-up
+} ds3231_wake_plan_t;
+
+/**
+ * Pending deadline
+ */
+typedef struct {
+    uint64_t deadline_ns;
+    uint64_t latest_ns;  //!< Deadline plus slack
+    uint32_t id;
+} ds3231_wake_entry_t;
+
+/**
+ * Scheduler state
+ */
+typedef struct {
+    i2c_dev_t *dev;
+    const ds3231_wake_config_t *config;
+    ds3231_alarm_cache_t cache;  //!< ALARM1 registers, re-arming the same second costs no write
+    ds3231_wake_entry_t entries[DS3231_WAKE_MAX];
+    uint8_t count;
+    bool ints_enabled;           //!< ALARM1 interrupt known to be enabled
+    bool flag_clear;             //!< ALARM1 past flag known to be clear
+    bool alarm_armed;            //!< ALARM1 armed and not yet seen firing
+    uint64_t alarm_ns;           //!< Its time
+    uint32_t timer_wakes;        //!< Plans on the MCU timer
+    uint32_t alarm_wakes;        //!< Plans on ALARM1
+} ds3231_wake_t;
+
+/**
+ * @brief Initialize the scheduler
+ * @param w Scheduler
+ * @param dev Device descriptor, INT/SQW wired to a wake-up pin of the host
+ * @param config Host power model, kept by reference
+ */
+void ds3231_wake_init(ds3231_wake_t *w, i2c_dev_t *dev, const ds3231_wake_config_t *config);
+
+/**
+ * @brief Add a deadline
+ * @param w Scheduler
+ * @param deadline_ns Time the application needs to run at
+ * @param slack_ns How late it may run, lets the scheduler batch it with later deadlines
+ * @param id Returned by `ds3231_wake_due`
+ * @return false if `DS3231_WAKE_MAX` deadlines are pending
+ */
+bool ds3231_wake_add(ds3231_wake_t *w, uint64_t deadline_ns, uint64_t slack_ns, uint32_t id);
+
+/**
+ * @brief Plan the next wake-up and arm the RTC if it is chosen
+ *
+ * Arm the MCU timer for `fire_ns` - `now_ns` for `DS3231_WAKE_TIMER`, or
+ * enter the INT/SQW sleep for `DS3231_WAKE_ALARM`. A wake-up from ALARM1
+ * is early by up to a second plus the wake latency, call `ds3231_wake_due`
+ * and plan again, which covers the rest with the timer.
+ *
+ * An alarm armed by an earlier plan is disarmed when the timer is chosen.
+ *
+ * @param w Scheduler
+ * @param now_ns Current time
+ * @param[out] plan Plan
+ * @return false if arming the alarm failed, the plan falls back to the
+ * timer, or if disarming an earlier one failed
+ */
+bool ds3231_wake_plan(ds3231_wake_t *w, uint64_t now_ns, ds3231_wake_plan_t *plan);
+
+/**
+ * @brief Take the deadlines that are due after a wake-up
+ *
+ * Also clears the ALARM1 past flag if the RTC was armed, releasing INT/SQW.
+ *
+ * @param w Scheduler
+ * @param now_ns Current time
+ * @param[out] ids Ids of the due deadlines, in deadline order
+ * @param max Size of `ids`, deadlines beyond it stay pending
+ * @return Number of ids written
+ */
+size_t ds3231_wake_due(ds3231_wake_t *w, uint64_t now_ns, uint32_t *ids, size_t max);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_WAKE_H__ */
@@ -0,0 +1,275 @@
+/**
+ * I2C Hardware Abstraction Layer
+ *
+ * Dispatches to the backend of each device, selects the mux channel in
+ * front of it and records statistics and traces for all of them in one place.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal.h"
+#include <string.h>
+
+#ifndef HAL_DEFAULT_OPS
+#error "define HAL_DEFAULT_OPS to the backend of descriptors without one, e.g. -DHAL_DEFAULT_OPS=hal_nrf5_ops"
+#endif
+
+extern const hal_ops_t HAL_DEFAULT_OPS;
+
+/* Mux last written on a bus, 0 if none or disabled. Another mux never has
+ * a channel enabled. While not known, e.g. after a failed write, `addr`
+ * may have any of its channels enabled. */
+typedef struct {
+    const hal_ops_t *ops;
+    uint8_t addr;
+    uint8_t channel;
+    bool known;
+} hal_mux_sel_t;
+
+static hal_mux_sel_t m_mux[HAL_MUX_PORTS];
+
+static const hal_ops_t *hal_ops(const i2c_dev_t *dev)
+{
+    return dev->ops ? dev->ops : &HAL_DEFAULT_OPS;
+}
+
+bool hal_i2c_init(const i2c_dev_t *dev)
+{
+    const hal_ops_t *ops = hal_ops(dev);
+
+    return ops->init(dev);
+}
+
+bool hal_i2c_free(const i2c_dev_t *dev)
+{
+    const hal_ops_t *ops = hal_ops(dev);
+
+    return ops->free(dev);
+}
+
+static bool hal_write(const hal_ops_t *ops, const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size)
+{
+    uint8_t retries = 0;
+    HAL_STATS_BEGIN();
+    HAL_TRACE_BEGIN();
+
+    bool res = ops->write_reg(dev, reg, out_data, out_size, &retries);
+
+    HAL_STATS_END(dev, true, out_size, res, retries);
+    HAL_TRACE_END(dev, true, reg, out_data, out_size, res, retries);
+    return res;
+}
+
+static bool hal_read(const hal_ops_t *ops, const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size)
+{
+    uint8_t retries = 0;
+    HAL_STATS_BEGIN();
+    HAL_TRACE_BEGIN();
+
+    bool res = ops->read_reg(dev, reg, in_data, in_size, &retries);
+
+    HAL_STATS_END(dev, false, in_size, res, retries);
+    HAL_TRACE_END(dev, false, reg, in_data, in_size, res, retries);
+    return res;
+}
+
+/* The control register of the mux is its only one, written as the
+ * register address of an empty write */
+static bool hal_mux_write(const hal_ops_t *ops, const i2c_dev_t *dev, uint8_t mux_addr, uint8_t mask)
+{
+    i2c_dev_t mux = *dev;
+
+    mux.addr = mux_addr;
+    return hal_write(ops, &mux, mask, &mask, 0);
+}
+
+static bool hal_mux_select(const hal_ops_t *ops, const i2c_dev_t *dev)
+{
+    hal_mux_sel_t *sel = dev->port < HAL_MUX_PORTS ? &m_mux[dev->port] : NULL;
+
+    if (sel == NULL) {
+        /* nothing cached, `hal_mux_release` disables the channel again */
+        return dev->mux_addr == 0 || hal_mux_write(ops, dev, dev->mux_addr, 1 << dev->mux_channel);
+    }
+    if (sel->known && sel->ops == ops && sel->addr == dev->mux_addr
+            && (dev->mux_addr == 0 || sel->channel == dev->mux_channel)) {
+        return true;
+    }
+
+    /* a channel of another mux, or any channel for a device without a mux,
+     * would answer at the same address */
+    if (sel->ops == ops && sel->addr != 0 && sel->addr != dev->mux_addr) {
+        if (hal_mux_write(ops, dev, sel->addr, 0) != true) {
+            sel->known = false;
+            return false;
+        }
+        sel->addr = 0;
+        sel->known = true;
+    }
+    if (dev->mux_addr == 0) {
+        return true;
+    }
+
+    sel->ops = ops;
+    sel->addr = dev->mux_addr;
+    sel->known = false;
+    if (hal_mux_write(ops, dev, dev->mux_addr, 1 << dev->mux_channel) != true) {
+        return false;
+    }
+    sel->channel = dev->mux_channel;
+    sel->known = true;
+
+    return true;
+}
+
+/* Disable the channel after a transaction on a port without a cache */
+static bool hal_mux_release(const hal_ops_t *ops, const i2c_dev_t *dev)
+{
+    if (dev->mux_addr == 0 || dev->port < HAL_MUX_PORTS) {
+        return true;
+    }
+    return hal_mux_write(ops, dev, dev->mux_addr, 0);
+}
+
+static void hal_mux_forget(const i2c_dev_t *dev)
+{
+    if (dev->mux_addr != 0 && dev->port < HAL_MUX_PORTS) {
+        m_mux[dev->port].known = false;
+    }
+}
+
+bool hal_i2c_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size)
+{
+    const hal_ops_t *ops = hal_ops(dev);
+
+    if (hal_mux_select(ops, dev) != true) {
+        return false;
+    }
+
+    bool res = hal_write(ops, dev, reg, out_data, out_size);
+    if (res != true) {
+        hal_mux_forget(dev);
+    }
+    return hal_mux_release(ops, dev) && res;
+}
+
+bool hal_i2c_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size)
+{
+    const hal_ops_t *ops = hal_ops(dev);
+
+    if (hal_mux_select(ops, dev) != true) {
+        return false;
+    }
+
+    bool res = hal_read(ops, dev, reg, in_data, in_size);
+    if (res != true) {
+        hal_mux_forget(dev);
+    }
+    return hal_mux_release(ops, dev) && res;
+}
+
+bool hal_i2c_prepare(const i2c_dev_t *dev, hal_xfer_t *xfer, bool write, uint8_t reg, void *data, size_t size)
+{
+    const hal_ops_t *ops = hal_ops(dev);
+
+    if (write && size > HAL_XFER_MAX_WRITE) {
+        return false;
+    }
+
+    xfer->dev = dev;
+    xfer->ops = ops;
+    xfer->write = write;
+    xfer->out[0] = reg;
+    xfer->size = size;
+    if (write) {
+        memcpy(xfer->out + 1, data, size);
+        xfer->data = xfer->out + 1;
+    } else {
+        xfer->data = data;
+    }
+
+    xfer->prepared = ops->prepare && ops->run && ops->prepare(dev, xfer);
+    return xfer->prepared || ops->prepare == NULL;
+}
+
+bool hal_i2c_run(hal_xfer_t *xfer)
+{
+    const hal_ops_t *ops = xfer->ops;
+    const i2c_dev_t *dev = xfer->dev;
+    uint8_t retries = 0;
+    bool res;
+
+    if (hal_mux_select(ops, dev) != true) {
+        return false;
+    }
+
+    HAL_STATS_BEGIN();
+    HAL_TRACE_BEGIN();
+
+    if (xfer->prepared) {
+        res = ops->run(xfer, &retries);
+    } else if (xfer->write) {
+        res = ops->write_reg(dev, xfer->out[0], xfer->data, xfer->size, &retries);
+    } else {
+        res = ops->read_reg(dev, xfer->out[0], xfer->data, xfer->size, &retries);
+    }
+
+    HAL_STATS_END(dev, xfer->write, xfer->size, res, retries);
+    HAL_TRACE_END(dev, xfer->write, xfer->out[0], xfer->data, xfer->size, res, retries);
+
+    if (res != true) {
+        hal_mux_forget(dev);
+    }
+    return hal_mux_release(ops, dev) && res;
+}
+
+bool hal_i2c_set_speed(const i2c_dev_t *dev, uint32_t hz)
+{
+    const hal_ops_t *ops = hal_ops(dev);
+
+    return ops->set_speed ? ops->set_speed(dev, hz) : false;
+}
+
+void hal_i2c_mux_invalidate(uint8_t port)
+{
+    if (port < HAL_MUX_PORTS) {
+        m_mux[port].known = false;
+    }
+}
+
+/* The selected channel first, then devices without a mux, which disable
+ * it, then the selected mux, then the other muxes */
+static uint32_t hal_mux_key(const i2c_dev_t *dev)
+{
+    const hal_mux_sel_t *sel = dev->port < HAL_MUX_PORTS ? &m_mux[dev->port] : NULL;
+    bool cur_mux = sel && sel->known && sel->ops == hal_ops(dev) && sel->addr == dev->mux_addr;
+    uint32_t group;
+
+    if (dev->mux_addr != 0 && cur_mux && sel->channel == dev->mux_channel) {
+        group = 0;
+    } else if (dev->mux_addr == 0) {
+        group = 1;
+    } else {
+        group = 2 + ((cur_mux ? 0 : 1) << 11 | dev->mux_addr << 3 | (dev->mux_channel & 0x07));
+    }
+
+    return (uint32_t)dev->port << 16 | group;
+}
+
+void hal_i2c_mux_order(i2c_dev_t **devs, size_t count)
+{
+    /* insertion sort, stable and fleets are small */
+    for (size_t i = 1; i < count; i++) {
+        i2c_dev_t *dev = devs[i];
+        uint32_t key = hal_mux_key(dev);
+        size_t j = i;
+
+        while (j > 0 && hal_mux_key(devs[j - 1]) > key) {
+            devs[j] = devs[j - 1];
+            j--;
+        }
+        devs[j] = dev;
+    }
+}
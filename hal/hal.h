@@ -12,6 +12,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "hal_stats.h"
+#include "hal_trace.h"
+
+typedef struct hal_ops hal_ops_t;
+typedef struct hal_xfer hal_xfer_t;
 
 /**
  * I2C device descriptor
@@ -22,8 +27,91 @@ typedef struct
     uint8_t scl_io_num;
     uint8_t sda_io_num;
     uint8_t addr;
+    uint32_t clk_speed;    /* SCL frequency in Hz, 0 for the backend default */
+    uint8_t mux_addr;      /* TCA9548A style mux in front of the device, 0 for none */
+    uint8_t mux_channel;   /* its channel, 0 to 7 */
+    const hal_ops_t *ops;  /* backend, NULL for HAL_DEFAULT_OPS */
+    void *ctx;             /* backend specific */
+#if HAL_STATS_ENABLED
+    hal_stats_t *stats;  /* transaction statistics, NULL to not collect */
+#endif
 } i2c_dev_t;
 
+/**
+ * I2C backend
+ *
+ * Every device descriptor selects its backend, so one binary can drive
+ * several, e.g. `hal_linux_ops` next to `hal_sim_ops`. Descriptors without
+ * one use the backend named by HAL_DEFAULT_OPS at build time, e.g.
+ * `-DHAL_DEFAULT_OPS=hal_nrf5_ops`, which hal.c requires.
+ *
+ * Backends set `retries` to the number of times a transaction was repeated
+ * internally, it is zero on entry.
+ *
+ * `init` configures the bus for `clk_speed`, rounded down to a frequency
+ * the controller supports, or up to its lowest one. `set_speed` changes it later and is NULL where
+ * the frequency is fixed outside the program, e.g. by the Linux adapter driver.
+ * The frequency belongs to the controller: where devices share one, as on
+ * nRF5, the first `init` sets it and `set_speed` applies to all of them.
+ */
+struct hal_ops
+{
+    const char *name;
+    bool (*init)(const i2c_dev_t *dev);
+    bool (*free)(const i2c_dev_t *dev);
+    bool (*write_reg)(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries);
+    bool (*read_reg)(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries);
+    bool (*set_speed)(const i2c_dev_t *dev, uint32_t hz);
+    bool (*prepare)(const i2c_dev_t *dev, hal_xfer_t *xfer);
+    bool (*run)(hal_xfer_t *xfer, uint8_t *retries);
+};
+
+/**
+ * Payload of a prepared write, and room for the backend descriptor
+ */
+#ifndef HAL_XFER_MAX_WRITE
+#define HAL_XFER_MAX_WRITE 8
+#endif
+
+#define HAL_XFER_PRIV_SIZE 64
+
+/**
+ * Prepared transfer
+ *
+ * A register read or write whose buffers and backend descriptor are built
+ * once by `hal_i2c_prepare`, so `hal_i2c_run` only starts it: a TWI
+ * descriptor on nRF5, an `i2c_msg` array on Linux. Backends without
+ * `prepare`/`run` fall back to `read_reg`/`write_reg`.
+ *
+ * The descriptor points into the transfer itself and into the read buffer,
+ * both must stay in place, and in RAM for EasyDMA, while the transfer is used.
+ */
+struct hal_xfer
+{
+    const i2c_dev_t *dev;
+    const hal_ops_t *ops;
+    bool write;
+    bool prepared;                           /* backend descriptor built */
+    uint8_t out[1 + HAL_XFER_MAX_WRITE];     /* register address and write payload */
+    void *data;                              /* read buffer, or the payload in `out` */
+    size_t size;
+    union {
+        uint8_t bytes[HAL_XFER_PRIV_SIZE];
+        void *align_ptr;
+        uint64_t align_u64;
+    } priv;                                  /* backend descriptor */
+};
+
+/**
+ * Standard I2C frequencies, the DS3231 supports up to fast mode
+ */
+#define HAL_I2C_SPEED_STANDARD 100000
+#define HAL_I2C_SPEED_FAST     400000
+
+extern const hal_ops_t hal_nrf5_ops;
+extern const hal_ops_t hal_linux_ops;
+extern const hal_ops_t hal_sim_ops;
+
 bool hal_i2c_init(const i2c_dev_t *dev);
 
 bool hal_i2c_free(const i2c_dev_t *dev);
@@ -32,4 +120,69 @@ bool hal_i2c_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data,
 
 bool hal_i2c_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size);
 
-#endif
\ No newline at end of file
+bool hal_i2c_set_speed(const i2c_dev_t *dev, uint32_t hz);
+
+/**
+ * @brief Prepare a transfer
+ * @param dev Device descriptor, must outlive the transfer
+ * @param xfer Transfer
+ * @param write true for a register write
+ * @param reg Register address
+ * @param data Read buffer, or payload of a write, which is copied
+ * @param size Size of `data`, up to HAL_XFER_MAX_WRITE for a write
+ * @return true to indicate success
+ */
+bool hal_i2c_prepare(const i2c_dev_t *dev, hal_xfer_t *xfer, bool write, uint8_t reg, void *data, size_t size);
+
+/**
+ * @brief Run a prepared transfer
+ * @param xfer Transfer
+ * @return true to indicate success
+ */
+bool hal_i2c_run(hal_xfer_t *xfer);
+
+/**
+ * I2C multiplexers
+ *
+ * A device with `mux_addr` set is reached by first writing its channel mask
+ * to the mux, so several DS3231s, which all answer at `DS3231_ADDR`, can
+ * share a bus. The dispatcher remembers the selected channel per bus and
+ * skips the write while consecutive transactions stay on one channel.
+ * Switching to another mux on the same bus, or to a device without a mux,
+ * first disables the channels of the previous one. A failed transaction
+ * forgets which channel is selected but not the mux, so the next one
+ * writes the selection again, or disables that mux.
+ *
+ * Selections are remembered on ports below HAL_MUX_PORTS, on other ports
+ * every transaction selects its channel and disables it afterwards. On
+ * Linux, muxes bound to the kernel driver appear as adapters of their own
+ * and need no `mux_addr`.
+ */
+#ifndef HAL_MUX_PORTS
+#define HAL_MUX_PORTS 8
+#endif
+
+/**
+ * @brief Forget the selected mux channel of a bus
+ *
+ * Call after anything else may have written the mux, e.g. a bus reset or
+ * another master. The mux written last is still disabled before a device
+ * without a mux is reached.
+ *
+ * @param port I2C port
+ */
+void hal_i2c_mux_invalidate(uint8_t port);
+
+/**
+ * @brief Order devices for a pass over a fleet with the fewest channel switches
+ *
+ * Groups the devices by bus, mux and channel, starting each bus with the
+ * channel currently selected and then with the devices without a mux.
+ * Devices on one channel keep their order.
+ *
+ * @param devs Device descriptors, reordered in place
+ * @param count Number of devices
+ */
+void hal_i2c_mux_order(i2c_dev_t **devs, size_t count);
+
+#endif
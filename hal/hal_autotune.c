@@ -0,0 +1,185 @@
+/**
+ * I2C bus frequency auto-tuning
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_autotune.h"
+
+static const uint32_t m_ladder[] = { 100000, 250000, 400000 };
+
+#define LADDER_SIZE (sizeof(m_ladder) / sizeof(m_ladder[0]))
+
+/* The tuned backend sees the device with its own context and frequency */
+static void autotune_inner(const hal_autotune_t *at, const i2c_dev_t *dev, i2c_dev_t *inner)
+{
+    *inner = *dev;
+    inner->ops = at->ops;
+    inner->ctx = at->ctx;
+    inner->clk_speed = at->hz;
+}
+
+static uint32_t autotune_lower(const hal_autotune_t *at)
+{
+    uint32_t hz = at->min_hz;
+
+    for (unsigned i = 0; i < LADDER_SIZE; i++) {
+        if (m_ladder[i] < at->hz && m_ladder[i] > hz) {
+            hz = m_ladder[i];
+        }
+    }
+    return hz;
+}
+
+static uint32_t autotune_higher(const hal_autotune_t *at)
+{
+    uint32_t hz = at->max_hz;
+
+    for (unsigned i = 0; i < LADDER_SIZE; i++) {
+        if (m_ladder[i] > at->hz && m_ladder[i] < hz) {
+            hz = m_ladder[i];
+        }
+    }
+    return hz;
+}
+
+static bool autotune_change(hal_autotune_t *at, const i2c_dev_t *dev, uint32_t hz)
+{
+    i2c_dev_t inner;
+
+    if (hz == at->hz || at->ops->set_speed == NULL) {
+        return false;
+    }
+    autotune_inner(at, dev, &inner);
+    if (at->ops->set_speed(&inner, hz) != true) {
+        return false;
+    }
+    at->hz = hz;
+    at->window = 0;
+    at->errors = 0;
+    at->clean = 0;
+
+    return true;
+}
+
+/* A transaction that failed or needed retries counts as an error */
+static void autotune_update(hal_autotune_t *at, const i2c_dev_t *dev, bool ok, uint8_t retries)
+{
+    at->window++;
+    if (!ok || retries > 0) {
+        at->errors++;
+        at->clean = 0;
+    } else {
+        at->clean++;
+    }
+
+    if (at->errors >= HAL_AUTOTUNE_ERRORS) {
+        if (at->probing && at->clean_needed < HAL_AUTOTUNE_CLEAN_MAX) {
+            at->clean_needed *= 2;
+        }
+        at->probing = false;
+        if (autotune_change(at, dev, autotune_lower(at))) {
+            at->steps_down++;
+        }
+        at->window = 0;
+        at->errors = 0;
+        return;
+    }
+    if (at->window >= HAL_AUTOTUNE_WINDOW) {
+        at->window = 0;
+        at->errors = 0;
+    }
+
+    if (at->probing && at->clean >= HAL_AUTOTUNE_CLEAN) {
+        at->probing = false;
+        at->clean_needed = HAL_AUTOTUNE_CLEAN;
+    }
+    if (at->clean >= at->clean_needed && autotune_change(at, dev, autotune_higher(at))) {
+        at->probing = true;
+        at->steps_up++;
+    }
+}
+
+static bool autotune_init(const i2c_dev_t *dev)
+{
+    hal_autotune_t *at = dev->ctx;
+    i2c_dev_t inner;
+
+    autotune_inner(at, dev, &inner);
+    return at->ops->init(&inner);
+}
+
+static bool autotune_free(const i2c_dev_t *dev)
+{
+    hal_autotune_t *at = dev->ctx;
+    i2c_dev_t inner;
+
+    autotune_inner(at, dev, &inner);
+    return at->ops->free(&inner);
+}
+
+static bool autotune_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
+{
+    hal_autotune_t *at = dev->ctx;
+    i2c_dev_t inner;
+
+    autotune_inner(at, dev, &inner);
+    bool res = at->ops->write_reg(&inner, reg, out_data, out_size, retries);
+    autotune_update(at, dev, res, *retries);
+
+    return res;
+}
+
+static bool autotune_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
+{
+    hal_autotune_t *at = dev->ctx;
+    i2c_dev_t inner;
+
+    autotune_inner(at, dev, &inner);
+    bool res = at->ops->read_reg(&inner, reg, in_data, in_size, retries);
+    autotune_update(at, dev, res, *retries);
+
+    return res;
+}
+
+static bool autotune_set_speed(const i2c_dev_t *dev, uint32_t hz)
+{
+    hal_autotune_t *at = dev->ctx;
+
+    if (hz < at->min_hz) {
+        hz = at->min_hz;
+    } else if (hz > at->max_hz) {
+        hz = at->max_hz;
+    }
+    at->probing = false;
+    at->clean_needed = HAL_AUTOTUNE_CLEAN;
+
+    return hz == at->hz || autotune_change(at, dev, hz);
+}
+
+const hal_ops_t hal_autotune_ops = {
+    .name      = "autotune",
+    .init      = autotune_init,
+    .free      = autotune_free,
+    .write_reg = autotune_write_reg,
+    .read_reg  = autotune_read_reg,
+    .set_speed = autotune_set_speed,
+};
+
+void hal_autotune_start(hal_autotune_t *at, const hal_ops_t *ops, void *ctx, uint32_t min_hz, uint32_t max_hz)
+{
+    at->ops = ops;
+    at->ctx = ctx;
+    at->min_hz = min_hz;
+    at->max_hz = max_hz;
+    at->hz = max_hz;
+    at->window = 0;
+    at->errors = 0;
+    at->clean = 0;
+    at->clean_needed = HAL_AUTOTUNE_CLEAN;
+    at->probing = false;
+    at->steps_down = 0;
+    at->steps_up = 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * I2C bus frequency auto-tuning
+ *
+ * `hal_autotune_ops` passes every transaction through to another backend
+ * and adapts the SCL frequency to the bus: a burst of failed or retried
+ * transactions steps it down, a long enough run of clean ones steps it
+ * back up. A step up that is followed by errors before it has proven
+ * itself doubles the run required for the next one, so a marginal bus
+ * settles at the highest frequency it carries reliably instead of
+ * oscillating.
+ *
+ * Frequencies are taken from the ladder 100, 250 and 400 kHz, limited to
+ * a configured range. The decision is made on transaction counts alone,
+ * so it replays deterministically. Backends without `set_speed` keep
+ * their frequency and only the counters are updated.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_AUTOTUNE_H__
+#define __HAL_AUTOTUNE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Errors within `HAL_AUTOTUNE_WINDOW` transactions that step the frequency down
+ */
+#ifndef HAL_AUTOTUNE_ERRORS
+#define HAL_AUTOTUNE_ERRORS 3
+#endif
+
+#ifndef HAL_AUTOTUNE_WINDOW
+#define HAL_AUTOTUNE_WINDOW 32
+#endif
+
+/**
+ * Clean transactions in a row that step the frequency up, doubled after
+ * every failed step up, up to `HAL_AUTOTUNE_CLEAN_MAX`
+ */
+#ifndef HAL_AUTOTUNE_CLEAN
+#define HAL_AUTOTUNE_CLEAN 256
+#endif
+
+#ifndef HAL_AUTOTUNE_CLEAN_MAX
+#define HAL_AUTOTUNE_CLEAN_MAX 65536
+#endif
+
+/**
+ * Auto-tuner, the `ctx` of devices using `hal_autotune_ops`
+ */
+typedef struct {
+    const hal_ops_t *ops;   //!< Backend the transactions go to
+    void *ctx;              //!< Its context
+    uint32_t min_hz;
+    uint32_t max_hz;
+    uint32_t hz;            //!< Current SCL frequency
+    uint16_t window;        //!< Transactions in the current error window
+    uint16_t errors;        //!< Errors in the current error window
+    uint32_t clean;         //!< Clean transactions in a row
+    uint32_t clean_needed;  //!< Clean transactions in a row for the next step up
+    bool probing;           //!< Stepped up, not yet for `HAL_AUTOTUNE_CLEAN` transactions
+    uint32_t steps_down;
+    uint32_t steps_up;
+} hal_autotune_t;
+
+extern const hal_ops_t hal_autotune_ops;
+
+/**
+ * @brief Set up an auto-tuner
+ *
+ * Set `dev->ops` to `&hal_autotune_ops` and `dev->ctx` to `at` afterwards,
+ * then call `hal_i2c_init`. The bus starts at `max_hz`, `clk_speed` of the
+ * device descriptor is overridden. `hal_i2c_set_speed` moves the current
+ * frequency within the range.
+ *
+ * @param at Auto-tuner
+ * @param ops Backend to tune, e.g. `&hal_nrf5_ops`
+ * @param ctx Its context
+ * @param min_hz Lowest frequency, e.g. `HAL_I2C_SPEED_STANDARD`
+ * @param max_hz Highest frequency, e.g. `HAL_I2C_SPEED_FAST`
+ */
+void hal_autotune_start(hal_autotune_t *at, const hal_ops_t *ops, void *ctx, uint32_t min_hz, uint32_t max_hz);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+/**
+ * Timestamp source for HAL instrumentation
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_clock.h"
+#include <stddef.h>
+
+static hal_clock_fn_t m_clock;
+
+void hal_clock_set_source(hal_clock_fn_t fn)
+{
+    m_clock = fn;
+}
+
+uint32_t hal_clock_us(void)
+{
+    return m_clock ? m_clock() : 0;
+}
@@ -0,0 +1,43 @@
+/**
+ * Timestamp source for HAL instrumentation
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_CLOCK_H__
+#define __HAL_CLOCK_H__
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Free running microsecond counter, allowed to wrap
+ */
+typedef uint32_t (*hal_clock_fn_t)(void);
+
+/**
+ * @brief Set the timestamp source
+ *
+ * E.g. a wrapper around `app_timer_cnt_get()` on nRF5 or
+ * `clock_gettime(CLOCK_MONOTONIC)` on Linux.
+ *
+ * @param fn Timestamp source, NULL to disable timestamps
+ */
+void hal_clock_set_source(hal_clock_fn_t fn);
+
+/**
+ * @brief Get a timestamp
+ * @return Microseconds, 0 if no source is set
+ */
+uint32_t hal_clock_us(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * Edge counter Hardware Abstraction Layer
+ *
+ * Counts rising edges on a GPIO in hardware, e.g. the 32kHz output of the
+ * DS3231. Like the I2C HAL the backend is selected at link time.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_COUNTER_H__
+#define __HAL_COUNTER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start counting rising edges
+ * @param id Counter, backend specific: ignored on nRF5, the I2C port of the
+ * device on the simulator
+ * @param pin GPIO to count edges on
+ * @return true to indicate success
+ */
+bool hal_counter_init(uint8_t id, uint8_t pin);
+
+/**
+ * @brief Stop counting
+ * @param id Counter
+ * @return true to indicate success
+ */
+bool hal_counter_free(uint8_t id);
+
+/**
+ * @brief Get the number of edges counted
+ * @param id Counter
+ * @return Free running edge count, wraps at 2^32
+ */
+uint32_t hal_counter_read(uint8_t id);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
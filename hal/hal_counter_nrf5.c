@@ -0,0 +1,99 @@
+/**
+ * Edge counter Hardware Abstraction Layer for nRF5
+ *
+ * A TIMER in low power counter mode, with its COUNT task triggered over
+ * PPI by a GPIOTE event on the pin, so counting costs no CPU time. The
+ * DS3231 32kHz output is open drain, the pin pull-up is enabled.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_counter.h"
+
+#include "nrf_drv_timer.h"
+#include "nrf_drv_gpiote.h"
+#include "nrf_drv_ppi.h"
+
+/* TIMER instance used as counter */
+#ifndef HAL_COUNTER_TIMER_INSTANCE
+#define HAL_COUNTER_TIMER_INSTANCE 1
+#endif
+
+static const nrf_drv_timer_t m_timer = NRF_DRV_TIMER_INSTANCE(HAL_COUNTER_TIMER_INSTANCE);
+static nrf_ppi_channel_t m_ppi_channel;
+static uint8_t m_pin;
+
+static void timer_handler(nrf_timer_event_t event_type, void *p_context)
+{
+    /* no compare events are used */
+}
+
+bool hal_counter_init(uint8_t id, uint8_t pin)
+{
+    ret_code_t err_code;
+    nrf_drv_timer_config_t timer_config = NRF_DRV_TIMER_DEFAULT_CONFIG;
+    /* IN event with high accuracy, the PORT event cannot follow 32kHz */
+    nrf_drv_gpiote_in_config_t in_config = GPIOTE_CONFIG_IN_SENSE_LOTOHI(true);
+
+    timer_config.mode = NRF_TIMER_MODE_LOW_POWER_COUNTER;
+    timer_config.bit_width = NRF_TIMER_BIT_WIDTH_32;
+    err_code = nrf_drv_timer_init(&m_timer, &timer_config, timer_handler);
+    if (err_code != NRF_SUCCESS) {
+        return false;
+    }
+
+    if (!nrf_drv_gpiote_is_init()) {
+        err_code = nrf_drv_gpiote_init();
+        if (err_code != NRF_SUCCESS) {
+            return false;
+        }
+    }
+    in_config.pull = NRF_GPIO_PIN_PULLUP;
+    err_code = nrf_drv_gpiote_in_init(pin, &in_config, NULL);
+    if (err_code != NRF_SUCCESS) {
+        return false;
+    }
+
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED) {
+        return false;
+    }
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_channel);
+    if (err_code != NRF_SUCCESS) {
+        return false;
+    }
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_channel, nrf_drv_gpiote_in_event_addr_get(pin),
+        nrf_drv_timer_task_address_get(&m_timer, NRF_TIMER_TASK_COUNT));
+    if (err_code != NRF_SUCCESS) {
+        return false;
+    }
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_channel);
+    if (err_code != NRF_SUCCESS) {
+        return false;
+    }
+
+    m_pin = pin;
+    nrf_drv_gpiote_in_event_enable(pin, false);
+    nrf_drv_timer_enable(&m_timer);
+
+    return true;
+}
+
+bool hal_counter_free(uint8_t id)
+{
+    nrf_drv_timer_disable(&m_timer);
+    nrf_drv_gpiote_in_event_disable(m_pin);
+    nrf_drv_ppi_channel_disable(m_ppi_channel);
+    nrf_drv_ppi_channel_free(m_ppi_channel);
+    nrf_drv_gpiote_in_uninit(m_pin);
+    nrf_drv_timer_uninit(&m_timer);
+
+    return true;
+}
+
+uint32_t hal_counter_read(uint8_t id)
+{
+    return nrf_drv_timer_capture(&m_timer, NRF_TIMER_CC_CHANNEL0);
+}
@@ -0,0 +1,186 @@
+/**
+ * I2C Hardware Abstraction Layer for Linux (i2c-dev)
+ *
+ * The I2C port selects the adapter, port N is `/dev/i2c-N`. The bus
+ * frequency is set by the adapter driver, e.g. with the `clock-frequency`
+ * device tree property, `clk_speed` is ignored.
+ * Backend `hal_linux_ops`.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#ifndef HAL_LINUX_MAX_PORTS
+#define HAL_LINUX_MAX_PORTS 16
+#endif
+
+/* Attempts repeated after a lost arbitration or a busy adapter */
+#ifndef HAL_LINUX_RETRIES
+#define HAL_LINUX_RETRIES 2
+#endif
+
+/* Largest transfer, the whole DS3231 register file plus the address byte */
+#define HAL_LINUX_MAX_XFER 32
+
+static int m_fd[HAL_LINUX_MAX_PORTS];
+static uint8_t m_refs[HAL_LINUX_MAX_PORTS];
+
+/* Issue a combined transfer, repeating it on transient errors */
+static bool linux_transfer(int fd, struct i2c_rdwr_ioctl_data *xfer, uint8_t *retries)
+{
+    int res;
+
+    *retries = 0;
+    for (;;) {
+        res = ioctl(fd, I2C_RDWR, xfer);
+        if (res == (int)xfer->nmsgs) {
+            return true;
+        }
+        if (*retries >= HAL_LINUX_RETRIES || (errno != EAGAIN && errno != EBUSY)) {
+            return false;
+        }
+        (*retries)++;
+    }
+}
+
+/* Adapter of an initialized port, -1 otherwise, the fd of a port never
+ * opened would be 0, stdin */
+static int linux_fd(const i2c_dev_t *dev)
+{
+    if (dev->port >= HAL_LINUX_MAX_PORTS || m_refs[dev->port] == 0) {
+        return -1;
+    }
+    return m_fd[dev->port];
+}
+
+static bool linux_init(const i2c_dev_t *dev)
+{
+    char path[20];
+
+    if (dev->port >= HAL_LINUX_MAX_PORTS) {
+        return false;
+    }
+    if (m_refs[dev->port]++ > 0) {
+        return true;
+    }
+
+    snprintf(path, sizeof(path), "/dev/i2c-%u", dev->port);
+    m_fd[dev->port] = open(path, O_RDWR | O_CLOEXEC);
+    if (m_fd[dev->port] < 0) {
+        m_refs[dev->port] = 0;
+        return false;
+    }
+
+    return true;
+}
+
+static bool linux_free(const i2c_dev_t *dev)
+{
+    if (dev->port >= HAL_LINUX_MAX_PORTS || m_refs[dev->port] == 0) {
+        return false;
+    }
+    if (--m_refs[dev->port] == 0) {
+        close(m_fd[dev->port]);
+    }
+
+    return true;
+}
+
+static bool linux_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
+{
+    uint8_t data[HAL_LINUX_MAX_XFER + 1];
+    int fd = linux_fd(dev);
+
+    if (fd < 0 || out_size > HAL_LINUX_MAX_XFER) {
+        return false;
+    }
+    data[0] = reg;
+    memcpy(data + 1, out_data, out_size);
+
+    struct i2c_msg msg = {
+        .addr  = dev->addr,
+        .flags = 0,
+        .len   = out_size + 1,
+        .buf   = data
+    };
+    struct i2c_rdwr_ioctl_data xfer = { .msgs = &msg, .nmsgs = 1 };
+
+    return linux_transfer(fd, &xfer, retries);
+}
+
+static bool linux_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
+{
+    int fd = linux_fd(dev);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    /* register address and data in one transfer with a repeated start */
+    struct i2c_msg msgs[2] = {
+        { .addr = dev->addr, .flags = 0, .len = 1, .buf = &reg },
+        { .addr = dev->addr, .flags = I2C_M_RD, .len = in_size, .buf = in_data }
+    };
+    struct i2c_rdwr_ioctl_data xfer = { .msgs = msgs, .nmsgs = 2 };
+
+    return linux_transfer(fd, &xfer, retries);
+}
+
+/* Prebuilt transfer of a prepared transaction */
+typedef struct {
+    int fd;
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data xfer;
+} linux_xfer_t;
+
+typedef char linux_xfer_fits[sizeof(linux_xfer_t) <= HAL_XFER_PRIV_SIZE ? 1 : -1];
+
+static bool linux_prepare(const i2c_dev_t *dev, hal_xfer_t *xfer)
+{
+    linux_xfer_t *p = (linux_xfer_t *)xfer->priv.bytes;
+
+    p->fd = linux_fd(dev);
+    if (p->fd < 0) {
+        return false;
+    }
+
+    p->msgs[0] = (struct i2c_msg){ .addr = dev->addr, .flags = 0, .len = 1, .buf = xfer->out };
+    if (xfer->write) {
+        p->msgs[0].len += xfer->size;
+        p->xfer.nmsgs = 1;
+    } else {
+        p->msgs[1] = (struct i2c_msg){ .addr = dev->addr, .flags = I2C_M_RD, .len = xfer->size, .buf = xfer->data };
+        p->xfer.nmsgs = 2;
+    }
+    p->xfer.msgs = p->msgs;
+
+    return true;
+}
+
+static bool linux_run(hal_xfer_t *xfer, uint8_t *retries)
+{
+    linux_xfer_t *p = (linux_xfer_t *)xfer->priv.bytes;
+
+    return linux_transfer(p->fd, &p->xfer, retries);
+}
+
+const hal_ops_t hal_linux_ops = {
+    .name      = "linux",
+    .init      = linux_init,
+    .free      = linux_free,
+    .write_reg = linux_write_reg,
+    .read_reg  = linux_read_reg,
+    .prepare   = linux_prepare,
+    .run       = linux_run,
+};
@@ -1,6 +1,13 @@
 /**
  * I2C Hardware Abstraction Layer for nRF5x (nRF5_SDK)
  *
+ * Backend `hal_nrf5_ops`.
+ *
+ * All devices share the one TWI instance. The first `init` configures it
+ * for its `clk_speed`, later ones only take a reference, and `set_speed`
+ * reconfigures it for every device, so devices on one bus should agree on
+ * their frequency.
+ *
  * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
  *
  * MIT Licensed as described in the file LICENSE
@@ -18,16 +25,35 @@
 #define TWI_INSTANCE_ID     1
 #endif
 
+/* Attempts repeated after a busy driver or a bus error */
+#ifndef HAL_NRF5_RETRIES
+#define HAL_NRF5_RETRIES 2
+#endif
+
 static const nrf_drv_twi_t m_twi = NRF_DRV_TWI_INSTANCE(TWI_INSTANCE_ID);
+static uint8_t m_refs;
+
+/* Highest TWI frequency not above hz, 400 kHz by default. Requests below
+ * 100 kHz are clamped up to 100 kHz, the lowest the TWI supports. */
+static nrf_drv_twi_frequency_t nrf5_frequency(uint32_t hz)
+{
+    if (hz == 0 || hz >= 400000) {
+        return NRF_DRV_TWI_FREQ_400K;
+    }
+    if (hz >= 250000) {
+        return NRF_DRV_TWI_FREQ_250K;
+    }
+    return NRF_DRV_TWI_FREQ_100K;
+}
 
-bool hal_i2c_init(const i2c_dev_t *dev)
+static bool nrf5_config(const i2c_dev_t *dev, uint32_t hz)
 {
     ret_code_t err_code;
 
     const nrf_drv_twi_config_t twi_config = {
        .scl                = dev->scl_io_num,
        .sda                = dev->sda_io_num,
-       .frequency          = NRF_DRV_TWI_FREQ_400K,
+       .frequency          = nrf5_frequency(hz),
        .interrupt_priority = APP_IRQ_PRIORITY_HIGH,
        .clear_bus_init     = false
     };
@@ -40,30 +66,121 @@ bool hal_i2c_init(const i2c_dev_t *dev)
     return true;
 }
 
-bool hal_i2c_free(const i2c_dev_t *dev)
+static bool nrf5_init(const i2c_dev_t *dev)
 {
+    if (m_refs++ > 0) {
+        return true;
+    }
+
+    return nrf5_config(dev, dev->clk_speed);
+}
+
+static bool nrf5_free(const i2c_dev_t *dev)
+{
+    (void)dev;
+    if (m_refs == 0) {
+        return false;
+    }
+    if (--m_refs == 0) {
+        nrf_drv_twi_disable(&m_twi);
+        nrf_drv_twi_uninit(&m_twi);
+    }
+
     return true;
 }
 
-bool hal_i2c_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size)
+/* The driver takes the frequency at init only, the instance is shared */
+static bool nrf5_set_speed(const i2c_dev_t *dev, uint32_t hz)
+{
+    if (m_refs == 0) {
+        return false;
+    }
+    nrf_drv_twi_disable(&m_twi);
+    nrf_drv_twi_uninit(&m_twi);
+
+    return nrf5_config(dev, hz);
+}
+
+/* Issue a transfer, repeating it on transient errors. A NACK or a bus
+ * error is returned as a failure for the caller and the auto-tuner to
+ * see, anything else is a programming error, e.g. a buffer out of RAM. */
+static bool nrf5_transfer(nrf_drv_twi_xfer_desc_t *xfer, uint8_t *retries)
+{
+    ret_code_t err_code;
+
+    *retries = 0;
+    for (;;) {
+        err_code = nrf_drv_twi_xfer(&m_twi, xfer, 0);
+        switch (err_code) {
+        case NRF_SUCCESS:
+            return true;
+        case NRF_ERROR_BUSY:
+        case NRF_ERROR_INTERNAL:
+        case NRF_ERROR_DRV_TWI_ERR_OVERRUN:
+            if (*retries >= HAL_NRF5_RETRIES) {
+                return false;
+            }
+            (*retries)++;
+            break;
+        case NRF_ERROR_DRV_TWI_ERR_ANACK:
+        case NRF_ERROR_DRV_TWI_ERR_DNACK:
+            return false;
+        default:
+            APP_ERROR_CHECK(err_code);
+            return false;
+        }
+    }
+}
+
+static bool nrf5_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
 {
     uint8_t data[out_size + 1];
     data[0] = reg;
     memcpy(data + 1, out_data, out_size);
-    ret_code_t err_code = nrf_drv_twi_tx(&m_twi, dev->addr, data, out_size + 1, false);
-    APP_ERROR_CHECK(err_code);
-    if (err_code == NRF_SUCCESS) {
-        return true;
-    }
-    return false;
+    nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TX(dev->addr, data, out_size + 1);
+
+    return nrf5_transfer(&xfer, retries);
 }
 
-bool hal_i2c_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size)
+static bool nrf5_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
 {
-    ret_code_t err_code = nrf_drv_twi_tx(&m_twi, dev->addr, &reg, 1, true);
-    if (err_code == NRF_SUCCESS) {
-        err_code = nrf_drv_twi_rx(&m_twi, dev->addr, in_data, in_size);
+    /* register address and data in one driver transfer with a repeated start */
+    nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TXRX(dev->addr, &reg, 1, in_data, in_size);
+
+    return nrf5_transfer(&xfer, retries);
+}
+
+typedef char nrf5_xfer_fits[sizeof(nrf_drv_twi_xfer_desc_t) <= HAL_XFER_PRIV_SIZE ? 1 : -1];
+
+/* The descriptor points at the buffers in the transfer, which EasyDMA
+ * reads and writes in place */
+static bool nrf5_prepare(const i2c_dev_t *dev, hal_xfer_t *xfer)
+{
+    nrf_drv_twi_xfer_desc_t *desc = (nrf_drv_twi_xfer_desc_t *)xfer->priv.bytes;
+
+    if (xfer->write) {
+        nrf_drv_twi_xfer_desc_t tx = NRF_DRV_TWI_XFER_DESC_TX(dev->addr, xfer->out, xfer->size + 1);
+        *desc = tx;
+    } else {
+        nrf_drv_twi_xfer_desc_t txrx = NRF_DRV_TWI_XFER_DESC_TXRX(dev->addr, xfer->out, 1, xfer->data, xfer->size);
+        *desc = txrx;
     }
-    APP_ERROR_CHECK(err_code);
+
     return true;
-}
\ No newline at end of file
+}
+
+static bool nrf5_run(hal_xfer_t *xfer, uint8_t *retries)
+{
+    return nrf5_transfer((nrf_drv_twi_xfer_desc_t *)xfer->priv.bytes, retries);
+}
+
+const hal_ops_t hal_nrf5_ops = {
+    .name      = "nrf5",
+    .init      = nrf5_init,
+    .free      = nrf5_free,
+    .write_reg = nrf5_write_reg,
+    .read_reg  = nrf5_read_reg,
+    .set_speed = nrf5_set_speed,
+    .prepare   = nrf5_prepare,
+    .run       = nrf5_run,
+};
@@ -0,0 +1,273 @@
+/**
+ * Record and replay I2C backends
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_record.h"
+#include "hal_clock.h"
+#include <string.h>
+
+static void record_entry(hal_record_t *rec, const i2c_dev_t *dev, bool write, uint8_t reg,
+        const void *data, size_t size, bool ok, uint8_t retries, uint32_t start_us)
+{
+    hal_record_entry_t entry = {
+        .timestamp_us = start_us,
+        .duration_us  = hal_clock_us() - start_us,
+        .addr         = dev->addr,
+        .reg          = reg,
+        .flags        = (write ? HAL_RECORD_WRITE : 0) | (ok ? 0 : HAL_RECORD_FAILED)
+            | ((retries > 15 ? 15 : retries) << HAL_RECORD_RETRY_SHIFT),
+        .len          = (uint8_t)size
+    };
+
+    if (rec->sink(rec->sink_arg, &entry, sizeof(entry)) != true
+            || rec->sink(rec->sink_arg, data, size) != true) {
+        rec->error = true;
+    }
+    rec->entries++;
+}
+
+/* The recorded backend sees the device with its own context */
+static void record_inner(const hal_record_t *rec, const i2c_dev_t *dev, i2c_dev_t *inner)
+{
+    *inner = *dev;
+    inner->ops = rec->ops;
+    inner->ctx = rec->ctx;
+}
+
+static bool record_init(const i2c_dev_t *dev)
+{
+    hal_record_t *rec = dev->ctx;
+    i2c_dev_t inner;
+
+    record_inner(rec, dev, &inner);
+    return rec->ops->init(&inner);
+}
+
+static bool record_free(const i2c_dev_t *dev)
+{
+    hal_record_t *rec = dev->ctx;
+    i2c_dev_t inner;
+
+    record_inner(rec, dev, &inner);
+    return rec->ops->free(&inner);
+}
+
+static bool record_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
+{
+    hal_record_t *rec = dev->ctx;
+    i2c_dev_t inner;
+
+    if (out_size > UINT8_MAX) {
+        return false;
+    }
+    record_inner(rec, dev, &inner);
+
+    uint32_t start = hal_clock_us();
+    bool res = rec->ops->write_reg(&inner, reg, out_data, out_size, retries);
+    record_entry(rec, dev, true, reg, out_data, out_size, res, *retries, start);
+
+    return res;
+}
+
+static bool record_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
+{
+    hal_record_t *rec = dev->ctx;
+    i2c_dev_t inner;
+
+    if (in_size > UINT8_MAX) {
+        return false;
+    }
+    record_inner(rec, dev, &inner);
+
+    uint32_t start = hal_clock_us();
+    bool res = rec->ops->read_reg(&inner, reg, in_data, in_size, retries);
+    record_entry(rec, dev, false, reg, in_data, in_size, res, *retries, start);
+
+    return res;
+}
+
+/* Speed changes are passed through, not recorded */
+static bool record_set_speed(const i2c_dev_t *dev, uint32_t hz)
+{
+    hal_record_t *rec = dev->ctx;
+    i2c_dev_t inner;
+
+    if (rec->ops->set_speed == NULL) {
+        return false;
+    }
+    record_inner(rec, dev, &inner);
+    return rec->ops->set_speed(&inner, hz);
+}
+
+const hal_ops_t hal_record_ops = {
+    .name      = "record",
+    .init      = record_init,
+    .free      = record_free,
+    .write_reg = record_write_reg,
+    .read_reg  = record_read_reg,
+    .set_speed = record_set_speed,
+};
+
+bool hal_record_start(hal_record_t *rec, const hal_ops_t *ops, void *ctx, hal_record_sink_t sink, void *sink_arg)
+{
+    hal_record_header_t header = {
+        .magic      = HAL_RECORD_MAGIC,
+        .version    = HAL_RECORD_VERSION,
+        .entry_size = sizeof(hal_record_entry_t),
+        .reserved   = 0
+    };
+
+    rec->ops = ops;
+    rec->ctx = ctx;
+    rec->sink = sink;
+    rec->sink_arg = sink_arg;
+    rec->entries = 0;
+    rec->error = sink(sink_arg, &header, sizeof(header)) != true;
+
+    return !rec->error;
+}
+
+/* Take the next entry and check it against the transaction issued */
+static const uint8_t *replay_next(hal_replay_t *rp, const i2c_dev_t *dev, bool write, uint8_t reg,
+        size_t size, hal_record_entry_t *entry)
+{
+    if (rp->size - rp->pos < sizeof(*entry)) {
+        rp->overruns++;
+        return NULL;
+    }
+    memcpy(entry, rp->data + rp->pos, sizeof(*entry));
+    if (rp->size - rp->pos - sizeof(*entry) < entry->len) {
+        rp->pos = rp->size;
+        rp->overruns++;
+        return NULL;
+    }
+
+    const uint8_t *payload = rp->data + rp->pos + sizeof(*entry);
+    rp->pos += sizeof(*entry) + entry->len;
+
+    /* recorded time, from the first entry */
+    bool first = rp->transactions + rp->mismatches == 0;
+    if (!first) {
+        rp->time_us += (uint32_t)(entry->timestamp_us - rp->last_us);
+    }
+    rp->last_us = entry->timestamp_us;
+
+    /* the gap to the previous transaction, less what the driver spent since */
+    if (rp->delay && !first) {
+        int32_t gap = (int32_t)(entry->timestamp_us - rp->paced_us) - (int32_t)(hal_clock_us() - rp->mark_us);
+        if (gap > 0) {
+            rp->delay(rp->delay_arg, (uint32_t)gap);
+        }
+    }
+    rp->paced_us = entry->timestamp_us;
+    rp->mark_us = hal_clock_us();
+
+    if (((entry->flags & HAL_RECORD_WRITE) != 0) != write || entry->addr != dev->addr
+            || entry->reg != reg || entry->len != size) {
+        rp->mismatches++;
+        return NULL;
+    }
+
+    if (rp->delay) {
+        rp->delay(rp->delay_arg, entry->duration_us);
+        rp->paced_us += entry->duration_us;
+        rp->mark_us = hal_clock_us();
+    }
+    rp->bus_us += entry->duration_us;
+
+    return payload;
+}
+
+static bool replay_init(const i2c_dev_t *dev)
+{
+    return dev->ctx != NULL;
+}
+
+static bool replay_free(const i2c_dev_t *dev)
+{
+    (void)dev;
+    return true;
+}
+
+static bool replay_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
+{
+    hal_replay_t *rp = dev->ctx;
+    hal_record_entry_t entry;
+
+    const uint8_t *payload = replay_next(rp, dev, true, reg, out_size, &entry);
+    if (payload == NULL) {
+        return false;
+    }
+    if (memcmp(payload, out_data, out_size) != 0) {
+        rp->mismatches++;
+        return false;
+    }
+
+    rp->transactions++;
+    *retries = (entry.flags & HAL_RECORD_RETRY_MASK) >> HAL_RECORD_RETRY_SHIFT;
+    return !(entry.flags & HAL_RECORD_FAILED);
+}
+
+static bool replay_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
+{
+    hal_replay_t *rp = dev->ctx;
+    hal_record_entry_t entry;
+
+    const uint8_t *payload = replay_next(rp, dev, false, reg, in_size, &entry);
+    if (payload == NULL) {
+        return false;
+    }
+    memcpy(in_data, payload, in_size);
+
+    rp->transactions++;
+    *retries = (entry.flags & HAL_RECORD_RETRY_MASK) >> HAL_RECORD_RETRY_SHIFT;
+    return !(entry.flags & HAL_RECORD_FAILED);
+}
+
+static bool replay_set_speed(const i2c_dev_t *dev, uint32_t hz)
+{
+    (void)dev;
+    (void)hz;
+    return true;
+}
+
+const hal_ops_t hal_replay_ops = {
+    .name      = "replay",
+    .init      = replay_init,
+    .free      = replay_free,
+    .write_reg = replay_write_reg,
+    .read_reg  = replay_read_reg,
+    .set_speed = replay_set_speed,
+};
+
+bool hal_replay_open(hal_replay_t *rp, const void *data, size_t size, hal_replay_delay_t delay, void *delay_arg)
+{
+    hal_record_header_t header;
+
+    memset(rp, 0, sizeof(*rp));
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != HAL_RECORD_MAGIC || header.version != HAL_RECORD_VERSION
+            || header.entry_size != sizeof(hal_record_entry_t)) {
+        return false;
+    }
+
+    rp->data = data;
+    rp->size = size;
+    rp->pos = sizeof(header);
+    rp->delay = delay;
+    rp->delay_arg = delay_arg;
+
+    return true;
+}
+
+bool hal_replay_done(const hal_replay_t *rp)
+{
+    return rp->pos >= rp->size;
+}
@@ -0,0 +1,156 @@
+/**
+ * Record and replay I2C backends
+ *
+ * `hal_record_ops` passes every transaction through to another backend and
+ * writes it, with register, payload, result and timing, to a binary stream.
+ * `hal_replay_ops` serves a recording back to the driver, checking that
+ * the driver issues the same transactions and optionally keeping the
+ * recorded pace. A field session thereby becomes a deterministic
+ * benchmark of `ds3231.c` and of the code above it, that catches changes
+ * in transaction count and bus time without hardware.
+ *
+ * Stream format, little-endian: a `hal_record_header_t`, then per
+ * transaction a `hal_record_entry_t` followed by `len` payload bytes,
+ * the data written, or the data read.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_RECORD_H__
+#define __HAL_RECORD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hal.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define HAL_RECORD_MAGIC   0x52523344  /* "D3RR" */
+#define HAL_RECORD_VERSION 1
+
+/**
+ * Entry flags
+ */
+#define HAL_RECORD_WRITE       0x01  //!< Register write, read otherwise
+#define HAL_RECORD_FAILED      0x02  //!< Transaction failed
+#define HAL_RECORD_RETRY_SHIFT 4     //!< Retries, saturated to 15
+#define HAL_RECORD_RETRY_MASK  0xf0
+
+/**
+ * Stream header
+ */
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t entry_size;
+    uint16_t reserved;
+} hal_record_header_t;
+
+/**
+ * Transaction, 12 bytes, followed by the payload
+ */
+typedef struct {
+    uint32_t timestamp_us;  //!< Start of the transaction, from `hal_clock_us`
+    uint32_t duration_us;
+    uint8_t addr;           //!< 7-bit device address
+    uint8_t reg;            //!< Register address
+    uint8_t flags;          //!< `HAL_RECORD_*` flags
+    uint8_t len;            //!< Payload size, transactions are limited to 255 bytes
+} hal_record_entry_t;
+
+/**
+ * Output of a recording, e.g. a wrapper around `fwrite`
+ */
+typedef bool (*hal_record_sink_t)(void *arg, const void *data, size_t size);
+
+/**
+ * Recorder, the `ctx` of devices using `hal_record_ops`
+ */
+typedef struct {
+    const hal_ops_t *ops;   //!< Backend the transactions go to
+    void *ctx;              //!< Its context
+    hal_record_sink_t sink;
+    void *sink_arg;
+    uint32_t entries;       //!< Transactions recorded
+    bool error;             //!< Set if the sink failed, the recording is incomplete
+} hal_record_t;
+
+/**
+ * Delay, used to take the recorded time of each transaction
+ */
+typedef void (*hal_replay_delay_t)(void *arg, uint32_t us);
+
+/**
+ * Replayer, the `ctx` of devices using `hal_replay_ops`
+ */
+typedef struct {
+    const uint8_t *data;      //!< Recording
+    size_t size;
+    size_t pos;               //!< Offset of the next entry
+    hal_replay_delay_t delay; //!< NULL to replay as fast as possible
+    void *delay_arg;
+    uint64_t time_us;         //!< Recorded time of the last entry, from the first one
+    uint32_t last_us;
+    uint32_t paced_us;        //!< Recorded time the delays have reached
+    uint32_t mark_us;         //!< `hal_clock_us` when they reached it
+    uint32_t transactions;    //!< Transactions replayed
+    uint32_t mismatches;      //!< Transactions that differed from the recording
+    uint32_t overruns;        //!< Transactions past the end of the recording
+    uint64_t bus_us;          //!< Recorded duration of the replayed transactions
+} hal_replay_t;
+
+extern const hal_ops_t hal_record_ops;
+extern const hal_ops_t hal_replay_ops;
+
+/**
+ * @brief Start a recording and write the stream header
+ *
+ * Set `dev->ops` to `&hal_record_ops` and `dev->ctx` to `rec` afterwards.
+ * Timestamps come from `hal_clock_us`, set a source first.
+ *
+ * @param rec Recorder
+ * @param ops Backend to record, e.g. `&hal_linux_ops`
+ * @param ctx Its context
+ * @param sink Output
+ * @param sink_arg Argument passed to `sink`
+ * @return true to indicate success
+ */
+bool hal_record_start(hal_record_t *rec, const hal_ops_t *ops, void *ctx, hal_record_sink_t sink, void *sink_arg);
+
+/**
+ * @brief Open a recording for replay
+ *
+ * Set `dev->ops` to `&hal_replay_ops` and `dev->ctx` to `rp` afterwards.
+ *
+ * A read returns the recorded data and result. A transaction that differs
+ * from the recording in direction, address, register, size or, for a write,
+ * payload is counted as a mismatch and fails, the entry is consumed either way.
+ *
+ * @param rp Replayer
+ * @param data Recording, kept in place
+ * @param size Size of `data`
+ * @param delay Called with the recorded gap before each transaction, less
+ *              the time `hal_clock_us` saw the driver take since the previous
+ *              one, and with its recorded duration. NULL for none
+ * @param delay_arg Argument passed to `delay`
+ * @return false if `data` is not a recording
+ */
+bool hal_replay_open(hal_replay_t *rp, const void *data, size_t size, hal_replay_delay_t delay, void *delay_arg);
+
+/**
+ * @brief Check if every recorded transaction has been replayed
+ * @param rp Replayer
+ * @return true at the end of the recording
+ */
+bool hal_replay_done(const hal_replay_t *rp);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
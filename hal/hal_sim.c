@@ -0,0 +1,568 @@
+/**
+ * I2C Hardware Abstraction Layer backed by a simulated DS3231
+ *
+ * Models the register file, the calendar counters, the alarms and an
+ * oscillator with an injectable frequency error, so the driver can be
+ * exercised on a host without hardware. Only 24-hour mode is modelled
+ * by the calendar counters. The edge counter HAL is implemented on the
+ * 32kHz output of the device on the same port. Bus and device faults can
+ * be injected reproducibly, see `hal_sim_set_faults`.
+ *
+ * Backend `hal_sim_ops`, the I2C port, and the channel of the simulated mux
+ * if one is selected, selects the simulated device.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_sim.h"
+#include "hal_counter.h"
+#include "../ds3231.h"
+#include <string.h>
+
+#define NS_PER_SEC 1000000000.0
+
+#define SIM_32KHZ 32768
+
+/* Seconds between automatic temperature conversions */
+#define SIM_TEMPCONV_PERIOD 64
+
+#define SIM_DEFAULT_FREQ 400000
+
+/* SCL clocks per byte including ACK, and per START/STOP condition */
+#define SIM_CLOCKS_PER_BYTE 9
+#define SIM_CLOCKS_PER_COND 1
+
+#define SIM_DEFAULT_SEED 0x2545f491
+
+typedef struct
+{
+    uint8_t regs[HAL_SIM_NREGS];
+    uint8_t ptr;              /* register pointer */
+    uint64_t now_ns;          /* reference time */
+    double phase_ns;          /* oscillator time since the last second tick */
+    double drift_ppm;         /* injected frequency error */
+    double edges_32k;         /* 32kHz output cycles since reset */
+    int8_t aging;             /* aging offset latched by the last conversion */
+    uint32_t tempconv_count;  /* seconds since the last conversion */
+    int16_t temp;
+    uint32_t freq_hz;         /* bus timing model */
+    uint32_t stretch_ns;
+    uint64_t bus_ns;          /* accumulated bus usage */
+    uint32_t transactions;
+    hal_sim_faults_t faults;
+    hal_sim_fault_stats_t fault_stats;
+    uint32_t rng;             /* xorshift32 state of the fault generator */
+    uint64_t stuck_until_ns;  /* SDA held low until then */
+    uint64_t osc_stop_ns;     /* oscillator stopped for that much longer */
+} sim_dev_t;
+
+static sim_dev_t m_sim[HAL_SIM_MAX_PORTS];
+static uint8_t m_mux[HAL_SIM_MAX_PORTS];  /* channel mask of the mux on each port */
+
+static uint8_t bcd2dec(uint8_t val)
+{
+    return (val >> 4) * 10 + (val & 0x0f);
+}
+
+static uint8_t dec2bcd(uint8_t val)
+{
+    return ((val / 10) << 4) + (val % 10);
+}
+
+static sim_dev_t *sim_get(uint8_t port)
+{
+    return &m_sim[port % HAL_SIM_MAX_PORTS];
+}
+
+/* The chip treats every year divisible by 4 as a leap year */
+static uint8_t sim_days_in_month(uint8_t month, uint8_t year)
+{
+    static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (month == 2 && (year % 4) == 0) {
+        return 29;
+    }
+    return days[(month - 1) % 12];
+}
+
+static void sim_temp_conversion(sim_dev_t *sim)
+{
+    if (sim->faults.busy_stuck) {
+        sim->regs[DS3231_ADDR_STATUS] |= DS3231_STAT_BUSY;
+        return;
+    }
+
+    sim->aging = (int8_t)sim->regs[DS3231_ADDR_AGING];
+    sim->regs[DS3231_ADDR_TEMP] = (uint8_t)(sim->temp >> 2);
+    sim->regs[DS3231_ADDR_TEMP + 1] = (uint8_t)((sim->temp & 0x03) << 6);
+    sim->regs[DS3231_ADDR_CONTROL] &= ~DS3231_CTRL_TEMPCONV;
+    sim->tempconv_count = 0;
+}
+
+/* Compare alarm registers against the time registers, bit 7 of each alarm
+ * byte masks the field out of the comparison */
+static bool sim_alarm_match(const sim_dev_t *sim, uint8_t alarm, uint8_t first, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t a = sim->regs[alarm + i];
+        uint8_t t = sim->regs[first + i];
+
+        if (a & DS3231_ALARM_NOTSET) {
+            continue;
+        }
+        if (first + i == 3) {
+            /* day/date selector */
+            if (a & DS3231_ALARM_WDAY) {
+                t = sim->regs[3];
+            } else {
+                t = sim->regs[4];
+            }
+            a &= 0x3f;
+        }
+        if (a != t) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void sim_tick(sim_dev_t *sim)
+{
+    uint8_t *r = sim->regs;
+    uint8_t sec = bcd2dec(r[0]);
+    uint8_t min = bcd2dec(r[1]);
+    uint8_t hour = bcd2dec(r[2] & 0x3f);
+    uint8_t wday = bcd2dec(r[3]);
+    uint8_t mday = bcd2dec(r[4]);
+    uint8_t mon = bcd2dec(r[5] & DS3231_MONTH_MASK);
+    uint8_t century = r[5] & ~DS3231_MONTH_MASK;
+    uint8_t year = bcd2dec(r[6]);
+
+    if (++sec == 60) {
+        sec = 0;
+        if (++min == 60) {
+            min = 0;
+            if (++hour == 24) {
+                hour = 0;
+                wday = (wday % 7) + 1;
+                if (++mday > sim_days_in_month(mon, year)) {
+                    mday = 1;
+                    if (++mon > 12) {
+                        mon = 1;
+                        if (++year == 100) {
+                            year = 0;
+                            century ^= 0x80;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    r[0] = dec2bcd(sec);
+    r[1] = dec2bcd(min);
+    r[2] = dec2bcd(hour);
+    r[3] = dec2bcd(wday);
+    r[4] = dec2bcd(mday);
+    r[5] = dec2bcd(mon) | century;
+    r[6] = dec2bcd(year);
+
+    if (sim_alarm_match(sim, DS3231_ADDR_ALARM1, 0, 4)) {
+        r[DS3231_ADDR_STATUS] |= DS3231_STAT_ALARM_1;
+    }
+    if (sec == 0 && sim_alarm_match(sim, DS3231_ADDR_ALARM2, 1, 3)) {
+        r[DS3231_ADDR_STATUS] |= DS3231_STAT_ALARM_2;
+    }
+
+    if (++sim->tempconv_count >= SIM_TEMPCONV_PERIOD) {
+        sim_temp_conversion(sim);
+    }
+}
+
+static void sim_write(sim_dev_t *sim, uint8_t reg, uint8_t val)
+{
+    switch (reg) {
+    case DS3231_ADDR_TIME:
+        /* writing seconds resets the countdown chain */
+        sim->phase_ns = 0;
+        sim->regs[reg] = val;
+        break;
+    case DS3231_ADDR_STATUS:
+        /* OSF, A2F and A1F can only be cleared, BSY is read only */
+        sim->regs[reg] = (sim->regs[reg] & val & (DS3231_STAT_OSCILLATOR | DS3231_ALARM_BOTH))
+            | (val & DS3231_STAT_32KHZ) | (sim->regs[reg] & DS3231_STAT_BUSY);
+        break;
+    case DS3231_ADDR_TEMP:
+    case DS3231_ADDR_TEMP + 1:
+        break;
+    default:
+        sim->regs[reg] = val;
+        break;
+    }
+}
+
+/* Account a transaction on the bus and let the time pass */
+static void sim_bus(sim_dev_t *sim, uint8_t port, size_t bytes, size_t conditions, uint64_t extra_ns)
+{
+    uint64_t clocks = bytes * SIM_CLOCKS_PER_BYTE + conditions * SIM_CLOCKS_PER_COND;
+    uint64_t ns = clocks * 1000000000ULL / sim->freq_hz + bytes * sim->stretch_ns + extra_ns;
+
+    sim->bus_ns += ns;
+    sim->transactions++;
+    hal_sim_advance(port, ns);
+}
+
+/* True with a probability of ppm parts per million */
+static bool sim_chance(sim_dev_t *sim, uint32_t ppm)
+{
+    if (ppm == 0) {
+        return false;
+    }
+
+    sim->rng ^= sim->rng << 13;
+    sim->rng ^= sim->rng >> 17;
+    sim->rng ^= sim->rng << 5;
+
+    return sim->rng % 1000000 < ppm;
+}
+
+/* Bus faults, unlike host side spikes, depend on the SCL frequency */
+static bool sim_bus_faults(const sim_dev_t *sim)
+{
+    return sim->faults.fault_above_hz == 0 || sim->freq_hz > sim->faults.fault_above_hz;
+}
+
+/* Inject faults at the start of a transaction, returns false if it fails,
+ * after having taken its time. Otherwise sets the stall time to add. */
+static bool sim_faults(sim_dev_t *sim, uint8_t port, uint64_t *stall_ns)
+{
+    hal_sim_faults_t *f = &sim->faults;
+    hal_sim_fault_stats_t *st = &sim->fault_stats;
+    uint64_t before = sim->bus_ns;
+
+    *stall_ns = 0;
+
+    if (sim_chance(sim, f->spike_ppm)) {
+        st->spikes++;
+        st->wasted_ns += f->spike_ns;
+        hal_sim_advance(port, f->spike_ns);
+    }
+
+    if (!sim_bus_faults(sim)) {
+        return true;
+    }
+
+    if (sim->now_ns < sim->stuck_until_ns || sim_chance(sim, f->stuck_sda_ppm)) {
+        if (sim->now_ns >= sim->stuck_until_ns) {
+            sim->stuck_until_ns = sim->now_ns + f->stuck_sda_ns;
+        }
+        /* the master sees the bus busy and gives up after the address byte */
+        st->stuck++;
+        sim_bus(sim, port, 1, 2, 0);
+        st->wasted_ns += sim->bus_ns - before;
+        return false;
+    }
+
+    if (sim_chance(sim, f->nack_ppm)) {
+        st->nacks++;
+        sim_bus(sim, port, 1, 2, 0);
+        st->wasted_ns += sim->bus_ns - before;
+        return false;
+    }
+
+    if (sim_chance(sim, f->stall_ppm)) {
+        st->stalls++;
+        st->wasted_ns += f->stall_ns;
+        *stall_ns = f->stall_ns;
+    }
+
+    return true;
+}
+
+void hal_sim_reset(uint8_t port)
+{
+    sim_dev_t *sim = sim_get(port);
+
+    memset(sim, 0, sizeof(*sim));
+    sim->regs[3] = 0x07;  /* 2000-01-01 was a Saturday */
+    sim->regs[4] = 0x01;
+    sim->regs[5] = 0x01;
+    sim->regs[DS3231_ADDR_CONTROL] = DS3231_SQWAVE_8192HZ | DS3231_CTRL_ALARM_INTS;
+    sim->regs[DS3231_ADDR_STATUS] = DS3231_STAT_OSCILLATOR | DS3231_STAT_32KHZ;
+    sim->temp = 25 << 2;
+    sim->freq_hz = SIM_DEFAULT_FREQ;
+    sim->rng = SIM_DEFAULT_SEED;
+    sim_temp_conversion(sim);
+}
+
+void hal_sim_set_drift(uint8_t port, double ppm)
+{
+    sim_get(port)->drift_ppm = ppm;
+}
+
+void hal_sim_set_temp(uint8_t port, int16_t raw)
+{
+    sim_get(port)->temp = raw;
+}
+
+void hal_sim_advance(uint8_t port, uint64_t ns)
+{
+    sim_dev_t *sim = sim_get(port);
+    double ppm = sim->drift_ppm - sim->aging * (DS3231_AGING_PPB_PER_LSB / 1000.0);
+
+    uint64_t stopped = ns < sim->osc_stop_ns ? ns : sim->osc_stop_ns;
+
+    sim->now_ns += ns;
+    sim->osc_stop_ns -= stopped;
+    ns -= stopped;
+
+    sim->phase_ns += ns * (1.0 + ppm * 1e-6);
+    if (sim->regs[DS3231_ADDR_STATUS] & DS3231_STAT_32KHZ) {
+        sim->edges_32k += ns * (1.0 + ppm * 1e-6) * (SIM_32KHZ / NS_PER_SEC);
+    }
+    while (sim->phase_ns >= NS_PER_SEC) {
+        sim->phase_ns -= NS_PER_SEC;
+        sim_tick(sim);
+    }
+}
+
+uint64_t hal_sim_now_ns(uint8_t port)
+{
+    return sim_get(port)->now_ns;
+}
+
+uint8_t hal_sim_peek(uint8_t port, uint8_t reg)
+{
+    return sim_get(port)->regs[reg % HAL_SIM_NREGS];
+}
+
+void hal_sim_poke(uint8_t port, uint8_t reg, uint8_t val)
+{
+    sim_get(port)->regs[reg % HAL_SIM_NREGS] = val;
+}
+
+void hal_sim_set_bus(uint8_t port, uint32_t freq_hz, uint32_t stretch_ns)
+{
+    sim_dev_t *sim = sim_get(port);
+
+    sim->freq_hz = freq_hz ? freq_hz : SIM_DEFAULT_FREQ;
+    sim->stretch_ns = stretch_ns;
+}
+
+void hal_sim_get_bus_usage(uint8_t port, uint64_t *bus_ns, uint32_t *transactions)
+{
+    sim_dev_t *sim = sim_get(port);
+
+    if (bus_ns) {
+        *bus_ns = sim->bus_ns;
+    }
+    if (transactions) {
+        *transactions = sim->transactions;
+    }
+}
+
+void hal_sim_reset_bus_usage(uint8_t port)
+{
+    sim_dev_t *sim = sim_get(port);
+
+    sim->bus_ns = 0;
+    sim->transactions = 0;
+}
+
+void hal_sim_set_faults(uint8_t port, const hal_sim_faults_t *faults)
+{
+    sim_dev_t *sim = sim_get(port);
+
+    memset(&sim->faults, 0, sizeof(sim->faults));
+    memset(&sim->fault_stats, 0, sizeof(sim->fault_stats));
+    sim->stuck_until_ns = 0;
+    sim->rng = SIM_DEFAULT_SEED;
+    sim->regs[DS3231_ADDR_STATUS] &= ~DS3231_STAT_BUSY;
+
+    if (faults) {
+        sim->faults = *faults;
+        if (faults->seed) {
+            sim->rng = faults->seed;
+        }
+        if (faults->busy_stuck) {
+            sim->regs[DS3231_ADDR_STATUS] |= DS3231_STAT_BUSY;
+        }
+    }
+}
+
+void hal_sim_get_fault_stats(uint8_t port, hal_sim_fault_stats_t *stats)
+{
+    *stats = sim_get(port)->fault_stats;
+}
+
+void hal_sim_stop_oscillator(uint8_t port, uint64_t ns)
+{
+    sim_dev_t *sim = sim_get(port);
+
+    sim->regs[DS3231_ADDR_STATUS] |= DS3231_STAT_OSCILLATOR;
+    sim->osc_stop_ns += ns;
+}
+
+static bool sim_init(const i2c_dev_t *dev)
+{
+    if (dev->port >= HAL_SIM_MAX_PORTS) {
+        return false;
+    }
+
+    /* power on a device that was never reset */
+    if (sim_get(dev->port)->freq_hz == 0) {
+        hal_sim_reset(dev->port);
+    }
+    if (dev->clk_speed) {
+        sim_get(dev->port)->freq_hz = dev->clk_speed;
+    }
+
+    return true;
+}
+
+static bool sim_set_speed(const i2c_dev_t *dev, uint32_t hz)
+{
+    sim_get(dev->port)->freq_hz = hz ? hz : SIM_DEFAULT_FREQ;
+
+    return true;
+}
+
+static bool sim_free(const i2c_dev_t *dev)
+{
+    (void)dev;
+    return true;
+}
+
+/* Port of the device a transaction reaches through the mux, false if
+ * several channels are selected and the devices answer at once */
+static bool sim_route(const i2c_dev_t *dev, uint8_t *port)
+{
+    uint8_t mask = m_mux[dev->port % HAL_SIM_MAX_PORTS];
+    uint8_t channel = 0;
+
+    if (mask & (mask - 1)) {
+        return false;
+    }
+    if (mask == 0) {
+        *port = dev->port;
+    } else {
+        while (mask > 1) {
+            mask >>= 1;
+            channel++;
+        }
+        *port = dev->port + 1 + channel;
+    }
+
+    /* power on a device that was never reset */
+    if (sim_get(*port)->freq_hz == 0) {
+        hal_sim_reset(*port);
+    }
+    return true;
+}
+
+/* The mux takes its control register as the only byte written */
+static bool sim_mux_write(const i2c_dev_t *dev, uint8_t mask, size_t out_size)
+{
+    if (out_size != 0) {
+        return false;
+    }
+    m_mux[dev->port % HAL_SIM_MAX_PORTS] = mask;
+    sim_bus(sim_get(dev->port), dev->port, 2, 2, 0);
+
+    return true;
+}
+
+static bool sim_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
+{
+    const uint8_t *data = out_data;
+    uint64_t stall_ns;
+    uint8_t port;
+
+    (void)retries;
+    if (dev->addr == HAL_SIM_MUX_ADDR) {
+        return sim_mux_write(dev, reg, out_size);
+    }
+    if (dev->addr != DS3231_ADDR || reg >= HAL_SIM_NREGS || sim_route(dev, &port) != true) {
+        return false;
+    }
+
+    sim_dev_t *sim = sim_get(port);
+
+    if (sim_faults(sim, port, &stall_ns) != true) {
+        return false;
+    }
+    sim_bus(sim, port, 2 + out_size, 2, stall_ns);
+
+    sim->ptr = reg;
+    for (size_t i = 0; i < out_size; i++) {
+        sim_write(sim, sim->ptr, data[i]);
+        sim->ptr = (sim->ptr + 1) % HAL_SIM_NREGS;
+    }
+
+    if (sim->regs[DS3231_ADDR_CONTROL] & DS3231_CTRL_TEMPCONV) {
+        sim_temp_conversion(sim);
+    }
+
+    return true;
+}
+
+static bool sim_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
+{
+    uint8_t *data = in_data;
+    uint64_t stall_ns;
+    uint8_t port;
+
+    (void)retries;
+    if (dev->addr != DS3231_ADDR || reg >= HAL_SIM_NREGS || sim_route(dev, &port) != true) {
+        return false;
+    }
+
+    sim_dev_t *sim = sim_get(port);
+
+    if (sim_faults(sim, port, &stall_ns) != true) {
+        return false;
+    }
+
+    /* The whole transfer is served from one snapshot, like the
+     * user buffers latched by the chip on START */
+    sim->ptr = reg;
+    for (size_t i = 0; i < in_size; i++) {
+        data[i] = sim->regs[sim->ptr];
+        sim->ptr = (sim->ptr + 1) % HAL_SIM_NREGS;
+        if (sim_bus_faults(sim) && sim_chance(sim, sim->faults.bitflip_ppm)) {
+            sim->fault_stats.bitflips++;
+            data[i] ^= 1 << (sim->rng >> 29);
+        }
+    }
+    sim_bus(sim, port, 3 + in_size, 3, stall_ns);
+
+    return true;
+}
+
+const hal_ops_t hal_sim_ops = {
+    .name      = "sim",
+    .init      = sim_init,
+    .free      = sim_free,
+    .write_reg = sim_write_reg,
+    .read_reg  = sim_read_reg,
+    .set_speed = sim_set_speed,
+};
+
+bool hal_counter_init(uint8_t id, uint8_t pin)
+{
+    (void)pin;
+    return id < HAL_SIM_MAX_PORTS;
+}
+
+bool hal_counter_free(uint8_t id)
+{
+    (void)id;
+    return true;
+}
+
+uint32_t hal_counter_read(uint8_t id)
+{
+    return (uint32_t)(uint64_t)sim_get(id)->edges_32k;
+}
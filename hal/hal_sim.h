@@ -0,0 +1,195 @@
+/**
+ * I2C Hardware Abstraction Layer backed by a simulated DS3231
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_SIM_H__
+#define __HAL_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of simulated devices, one per I2C port
+ */
+#ifndef HAL_SIM_MAX_PORTS
+#define HAL_SIM_MAX_PORTS 4
+#endif
+
+/**
+ * Address of the simulated TCA9548A style mux on every port. Channel C of
+ * the mux on port P reaches the device of port P + 1 + C, the device of
+ * the port itself is reached while no channel is selected.
+ */
+#define HAL_SIM_MUX_ADDR 0x70
+
+/**
+ * Size of the DS3231 register file
+ */
+#define HAL_SIM_NREGS 0x13
+
+/**
+ * Faults injected into transactions, probabilities in parts per million
+ */
+typedef struct {
+    uint32_t seed;            //!< Seed of the fault generator, 0 for a fixed default
+    uint32_t nack_ppm;        //!< Address not acknowledged, per transaction
+    uint32_t stuck_sda_ppm;   //!< SDA held low, per transaction
+    uint32_t stuck_sda_ns;    //!< Time SDA stays low, transactions fail meanwhile
+    uint32_t stall_ppm;       //!< Clock stretching stall, per transaction
+    uint32_t stall_ns;        //!< Length of a stall, the bus is busy meanwhile
+    uint32_t bitflip_ppm;     //!< Single bit error in a byte read, per byte
+    uint32_t spike_ppm;       //!< Host side latency spike, per transaction
+    uint32_t spike_ns;        //!< Length of a spike, the bus is idle meanwhile
+    bool busy_stuck;          //!< BSY stays set and temperature conversions never finish
+    uint32_t fault_above_hz;  //!< Bus faults only above this SCL frequency, e.g. a long cable, 0 at any
+} hal_sim_faults_t;
+
+/**
+ * Faults injected since they were configured
+ */
+typedef struct {
+    uint32_t nacks;
+    uint32_t stuck;           //!< Transactions failed on a stuck bus
+    uint32_t stalls;
+    uint32_t bitflips;
+    uint32_t spikes;
+    uint64_t wasted_ns;       //!< Time of failed transactions, stalls and spikes
+} hal_sim_fault_stats_t;
+
+/**
+ * @brief Reset the simulated device to its power-on state
+ *
+ * Time is 2000-01-01 00:00:00, the oscillator stop flag is set,
+ * drift and aging offset are zero and the temperature is 25 degrees Celsius.
+ *
+ * @param port I2C port of the device
+ */
+void hal_sim_reset(uint8_t port);
+
+/**
+ * @brief Inject a frequency error into the simulated oscillator
+ *
+ * The effective error is `ppm` minus the correction of the aging register.
+ *
+ * @param port I2C port of the device
+ * @param ppm Frequency error, positive values make the clock run fast
+ */
+void hal_sim_set_drift(uint8_t port, double ppm);
+
+/**
+ * @brief Set the temperature returned by the simulated sensor
+ * @param port I2C port of the device
+ * @param raw Temperature in 0.25 degrees Celsius units
+ */
+void hal_sim_set_temp(uint8_t port, int16_t raw);
+
+/**
+ * @brief Advance the simulated reference time
+ *
+ * Seconds, calendar and alarm flags are updated as the oscillator ticks,
+ * the 32kHz output counted by `hal_counter_read(port)` runs while enabled.
+ *
+ * @param port I2C port of the device
+ * @param ns Nanoseconds of reference time
+ */
+void hal_sim_advance(uint8_t port, uint64_t ns);
+
+/**
+ * @brief Get the simulated reference time
+ * @param port I2C port of the device
+ * @return Nanoseconds of reference time since the last reset
+ */
+uint64_t hal_sim_now_ns(uint8_t port);
+
+/**
+ * @brief Read a register without going through the bus
+ * @param port I2C port of the device
+ * @param reg Register address
+ * @return Register value
+ */
+uint8_t hal_sim_peek(uint8_t port, uint8_t reg);
+
+/**
+ * @brief Write a register without going through the bus
+ *
+ * Unlike bus writes, every bit can be set, including status flags.
+ *
+ * @param port I2C port of the device
+ * @param reg Register address
+ * @param val Register value
+ */
+void hal_sim_poke(uint8_t port, uint8_t reg, uint8_t val);
+
+/**
+ * @brief Configure the bus timing model
+ *
+ * Every transaction advances the reference time by its duration on the
+ * bus: 9 clocks per byte plus START, repeated START and STOP conditions,
+ * and `stretch_ns` of clock stretching after each byte.
+ * Defaults to 400 kHz without stretching, or to `clk_speed` of the device
+ * descriptor at init. `hal_i2c_set_speed` changes the frequency as well.
+ *
+ * @param port I2C port of the device
+ * @param freq_hz SCL frequency
+ * @param stretch_ns Clock stretching per byte
+ */
+void hal_sim_set_bus(uint8_t port, uint32_t freq_hz, uint32_t stretch_ns);
+
+/**
+ * @brief Get accumulated bus usage
+ * @param port I2C port of the device
+ * @param[out] bus_ns Time the bus was busy, may be NULL
+ * @param[out] transactions Number of transactions, may be NULL
+ */
+void hal_sim_get_bus_usage(uint8_t port, uint64_t *bus_ns, uint32_t *transactions);
+
+/**
+ * @brief Clear accumulated bus usage
+ * @param port I2C port of the device
+ */
+void hal_sim_reset_bus_usage(uint8_t port);
+
+/**
+ * @brief Configure fault injection
+ *
+ * Faults are drawn from a generator seeded by `faults->seed`, so the same
+ * configuration and the same transactions give the same faults.
+ * Clears the fault statistics.
+ *
+ * @param port I2C port of the device
+ * @param faults Faults, NULL to disable
+ */
+void hal_sim_set_faults(uint8_t port, const hal_sim_faults_t *faults);
+
+/**
+ * @brief Get the faults injected
+ * @param port I2C port of the device
+ * @param[out] stats Fault statistics
+ */
+void hal_sim_get_fault_stats(uint8_t port, hal_sim_fault_stats_t *stats);
+
+/**
+ * @brief Stop the oscillator for a while
+ *
+ * Sets the oscillator stop flag, the time registers and the 32kHz output
+ * stand still for `ns` of reference time, as on a brown-out of both supplies.
+ *
+ * @param port I2C port of the device
+ * @param ns Reference time the oscillator is stopped
+ */
+void hal_sim_stop_oscillator(uint8_t port, uint64_t ns);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
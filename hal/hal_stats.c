@@ -0,0 +1,119 @@
+/**
+ * I2C transaction statistics
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_stats.h"
+#include <string.h>
+
+#define SUB_MASK ((1u << HAL_STATS_SUB_BITS) - 1)
+
+/* Exact buckets below 2^HAL_STATS_SUB_BITS, then 2^HAL_STATS_SUB_BITS
+ * buckets per power of two */
+static unsigned stats_bucket(uint32_t us)
+{
+    unsigned log2 = 0;
+
+    if (us <= SUB_MASK) {
+        return us;
+    }
+    for (uint32_t v = us; v > 1; v >>= 1) {
+        log2++;
+    }
+    if (log2 >= HAL_STATS_MAX_LOG2) {
+        return HAL_STATS_BUCKETS - 1;
+    }
+
+    return ((log2 - HAL_STATS_SUB_BITS + 1) << HAL_STATS_SUB_BITS)
+        | ((us >> (log2 - HAL_STATS_SUB_BITS)) & SUB_MASK);
+}
+
+uint32_t hal_stats_bucket_us(unsigned bucket)
+{
+    if (bucket <= SUB_MASK) {
+        return bucket;
+    }
+
+    unsigned log2 = (bucket >> HAL_STATS_SUB_BITS) + HAL_STATS_SUB_BITS - 1;
+    return (1u << log2) | ((bucket & SUB_MASK) << (log2 - HAL_STATS_SUB_BITS));
+}
+
+void hal_stats_record(hal_stats_t *stats, bool write, size_t size, bool ok, uint8_t retries, uint32_t latency_us)
+{
+    stats->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (write) {
+        stats->writes++;
+        stats->write_bytes += size;
+    } else {
+        stats->reads++;
+        stats->read_bytes += size;
+    }
+    if (!ok) {
+        stats->failures++;
+    }
+    stats->retries += retries;
+    if (latency_us > stats->latency_max_us) {
+        stats->latency_max_us = latency_us;
+    }
+    stats->latency_sum_us += latency_us;
+    stats->hist[stats_bucket(latency_us)]++;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    stats->seq++;
+}
+
+void hal_stats_snapshot(const hal_stats_t *stats, hal_stats_t *out)
+{
+    uint32_t seq;
+
+    do {
+        seq = stats->seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        memcpy(out, stats, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != stats->seq);
+}
+
+void hal_stats_reset(hal_stats_t *stats)
+{
+    uint32_t seq = stats->seq;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->seq = seq + 2;
+}
+
+uint32_t hal_stats_percentile_us(const hal_stats_t *stats, unsigned percent)
+{
+    uint64_t total = 0, count = 0;
+
+    for (unsigned i = 0; i < HAL_STATS_BUCKETS; i++) {
+        total += stats->hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (total * percent + 99) / 100;
+    for (unsigned i = 0; i < HAL_STATS_BUCKETS; i++) {
+        count += stats->hist[i];
+        if (count >= target && count > 0) {
+            return hal_stats_bucket_us(i);
+        }
+    }
+    return hal_stats_bucket_us(HAL_STATS_BUCKETS - 1);
+}
+
+uint32_t hal_stats_throughput(const hal_stats_t *stats)
+{
+    if (stats->latency_sum_us == 0) {
+        return 0;
+    }
+
+    uint64_t bytes = (uint64_t)stats->read_bytes + stats->write_bytes;
+    return (uint32_t)(bytes * 1000000 / stats->latency_sum_us);
+}
@@ -0,0 +1,125 @@
+/**
+ * I2C transaction statistics
+ *
+ * Per device counters of transactions, bytes, failures and retries and a
+ * log-linear histogram of transaction latency. The dispatcher in hal.c
+ * records every transaction through `HAL_STATS_BEGIN`/`HAL_STATS_END`, which compile
+ * to nothing unless `HAL_STATS_ENABLED` is set to 1.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_STATS_H__
+#define __HAL_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#ifndef HAL_STATS_ENABLED
+#define HAL_STATS_ENABLED 0
+#endif
+
+/**
+ * Histogram resolution: 2^HAL_STATS_SUB_BITS buckets per power of two
+ * of microseconds, up to 2^HAL_STATS_MAX_LOG2 microseconds
+ */
+#define HAL_STATS_SUB_BITS 2
+#define HAL_STATS_MAX_LOG2 20
+#define HAL_STATS_BUCKETS  ((HAL_STATS_MAX_LOG2 - HAL_STATS_SUB_BITS + 1) << HAL_STATS_SUB_BITS)
+
+/**
+ * Transaction statistics
+ */
+typedef struct {
+    volatile uint32_t seq;   //!< Odd while a record is in progress
+    uint32_t reads;          //!< Register read transactions
+    uint32_t writes;         //!< Register write transactions
+    uint32_t read_bytes;     //!< Payload bytes read
+    uint32_t write_bytes;    //!< Payload bytes written
+    uint32_t failures;       //!< Failed transactions, after retries
+    uint32_t retries;        //!< Repeated attempts
+    uint32_t latency_max_us; //!< Slowest transaction
+    uint64_t latency_sum_us; //!< Total time spent on the bus
+    uint32_t hist[HAL_STATS_BUCKETS]; //!< Latency histogram, see `hal_stats_bucket_us`
+} hal_stats_t;
+
+/**
+ * @brief Record a transaction
+ * @param stats Statistics
+ * @param write true for a register write
+ * @param size Payload size
+ * @param ok Transaction result
+ * @param retries Number of repeated attempts
+ * @param latency_us Transaction time, including retries
+ */
+void hal_stats_record(hal_stats_t *stats, bool write, size_t size, bool ok, uint8_t retries, uint32_t latency_us);
+
+/**
+ * @brief Take a consistent copy of the statistics
+ * @param stats Statistics
+ * @param[out] out Copy
+ */
+void hal_stats_snapshot(const hal_stats_t *stats, hal_stats_t *out);
+
+/**
+ * @brief Clear the statistics
+ * @param stats Statistics
+ */
+void hal_stats_reset(hal_stats_t *stats);
+
+/**
+ * @brief Get the lowest latency counted by a histogram bucket
+ * @param bucket Bucket index
+ * @return Microseconds
+ */
+uint32_t hal_stats_bucket_us(unsigned bucket);
+
+/**
+ * @brief Estimate a latency percentile from the histogram
+ * @param stats Statistics
+ * @param percent Percentile, 0 to 100
+ * @return Lower bound of the bucket holding the percentile, microseconds
+ */
+uint32_t hal_stats_percentile_us(const hal_stats_t *stats, unsigned percent);
+
+/**
+ * @brief Get the payload throughput achieved while on the bus
+ *
+ * Bytes read and written over the time spent in transactions, including
+ * failed ones and retries, so it falls with the error rate as well as with
+ * the bus frequency.
+ *
+ * @param stats Statistics
+ * @return Bytes per second, 0 before the first transaction
+ */
+uint32_t hal_stats_throughput(const hal_stats_t *stats);
+
+#if HAL_STATS_ENABLED
+#include "hal_clock.h"
+
+#define HAL_STATS_BEGIN() \
+    uint32_t hal_stats_start = hal_clock_us()
+
+#define HAL_STATS_END(dev, write, size, ok, retries) \
+    do { \
+        if ((dev)->stats) { \
+            hal_stats_record((dev)->stats, write, size, ok, retries, hal_clock_us() - hal_stats_start); \
+        } \
+    } while (0)
+#else
+#define HAL_STATS_BEGIN() do {} while (0)
+#define HAL_STATS_END(dev, write, size, ok, retries) do {} while (0)
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * I2C transaction trace
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#include "hal_trace.h"
+#include "hal_clock.h"
+#include <string.h>
+
+#if (HAL_TRACE_RECORDS & (HAL_TRACE_RECORDS - 1)) != 0
+#error "HAL_TRACE_RECORDS must be a power of two"
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t head;  /* records written, the next slot is head % HAL_TRACE_RECORDS */
+    hal_trace_record_t records[HAL_TRACE_RECORDS];
+} trace_ring_t;
+
+#ifdef HAL_TRACE_SECTION
+static trace_ring_t m_ring __attribute__((section(HAL_TRACE_SECTION)));
+#else
+static trace_ring_t m_ring;
+#endif
+
+void hal_trace_init(void)
+{
+    if (m_ring.magic != HAL_TRACE_MAGIC) {
+        hal_trace_reset();
+    }
+}
+
+void hal_trace_reset(void)
+{
+    memset(&m_ring, 0, sizeof(m_ring));
+    m_ring.magic = HAL_TRACE_MAGIC;
+}
+
+void hal_trace_record(uint8_t port, uint8_t addr, bool write, uint8_t reg, const void *data, size_t size,
+        bool ok, uint8_t retries, uint32_t start_us)
+{
+    uint32_t duration = hal_clock_us() - start_us;
+    uint32_t slot = __atomic_fetch_add(&m_ring.head, 1, __ATOMIC_RELAXED) & (HAL_TRACE_RECORDS - 1);
+    hal_trace_record_t *rec = &m_ring.records[slot];
+
+    rec->timestamp_us = start_us;
+    rec->duration_us = duration > UINT16_MAX ? UINT16_MAX : duration;
+    rec->addr = addr;
+    rec->reg = reg;
+    rec->flags = (write ? HAL_TRACE_WRITE : 0) | (ok ? 0 : HAL_TRACE_FAILED)
+        | ((retries > 3 ? 3 : retries) << HAL_TRACE_RETRY_SHIFT)
+        | ((port << HAL_TRACE_PORT_SHIFT) & HAL_TRACE_PORT_MASK);
+    rec->len = size > UINT8_MAX ? UINT8_MAX : size;
+
+    size_t copy = size < HAL_TRACE_DATA_BYTES ? size : HAL_TRACE_DATA_BYTES;
+    memset(rec->data, 0, sizeof(rec->data));
+    /* the bytes of a failed write are what was sent, those of a failed read are garbage */
+    if (data != NULL && (ok || write)) {
+        memcpy(rec->data, data, copy);
+    }
+}
+
+size_t hal_trace_dump(void *buf, size_t size)
+{
+    hal_trace_header_t header;
+    uint8_t *p = buf;
+
+    if (size < sizeof(header)) {
+        return 0;
+    }
+
+    uint32_t head = __atomic_load_n(&m_ring.head, __ATOMIC_ACQUIRE);
+    uint32_t count = head < HAL_TRACE_RECORDS ? head : HAL_TRACE_RECORDS;
+    uint32_t fit = (size - sizeof(header)) / sizeof(hal_trace_record_t);
+
+    /* keep the most recent records if the buffer is short */
+    if (count > fit) {
+        count = fit;
+    }
+
+    header.magic = HAL_TRACE_MAGIC;
+    header.version = HAL_TRACE_VERSION;
+    header.record_size = sizeof(hal_trace_record_t);
+    header.count = count;
+    header.total = head;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    for (uint32_t i = head - count; i != head; i++) {
+        memcpy(p, &m_ring.records[i & (HAL_TRACE_RECORDS - 1)], sizeof(hal_trace_record_t));
+        p += sizeof(hal_trace_record_t);
+    }
+
+    return p - (uint8_t *)buf;
+}
@@ -0,0 +1,140 @@
+/**
+ * I2C transaction trace
+ *
+ * Records every HAL transaction into a ring buffer of fixed-size binary
+ * records for post-mortem analysis, `tools/ds3231_tracedump.c` decodes
+ * dumps into a timeline or Chrome trace JSON. The dispatcher in hal.c records through
+ * `HAL_TRACE_BEGIN`/`HAL_TRACE_END`, which compile to nothing unless
+ * `HAL_TRACE_ENABLED` is set to 1.
+ *
+ * Slots are claimed with an atomic increment, so transactions may be
+ * recorded from threads and interrupt handlers alike. On cores without
+ * atomic instructions (Cortex-M0) `__atomic_fetch_add_4` has to be
+ * provided, e.g. with a critical section.
+ *
+ * Define `HAL_TRACE_SECTION` to place the buffer in a section that is not
+ * cleared on reset (e.g. ".noinit"), `hal_trace_init` then keeps the
+ * records of the previous run.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __HAL_TRACE_H__
+#define __HAL_TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#ifndef HAL_TRACE_ENABLED
+#define HAL_TRACE_ENABLED 0
+#endif
+
+/**
+ * Number of records, must be a power of two
+ */
+#ifndef HAL_TRACE_RECORDS
+#define HAL_TRACE_RECORDS 64
+#endif
+
+#define HAL_TRACE_MAGIC   0x43525448  /* "HTRC" */
+#define HAL_TRACE_VERSION 1
+
+/**
+ * Payload bytes kept per record
+ */
+#define HAL_TRACE_DATA_BYTES 6
+
+/**
+ * Record flags
+ */
+#define HAL_TRACE_WRITE        0x01  //!< Register write, read otherwise
+#define HAL_TRACE_FAILED       0x02  //!< Transaction failed
+#define HAL_TRACE_RETRY_SHIFT  2     //!< Retries, saturated to 3
+#define HAL_TRACE_RETRY_MASK   0x0c
+#define HAL_TRACE_PORT_SHIFT   4     //!< I2C port, low 4 bits
+#define HAL_TRACE_PORT_MASK    0xf0
+
+/**
+ * Trace record, 16 bytes, little-endian
+ */
+typedef struct {
+    uint32_t timestamp_us;  //!< Start of the transaction
+    uint16_t duration_us;   //!< Saturated to 65535
+    uint8_t addr;           //!< 7-bit device address
+    uint8_t reg;            //!< Register address
+    uint8_t flags;          //!< `HAL_TRACE_*` flags
+    uint8_t len;            //!< Payload size, saturated to 255
+    uint8_t data[HAL_TRACE_DATA_BYTES];  //!< First payload bytes
+} hal_trace_record_t;
+
+/**
+ * Dump header, followed by `count` records, oldest first
+ */
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t record_size;
+    uint16_t count;
+    uint32_t total;  //!< Records written since the buffer was cleared
+} hal_trace_header_t;
+
+/**
+ * @brief Prepare the buffer
+ *
+ * Keeps the records left from before a reset if the buffer is intact.
+ */
+void hal_trace_init(void);
+
+/**
+ * @brief Drop all records
+ */
+void hal_trace_reset(void);
+
+/**
+ * @brief Record a transaction
+ * @param port I2C port
+ * @param addr Device address
+ * @param write true for a register write
+ * @param reg Register address
+ * @param data Payload, kept for failed writes and dropped for failed reads
+ * @param size Payload size
+ * @param ok Transaction result
+ * @param retries Number of repeated attempts
+ * @param start_us Timestamp of the start of the transaction
+ */
+void hal_trace_record(uint8_t port, uint8_t addr, bool write, uint8_t reg, const void *data, size_t size,
+        bool ok, uint8_t retries, uint32_t start_us);
+
+/**
+ * @brief Dump the buffer
+ * @param[out] buf Output buffer
+ * @param size Size of `buf`, records that do not fit are skipped, oldest first
+ * @return Number of bytes written
+ */
+size_t hal_trace_dump(void *buf, size_t size);
+
+#if HAL_TRACE_ENABLED
+#include "hal_clock.h"
+
+#define HAL_TRACE_BEGIN() \
+    uint32_t hal_trace_start = hal_clock_us()
+
+#define HAL_TRACE_END(dev, write, reg, data, size, ok, retries) \
+    hal_trace_record((dev)->port, (dev)->addr, write, reg, data, size, ok, retries, hal_trace_start)
+#else
+#define HAL_TRACE_BEGIN() do {} while (0)
+#define HAL_TRACE_END(dev, write, reg, data, size, ok, retries) do {} while (0)
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
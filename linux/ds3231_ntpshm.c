@@ -0,0 +1,59 @@
+/*
+ * NTP shared memory reference clock export for DS3231 on Linux
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_ntpshm.h"
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+ds3231_ntpshm_t *ds3231_ntpshm_attach(unsigned unit)
+{
+    int perm = unit < 2 ? 0600 : 0666;
+
+    int id = shmget(DS3231_NTPSHM_KEY + unit, sizeof(ds3231_ntpshm_t), IPC_CREAT | perm);
+    if (id < 0) {
+        return NULL;
+    }
+
+    ds3231_ntpshm_t *shm = shmat(id, NULL, 0);
+    if (shm == (void *)-1) {
+        return NULL;
+    }
+
+    shm->valid = 0;
+    shm->mode = 1;
+    shm->nsamples = 3;
+
+    return shm;
+}
+
+void ds3231_ntpshm_detach(ds3231_ntpshm_t *shm)
+{
+    shmdt(shm);
+}
+
+void ds3231_ntpshm_write(ds3231_ntpshm_t *shm, const struct timespec *clock,
+        const struct timespec *receive, int leap, int precision)
+{
+    /* mode 1: readers discard the sample if count changed while they read */
+    shm->valid = 0;
+    shm->count++;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    shm->clockTimeStampSec = clock->tv_sec;
+    shm->clockTimeStampUSec = clock->tv_nsec / 1000;
+    shm->clockTimeStampNSec = clock->tv_nsec;
+    shm->receiveTimeStampSec = receive->tv_sec;
+    shm->receiveTimeStampUSec = receive->tv_nsec / 1000;
+    shm->receiveTimeStampNSec = receive->tv_nsec;
+    shm->leap = leap;
+    shm->precision = precision;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    shm->count++;
+    shm->valid = 1;
+}
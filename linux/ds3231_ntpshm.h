@@ -0,0 +1,85 @@
+/**
+ * NTP shared memory reference clock export for DS3231 on Linux
+ *
+ * Writes samples into the SHM segment of the ntpd "shared memory" driver
+ * (type 28), which chrony reads as `refclock SHM <unit>`.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_NTPSHM_H__
+#define __DS3231_NTPSHM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * SHM key of unit 0, unit N uses `DS3231_NTPSHM_KEY + N`
+ */
+#define DS3231_NTPSHM_KEY 0x4e545030
+
+/**
+ * Leap indicator, `DS3231_NTPSHM_LEAP_NOTINSYNC` when the time is not trustworthy
+ */
+#define DS3231_NTPSHM_LEAP_NONE      0
+#define DS3231_NTPSHM_LEAP_NOTINSYNC 3
+
+/**
+ * Segment layout shared with ntpd and chrony
+ */
+typedef struct {
+    int mode;
+    volatile int count;
+    time_t clockTimeStampSec;
+    int clockTimeStampUSec;
+    time_t receiveTimeStampSec;
+    int receiveTimeStampUSec;
+    int leap;
+    int precision;
+    int nsamples;
+    volatile int valid;
+    unsigned clockTimeStampNSec;
+    unsigned receiveTimeStampNSec;
+    int dummy[8];
+} ds3231_ntpshm_t;
+
+/**
+ * @brief Attach to the segment of a unit, creating it if needed
+ *
+ * Units 0 and 1 are created root-only, higher units world-writable,
+ * as ntpd does.
+ *
+ * @param unit Unit number
+ * @return Attached segment, NULL on error
+ */
+ds3231_ntpshm_t *ds3231_ntpshm_attach(unsigned unit);
+
+/**
+ * @brief Detach from a segment
+ * @param shm Attached segment
+ */
+void ds3231_ntpshm_detach(ds3231_ntpshm_t *shm);
+
+/**
+ * @brief Publish a sample
+ * @param shm Attached segment
+ * @param clock Reference time, the RTC second the edge started
+ * @param receive System time (CLOCK_REALTIME) of the edge
+ * @param leap Leap indicator
+ * @param precision Precision as a power of two of seconds
+ */
+void ds3231_ntpshm_write(ds3231_ntpshm_t *shm, const struct timespec *clock,
+        const struct timespec *receive, int leap, int precision);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_NTPSHM_H__ */
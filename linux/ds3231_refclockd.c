@@ -0,0 +1,163 @@
+/*
+ * DS3231 reference clock daemon
+ *
+ * Timestamps the 1Hz squarewave edge with the GPIO character device
+ * (kernel timestamp in CLOCK_REALTIME) for the on-time mark, labels it
+ * with the second read from the RTC and feeds ntpd/chrony through the
+ * NTP SHM segment.
+ *
+ *     ds3231_refclockd [-b bus] [-c gpiochip] -l line [-u unit] [-r]
+ *
+ * `-r` selects the rising edge, the seconds register is updated on the
+ * falling one by default. For chrony:
+ *
+ *     refclock SHM 0 refid RTC precision 1e-6
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "../ds3231.h"
+#include "ds3231_ntpshm.h"
+
+#if !DS3231_CFG_SQUAREWAVE
+#error "ds3231_refclockd needs DS3231_CFG_SQUAREWAVE"
+#endif
+
+#define NS_PER_SEC 1000000000LL
+
+/* Labels read later than this after the edge are ambiguous */
+#define LABEL_MAX_DELAY_NS (300 * 1000 * 1000LL)
+
+/* About 1 us, the resolution of the edge timestamp */
+#define REFCLOCK_PRECISION (-20)
+
+static volatile sig_atomic_t m_stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    m_stop = 1;
+}
+
+static int request_edge(const char *chip, unsigned line, bool rising)
+{
+    struct gpio_v2_line_request req;
+
+    int fd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = line;
+    req.num_lines = 1;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME
+        | (rising ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING);
+    strncpy(req.consumer, "ds3231-sqw", sizeof(req.consumer) - 1);
+
+    int res = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+    close(fd);
+
+    return res < 0 ? -1 : req.fd;
+}
+
+int main(int argc, char **argv)
+{
+    const char *chip = "/dev/gpiochip0";
+    unsigned bus = 1, unit = 0;
+    int line = -1;
+    bool rising = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:c:l:u:r")) != -1) {
+        switch (opt) {
+        case 'b':
+            bus = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            chip = optarg;
+            break;
+        case 'l':
+            line = strtol(optarg, NULL, 0);
+            break;
+        case 'u':
+            unit = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rising = true;
+            break;
+        default:
+            line = -1;
+            break;
+        }
+    }
+    if (line < 0) {
+        fprintf(stderr, "usage: %s [-b bus] [-c gpiochip] -l line [-u unit] [-r]\n", argv[0]);
+        return 1;
+    }
+
+    i2c_dev_t dev = { .port = bus, .ops = &hal_linux_ops };
+    if (ds3231_init_dev(&dev) != true
+            || ds3231_set_squarewave_freq(&dev, DS3231_SQWAVE_1HZ) != true
+            || ds3231_enable_squarewave(&dev) != true) {
+        fprintf(stderr, "cannot set up DS3231 on /dev/i2c-%u\n", bus);
+        return 1;
+    }
+
+    int fd = request_edge(chip, line, rising);
+    if (fd < 0) {
+        fprintf(stderr, "cannot request %s line %d\n", chip, line);
+        return 1;
+    }
+
+    ds3231_ntpshm_t *shm = ds3231_ntpshm_attach(unit);
+    if (shm == NULL) {
+        fprintf(stderr, "cannot attach NTP SHM unit %u\n", unit);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (!m_stop) {
+        struct gpio_v2_line_event event;
+        struct timespec clock, receive, now;
+        ds3231_snapshot_t snap;
+
+        if (read(fd, &event, sizeof(event)) != sizeof(event)) {
+            continue;
+        }
+
+        /* the registers now hold the second that started at the edge,
+         * time and flags in one transaction */
+        if (ds3231_get_snapshot(&dev, &snap) != true) {
+            continue;
+        }
+        clock_gettime(CLOCK_REALTIME, &now);
+        if ((int64_t)(now.tv_sec * NS_PER_SEC + now.tv_nsec - event.timestamp_ns) > LABEL_MAX_DELAY_NS) {
+            continue;
+        }
+
+        clock.tv_sec = ds3231_tm_to_epoch(&snap.time);
+        clock.tv_nsec = 0;
+        receive.tv_sec = event.timestamp_ns / NS_PER_SEC;
+        receive.tv_nsec = event.timestamp_ns % NS_PER_SEC;
+        ds3231_ntpshm_write(shm, &clock, &receive,
+            (snap.status & DS3231_STAT_OSCILLATOR) ? DS3231_NTPSHM_LEAP_NOTINSYNC : DS3231_NTPSHM_LEAP_NONE, REFCLOCK_PRECISION);
+    }
+
+    ds3231_ntpshm_detach(shm);
+    close(fd);
+    ds3231_free(&dev);
+    return 0;
+}
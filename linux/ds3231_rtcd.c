@@ -0,0 +1,65 @@
+/*
+ * DS3231 /dev/rtc bridge daemon
+ *
+ * Serves RTC class ioctls for the RTC over a local socket,
+ * see ds3231_rtcdev.h.
+ *
+ *     ds3231_rtcd [-b bus] [-s socket]
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "ds3231_rtcdev.h"
+
+static volatile sig_atomic_t m_stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    m_stop = 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = DS3231_RTCDEV_PATH;
+    unsigned bus = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:s:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bus = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b bus] [-s socket]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    i2c_dev_t dev = { .port = bus, .ops = &hal_linux_ops };
+    if (ds3231_init_dev(&dev) != true) {
+        fprintf(stderr, "cannot open /dev/i2c-%u\n", bus);
+        return 1;
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    bool res = ds3231_rtcdev_serve(&dev, path, &m_stop);
+    if (res != true) {
+        fprintf(stderr, "cannot listen on %s\n", path);
+    }
+
+    ds3231_free(&dev);
+    return res ? 0 : 1;
+}
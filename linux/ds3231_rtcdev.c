@@ -0,0 +1,417 @@
+/*
+ * /dev/rtc compatible bridge for DS3231 on Linux
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "ds3231_rtcdev.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define NS_PER_SEC 1000000000LL
+#define NS_PER_MS  1000000LL
+
+/* Polling of the seconds register while update or alarm interrupts are on:
+ * slow until the first edge is seen, then sleep until just before the next one */
+#define EDGE_SEARCH_NS  (20 * NS_PER_MS)
+#define EDGE_GUARD_NS   (10 * NS_PER_MS)
+#define EDGE_POLL_NS    (2 * NS_PER_MS)
+
+/* Request number carried by interrupt data */
+#define RTCDEV_IRQ 0
+
+typedef struct {
+    uint32_t request;
+    int32_t result;
+    union {
+        struct rtc_time time;
+        struct rtc_wkalrm alarm;
+        unsigned long data;
+    } arg;
+} rtcdev_msg_t;
+
+typedef struct {
+    int fd;
+    bool uie;
+} rtcdev_client_t;
+
+typedef struct {
+    i2c_dev_t *dev;
+    rtcdev_client_t clients[DS3231_RTCDEV_MAX_CLIENTS];
+    struct rtc_wkalrm alarm;
+    bool aie;
+    int last_sec;
+    int64_t last_poll_ns;
+    int64_t edge_ns;
+} rtcdev_server_t;
+
+static int64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void tm_to_rtc(const struct tm *tm, struct rtc_time *rtc)
+{
+    memset(rtc, 0, sizeof(*rtc));
+    rtc->tm_sec = tm->tm_sec;
+    rtc->tm_min = tm->tm_min;
+    rtc->tm_hour = tm->tm_hour;
+    rtc->tm_mday = tm->tm_mday;
+    rtc->tm_mon = tm->tm_mon;
+    rtc->tm_year = tm->tm_year;
+    rtc->tm_wday = tm->tm_wday;
+    rtc->tm_yday = tm->tm_yday;
+    rtc->tm_isdst = 0;
+}
+
+static void rtc_to_tm(const struct rtc_time *rtc, struct tm *tm)
+{
+    memset(tm, 0, sizeof(*tm));
+    tm->tm_sec = rtc->tm_sec;
+    tm->tm_min = rtc->tm_min;
+    tm->tm_hour = rtc->tm_hour;
+    tm->tm_mday = rtc->tm_mday;
+    tm->tm_mon = rtc->tm_mon;
+    tm->tm_year = rtc->tm_year;
+}
+
+static void send_irq(const rtcdev_server_t *srv, unsigned long flags, bool uie_only)
+{
+    rtcdev_msg_t msg = { .request = RTCDEV_IRQ, .result = 0 };
+
+    msg.arg.data = (1UL << 8) | RTC_IRQF | flags;
+    for (int i = 0; i < DS3231_RTCDEV_MAX_CLIENTS; i++) {
+        const rtcdev_client_t *c = &srv->clients[i];
+        if (c->fd >= 0 && (!uie_only || c->uie)) {
+            send(c->fd, &msg, sizeof(msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+    }
+}
+
+static int handle_alarm(rtcdev_server_t *srv, const struct rtc_time *time, bool with_date)
+{
+    struct tm tm = {
+        .tm_sec = time->tm_sec, .tm_min = time->tm_min,
+        .tm_hour = time->tm_hour, .tm_mday = time->tm_mday
+    };
+
+    if (ds3231_set_alarm(srv->dev, DS3231_ALARM_1, &tm,
+            with_date ? DS3231_ALARM1_MATCH_SECMINHOURDATE : DS3231_ALARM1_MATCH_SECMINHOUR,
+            NULL, DS3231_ALARM2_EVERY_MIN) != true) {
+        return -EIO;
+    }
+    srv->alarm.time = *time;
+    return 0;
+}
+
+static int handle_aie(rtcdev_server_t *srv, bool on)
+{
+    bool res;
+
+    if (on) {
+        res = ds3231_clear_alarm_flags(srv->dev, DS3231_ALARM_1)
+            && ds3231_enable_alarm_ints(srv->dev, DS3231_ALARM_1);
+    } else {
+        res = ds3231_disable_alarm_ints(srv->dev, DS3231_ALARM_1);
+    }
+    if (res != true) {
+        return -EIO;
+    }
+    srv->aie = on;
+    srv->alarm.enabled = on;
+    return 0;
+}
+
+static int handle_request(rtcdev_server_t *srv, rtcdev_client_t *client, rtcdev_msg_t *msg)
+{
+    struct tm tm;
+
+    switch (msg->request) {
+    case RTC_RD_TIME:
+        if (ds3231_get_time(srv->dev, &tm) != true) {
+            return -EIO;
+        }
+        tm_to_rtc(&tm, &msg->arg.time);
+        return 0;
+    case RTC_SET_TIME:
+        rtc_to_tm(&msg->arg.time, &tm);
+        return ds3231_set_time(srv->dev, &tm) ? 0 : -EIO;
+    case RTC_ALM_READ:
+        msg->arg.time = srv->alarm.time;
+        return 0;
+    case RTC_ALM_SET:
+        return handle_alarm(srv, &msg->arg.time, false);
+    case RTC_WKALM_RD:
+        msg->arg.alarm = srv->alarm;
+        return 0;
+    case RTC_WKALM_SET: {
+        int res = handle_alarm(srv, &msg->arg.alarm.time, true);
+        return res ? res : handle_aie(srv, msg->arg.alarm.enabled);
+    }
+    case RTC_AIE_ON:
+    case RTC_AIE_OFF:
+        return handle_aie(srv, msg->request == RTC_AIE_ON);
+    case RTC_UIE_ON:
+    case RTC_UIE_OFF:
+        client->uie = msg->request == RTC_UIE_ON;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static bool ticking(const rtcdev_server_t *srv)
+{
+    if (srv->aie) {
+        return true;
+    }
+    for (int i = 0; i < DS3231_RTCDEV_MAX_CLIENTS; i++) {
+        if (srv->clients[i].fd >= 0 && srv->clients[i].uie) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int64_t next_poll(const rtcdev_server_t *srv, int64_t now)
+{
+    if (srv->edge_ns == 0 || now - srv->edge_ns > NS_PER_SEC + EDGE_SEARCH_NS) {
+        return srv->last_poll_ns + EDGE_SEARCH_NS;
+    }
+    if (now < srv->edge_ns + NS_PER_SEC - EDGE_GUARD_NS) {
+        return srv->edge_ns + NS_PER_SEC - EDGE_GUARD_NS;
+    }
+    return srv->last_poll_ns + EDGE_POLL_NS;
+}
+
+/* One poll of the seconds register, raises the interrupts on a new second */
+static void tick(rtcdev_server_t *srv)
+{
+    uint8_t sec;
+    int64_t now;
+
+    if (hal_i2c_read_reg(srv->dev, DS3231_ADDR_TIME, &sec, 1) != true) {
+        srv->last_sec = -1;
+        return;
+    }
+    now = mono_ns();
+
+    if (srv->last_sec >= 0 && sec != srv->last_sec) {
+        srv->edge_ns = srv->last_poll_ns + (now - srv->last_poll_ns) / 2;
+        send_irq(srv, RTC_UF, true);
+
+        ds3231_alarm_t alarms;
+        if (srv->aie && ds3231_get_alarm_flags(srv->dev, &alarms) && (alarms & DS3231_ALARM_1)) {
+            ds3231_clear_alarm_flags(srv->dev, DS3231_ALARM_1);
+            send_irq(srv, RTC_AF, false);
+        }
+    }
+    srv->last_sec = sec;
+    srv->last_poll_ns = now;
+}
+
+bool ds3231_rtcdev_serve(i2c_dev_t *dev, const char *path, volatile sig_atomic_t *stop)
+{
+    rtcdev_server_t srv = { .dev = dev, .last_sec = -1 };
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    for (int i = 0; i < DS3231_RTCDEV_MAX_CLIENTS; i++) {
+        srv.clients[i].fd = -1;
+    }
+
+    int lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        return false;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 4) != 0) {
+        close(lfd);
+        return false;
+    }
+
+    while (stop == NULL || !*stop) {
+        struct pollfd fds[DS3231_RTCDEV_MAX_CLIENTS + 1];
+        struct timespec timeout, *ptimeout = NULL;
+        int n = 0;
+
+        fds[n].fd = lfd;
+        fds[n++].events = POLLIN;
+        for (int i = 0; i < DS3231_RTCDEV_MAX_CLIENTS; i++) {
+            fds[n].fd = srv.clients[i].fd;
+            fds[n++].events = POLLIN;
+        }
+
+        if (ticking(&srv)) {
+            int64_t now = mono_ns();
+            int64_t wait = next_poll(&srv, now) - now;
+            if (wait <= 0) {
+                tick(&srv);
+                continue;
+            }
+            timeout.tv_sec = wait / NS_PER_SEC;
+            timeout.tv_nsec = wait % NS_PER_SEC;
+            ptimeout = &timeout;
+        } else {
+            srv.last_sec = -1;
+            srv.edge_ns = 0;
+        }
+
+        if (ppoll(fds, n, ptimeout, NULL) <= 0) {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            int i = 0;
+            while (i < DS3231_RTCDEV_MAX_CLIENTS && srv.clients[i].fd >= 0) {
+                i++;
+            }
+            if (fd >= 0 && i < DS3231_RTCDEV_MAX_CLIENTS) {
+                srv.clients[i].fd = fd;
+                srv.clients[i].uie = false;
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        for (int i = 0; i < DS3231_RTCDEV_MAX_CLIENTS; i++) {
+            rtcdev_client_t *c = &srv.clients[i];
+            rtcdev_msg_t msg;
+
+            if (c->fd < 0 || fds[i + 1].revents == 0) {
+                continue;
+            }
+            if (recv(c->fd, &msg, sizeof(msg), 0) != sizeof(msg)) {
+                close(c->fd);
+                c->fd = -1;
+                continue;
+            }
+            msg.result = handle_request(&srv, c, &msg);
+            send(c->fd, &msg, sizeof(msg), MSG_NOSIGNAL);
+        }
+    }
+
+    for (int i = 0; i < DS3231_RTCDEV_MAX_CLIENTS; i++) {
+        if (srv.clients[i].fd >= 0) {
+            close(srv.clients[i].fd);
+        }
+    }
+    close(lfd);
+    unlink(path);
+
+    return true;
+}
+
+bool ds3231_rtcdev_open(ds3231_rtcdev_t *rtc, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    rtc->pending = 0;
+    rtc->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (rtc->fd < 0) {
+        return false;
+    }
+
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(rtc->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(rtc->fd);
+        rtc->fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void ds3231_rtcdev_close(ds3231_rtcdev_t *rtc)
+{
+    if (rtc->fd >= 0) {
+        close(rtc->fd);
+        rtc->fd = -1;
+    }
+}
+
+/* Interrupts add up like on /dev/rtc: counts are summed, flags or-ed */
+static void rtcdev_accumulate(ds3231_rtcdev_t *rtc, unsigned long data)
+{
+    unsigned long count = (rtc->pending >> 8) + (data >> 8);
+
+    rtc->pending = (count << 8) | ((rtc->pending | data) & 0xff);
+}
+
+int ds3231_rtcdev_ioctl(ds3231_rtcdev_t *rtc, unsigned long request, void *arg)
+{
+    rtcdev_msg_t msg = { .request = request };
+    size_t size = 0;
+
+    switch (request) {
+    case RTC_RD_TIME:
+    case RTC_SET_TIME:
+    case RTC_ALM_READ:
+    case RTC_ALM_SET:
+        size = sizeof(struct rtc_time);
+        break;
+    case RTC_WKALM_RD:
+    case RTC_WKALM_SET:
+        size = sizeof(struct rtc_wkalrm);
+        break;
+    default:
+        break;
+    }
+    if (size) {
+        memcpy(&msg.arg, arg, size);
+    }
+
+    if (send(rtc->fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg)) {
+        return -errno;
+    }
+
+    for (;;) {
+        ssize_t len = recv(rtc->fd, &msg, sizeof(msg), 0);
+        if (len != sizeof(msg)) {
+            return len < 0 ? -errno : -EIO;
+        }
+        if (msg.request == RTCDEV_IRQ) {
+            rtcdev_accumulate(rtc, msg.arg.data);
+            continue;
+        }
+        break;
+    }
+
+    if (msg.result == 0 && size) {
+        memcpy(arg, &msg.arg, size);
+    }
+    return msg.result;
+}
+
+int ds3231_rtcdev_read(ds3231_rtcdev_t *rtc, unsigned long *data)
+{
+    rtcdev_msg_t msg;
+
+    while (rtc->pending == 0) {
+        ssize_t len = recv(rtc->fd, &msg, sizeof(msg), 0);
+        if (len != sizeof(msg)) {
+            return len < 0 ? -errno : -EIO;
+        }
+        if (msg.request == RTCDEV_IRQ) {
+            rtcdev_accumulate(rtc, msg.arg.data);
+        }
+    }
+
+    *data = rtc->pending;
+    rtc->pending = 0;
+    return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * /dev/rtc compatible bridge for DS3231 on Linux
+ *
+ * A server owns the RTC and answers RTC class ioctl requests
+ * (`RTC_RD_TIME`, `RTC_SET_TIME`, `RTC_ALM_*`, `RTC_WKALM_*`, `RTC_AIE_*`,
+ * `RTC_UIE_*`) sent over a local SOCK_SEQPACKET socket, using the structs
+ * of `<linux/rtc.h>`. Update and alarm interrupts are delivered like
+ * reads from /dev/rtc, so hwclock-style tools need only their open, ioctl
+ * and read calls replaced.
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_RTCDEV_H__
+#define __DS3231_RTCDEV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <linux/rtc.h>
+#include "../ds3231.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default socket path
+ */
+#define DS3231_RTCDEV_PATH "/run/ds3231-rtc.sock"
+
+/**
+ * Maximum number of connected clients
+ */
+#ifndef DS3231_RTCDEV_MAX_CLIENTS
+#define DS3231_RTCDEV_MAX_CLIENTS 8
+#endif
+
+/**
+ * Client connection
+ */
+typedef struct {
+    int fd;
+    unsigned long pending;  //!< Interrupt data received while waiting for an ioctl reply
+} ds3231_rtcdev_t;
+
+/**
+ * @brief Serve requests until `*stop` becomes true
+ * @param dev Device descriptor
+ * @param path Socket path, e.g. `DS3231_RTCDEV_PATH`
+ * @param stop Stop request, e.g. set from a signal handler, may be NULL
+ * @return false if the socket could not be created
+ */
+bool ds3231_rtcdev_serve(i2c_dev_t *dev, const char *path, volatile sig_atomic_t *stop);
+
+/**
+ * @brief Connect to a server
+ * @param[out] rtc Client connection
+ * @param path Socket path
+ * @return true to indicate success
+ */
+bool ds3231_rtcdev_open(ds3231_rtcdev_t *rtc, const char *path);
+
+/**
+ * @brief Close a connection
+ * @param rtc Client connection
+ */
+void ds3231_rtcdev_close(ds3231_rtcdev_t *rtc);
+
+/**
+ * @brief Issue an RTC class ioctl
+ *
+ * `arg` points to a `struct rtc_time` or `struct rtc_wkalrm` as the request requires.
+ *
+ * @param rtc Client connection
+ * @param request ioctl request, e.g. `RTC_RD_TIME`
+ * @param arg Argument
+ * @return 0 on success, a negative errno value on failure
+ */
+int ds3231_rtcdev_ioctl(ds3231_rtcdev_t *rtc, unsigned long request, void *arg);
+
+/**
+ * @brief Wait for an interrupt, like read() on /dev/rtc
+ *
+ * The low byte holds `RTC_IRQF` and `RTC_UF`/`RTC_AF`, the remaining bytes
+ * the number of interrupts since the last read.
+ *
+ * @param rtc Client connection
+ * @param[out] data Interrupt data
+ * @return 0 on success, a negative errno value on failure
+ */
+int ds3231_rtcdev_read(ds3231_rtcdev_t *rtc, unsigned long *data);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_RTCDEV_H__ */
@@ -0,0 +1,236 @@
+/*
+ * DS3231 time page daemon
+ *
+ * Owns the RTC and publishes samples into the shared memory time page,
+ * see ds3231_timepage.h.
+ *
+ * The RTC frequency error against CLOCK_MONOTONIC, which NTP disciplines,
+ * is learned into a temperature compensation table (ds3231_tempcomp.h),
+ * kept in the file given with -t. The RTC time between samples is
+ * corrected with the table, and the accumulated correction is published
+ * with the samples.
+ *
+ *     ds3231_timed [-b bus] [-n name] [-i interval] [-t table]
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "../ds3231.h"
+#include "../ds3231_discipline.h"
+#include "../ds3231_tempcomp.h"
+#include "ds3231_timepage.h"
+
+#define NS_PER_SEC 1000000000LL
+
+/* Polling period and guard time when looking for a second edge */
+#define EDGE_POLL_NS  (500 * 1000LL)
+#define EDGE_GUARD_NS (5 * 1000 * 1000LL)
+
+static volatile sig_atomic_t m_stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    m_stop = 1;
+}
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t mono_clock(void *arg)
+{
+    (void)arg;
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+static void sleep_until(int64_t mono_ns)
+{
+    struct timespec ts = { .tv_sec = mono_ns / NS_PER_SEC, .tv_nsec = mono_ns % NS_PER_SEC };
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* Poll the seconds register until it changes, the edge is timestamped
+ * halfway between the last read of the old value and the first of the new */
+static bool capture_edge(i2c_dev_t *dev, int64_t *mono_ns, int64_t *real_ns)
+{
+    uint8_t first, sec;
+    int64_t before, after;
+
+    if (hal_i2c_read_reg(dev, DS3231_ADDR_TIME, &first, 1) != true) {
+        return false;
+    }
+    before = clock_ns(CLOCK_MONOTONIC);
+
+    for (int64_t t = 0; t < 2 * NS_PER_SEC; t += EDGE_POLL_NS) {
+        sleep_until(before + EDGE_POLL_NS);
+        if (hal_i2c_read_reg(dev, DS3231_ADDR_TIME, &sec, 1) != true) {
+            return false;
+        }
+        after = clock_ns(CLOCK_MONOTONIC);
+        if (sec != first) {
+            *mono_ns = before + (after - before) / 2;
+            *real_ns = clock_ns(CLOCK_REALTIME) - (after - *mono_ns);
+            return true;
+        }
+        before = after;
+    }
+
+    return false;
+}
+
+/* A missing or corrupt table starts empty */
+static void load_table(const char *path, ds3231_tempcomp_t *tc)
+{
+    uint8_t blob[DS3231_TEMPCOMP_BLOB_SIZE];
+    FILE *f = fopen(path, "rb");
+
+    ds3231_tempcomp_init(tc);
+    if (f == NULL) {
+        return;
+    }
+    size_t size = fread(blob, 1, sizeof(blob), f);
+    fclose(f);
+    if (ds3231_tempcomp_load(tc, blob, size) != true) {
+        fprintf(stderr, "ignoring corrupt table %s\n", path);
+    }
+}
+
+/* Written to a temporary file and renamed, so a crash leaves the old table */
+static void save_table(const char *path, const ds3231_tempcomp_t *tc)
+{
+    uint8_t blob[DS3231_TEMPCOMP_BLOB_SIZE];
+    char tmp[256];
+    size_t size = ds3231_tempcomp_save(tc, blob, sizeof(blob));
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL) {
+        return;
+    }
+    bool ok = fwrite(blob, 1, size, f) == size;
+    if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "cannot save table %s\n", path);
+        unlink(tmp);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = DS3231_TIMEPAGE_NAME;
+    const char *table = NULL;
+    unsigned bus = 1;
+    unsigned interval = 16;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:i:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bus = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            table = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-b bus] [-n name] [-i interval] [-t table]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (interval == 0) {
+        interval = 1;
+    }
+
+    i2c_dev_t dev = { .port = bus, .ops = &hal_linux_ops };
+    if (ds3231_init_dev(&dev) != true) {
+        fprintf(stderr, "cannot open /dev/i2c-%u\n", bus);
+        return 1;
+    }
+
+    ds3231_tempcomp_t tc;
+    ds3231_discipline_t disc;
+
+    ds3231_tempcomp_init(&tc);
+    if (table) {
+        load_table(table, &tc);
+    }
+    if (ds3231_discipline_init(&disc, &dev, mono_clock, NULL) != true) {
+        fprintf(stderr, "cannot read DS3231 on /dev/i2c-%u\n", bus);
+        return 1;
+    }
+    disc.tempcomp = &tc;
+
+    ds3231_timepage_t *page = ds3231_timepage_create(name);
+    if (page == NULL) {
+        fprintf(stderr, "cannot create %s\n", name);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    int64_t next = 0;
+    int64_t last_sec = 0;
+    int64_t drift_ns = 0;
+    while (!m_stop) {
+        ds3231_timepage_sample_t sample = { 0 };
+        ds3231_snapshot_t snap;
+        int64_t real_ns;
+
+        if (next) {
+            sleep_until(next - EDGE_GUARD_NS);
+        }
+        if (capture_edge(&dev, &sample.mono_ns, &real_ns) != true
+                || ds3231_get_snapshot(&dev, &snap) != true) {
+            next = 0;
+            sleep(1);
+            continue;
+        }
+
+        sample.rtc_sec = ds3231_tm_to_epoch(&snap.time);
+        sample.offset_ns = sample.rtc_sec * NS_PER_SEC - real_ns;
+        sample.temp = snap.temp;
+        sample.flags = DS3231_TIMEPAGE_VALID
+            | ((snap.status & DS3231_STAT_OSCILLATOR) ? DS3231_TIMEPAGE_OSF : 0);
+
+        /* learn the RTC rate while it runs undisturbed, the time counted
+         * since the last sample is corrected at the current temperature */
+        bool learned = false;
+        if (snap.status & DS3231_STAT_OSCILLATOR) {
+            ds3231_discipline_reset(&disc);
+        } else {
+            ds3231_discipline_add_edge(&disc, sample.mono_ns);
+            if (ds3231_discipline_update(&disc, &learned) && learned && table) {
+                save_table(table, &tc);
+            }
+        }
+        if (last_sec && sample.rtc_sec > last_sec) {
+            uint64_t elapsed = (sample.rtc_sec - last_sec) * NS_PER_SEC;
+            drift_ns += (int64_t)(elapsed - ds3231_tempcomp_correct(&tc, snap.temp, elapsed));
+        }
+        last_sec = sample.rtc_sec;
+        sample.drift_ns = drift_ns;
+        ds3231_timepage_publish(page, &sample);
+
+        next = sample.mono_ns + interval * NS_PER_SEC;
+    }
+
+    ds3231_free(&dev);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Shared memory time page for DS3231 on Linux
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include "ds3231_timepage.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NS_PER_SEC 1000000000LL
+
+ds3231_timepage_t *ds3231_timepage_create(const char *name)
+{
+    ds3231_timepage_t *page;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(*page)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* invalidate whatever a previous owner left behind */
+    page->seq = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->sample.flags = 0;
+    page->sample.updates = 0;
+    page->version = DS3231_TIMEPAGE_VERSION;
+    page->magic = DS3231_TIMEPAGE_MAGIC;
+
+    return page;
+}
+
+const ds3231_timepage_t *ds3231_timepage_open(const char *name)
+{
+    const ds3231_timepage_t *page;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (page->magic != DS3231_TIMEPAGE_MAGIC || page->version != DS3231_TIMEPAGE_VERSION) {
+        munmap((void *)page, sizeof(*page));
+        return NULL;
+    }
+
+    return page;
+}
+
+void ds3231_timepage_close(const ds3231_timepage_t *page)
+{
+    munmap((void *)page, sizeof(*page));
+}
+
+void ds3231_timepage_publish(ds3231_timepage_t *page, const ds3231_timepage_sample_t *sample)
+{
+    uint32_t seq = page->seq;
+    uint32_t updates = page->sample.updates;
+
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    page->sample = *sample;
+    page->sample.updates = updates + 1;
+
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+bool ds3231_timepage_read(const ds3231_timepage_t *page, ds3231_timepage_sample_t *sample)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        *sample = page->sample;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+
+    return (sample->flags & DS3231_TIMEPAGE_VALID) != 0;
+}
+
+bool ds3231_timepage_now(const ds3231_timepage_t *page, struct timespec *ts)
+{
+    ds3231_timepage_sample_t sample;
+    struct timespec mono;
+
+    if (ds3231_timepage_read(page, &sample) != true) {
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t elapsed = (mono.tv_sec * NS_PER_SEC + mono.tv_nsec) - sample.mono_ns - sample.drift_ns;
+
+    ts->tv_sec = sample.rtc_sec + elapsed / NS_PER_SEC;
+    ts->tv_nsec = elapsed % NS_PER_SEC;
+    if (ts->tv_nsec < 0) {
+        ts->tv_nsec += NS_PER_SEC;
+        ts->tv_sec--;
+    }
+
+    return true;
+}
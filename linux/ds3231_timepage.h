@@ -0,0 +1,114 @@
+/**
+ * Shared memory time page for DS3231 on Linux
+ *
+ * A single owner polls the RTC and publishes time, offset and temperature
+ * into a POSIX shared memory page protected by a sequence lock. Readers map
+ * the page read-only and get lock-free reads without syscalls or bus traffic,
+ * the RTC time is extrapolated with CLOCK_MONOTONIC (served by the vDSO).
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+ */
+
+#ifndef __DS3231_TIMEPAGE_H__
+#define __DS3231_TIMEPAGE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default shared memory object name
+ */
+#define DS3231_TIMEPAGE_NAME "/ds3231-time"
+
+#define DS3231_TIMEPAGE_MAGIC   0x44533331
+#define DS3231_TIMEPAGE_VERSION 2
+
+/**
+ * Sample flags
+ */
+#define DS3231_TIMEPAGE_VALID 0x01  //!< Page holds at least one sample
+#define DS3231_TIMEPAGE_OSF   0x02  //!< Oscillator stop flag was set, time is not trustworthy
+
+/**
+ * Published sample
+ */
+typedef struct {
+    int64_t rtc_sec;    //!< RTC time at `mono_ns`, seconds since the Unix epoch
+    int64_t mono_ns;    //!< CLOCK_MONOTONIC of the RTC second edge
+    int64_t offset_ns;  //!< RTC time minus CLOCK_REALTIME at the edge
+    int64_t drift_ns;   //!< Temperature drift of the RTC learned by the owner, accumulated since it started
+    int16_t temp;       //!< Temperature in 0.25 degrees Celsius units
+    uint16_t flags;     //!< `DS3231_TIMEPAGE_*` flags
+    uint32_t updates;   //!< Number of samples published so far
+} ds3231_timepage_sample_t;
+
+/**
+ * Shared page layout
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    volatile uint32_t seq;  //!< Odd while the owner is writing
+    uint32_t reserved;
+    ds3231_timepage_sample_t sample;
+} ds3231_timepage_t;
+
+/**
+ * @brief Create (or take over) the page as its owner
+ * @param name Shared memory object name, e.g. `DS3231_TIMEPAGE_NAME`
+ * @return Mapped page, NULL on error
+ */
+ds3231_timepage_t *ds3231_timepage_create(const char *name);
+
+/**
+ * @brief Map an existing page read-only
+ * @param name Shared memory object name
+ * @return Mapped page, NULL on error or if the page has an unknown layout
+ */
+const ds3231_timepage_t *ds3231_timepage_open(const char *name);
+
+/**
+ * @brief Unmap a page
+ * @param page Mapped page
+ */
+void ds3231_timepage_close(const ds3231_timepage_t *page);
+
+/**
+ * @brief Publish a sample, owner only
+ * @param page Mapped page
+ * @param sample Sample, `updates` is filled in
+ */
+void ds3231_timepage_publish(ds3231_timepage_t *page, const ds3231_timepage_sample_t *sample);
+
+/**
+ * @brief Read a consistent copy of the last sample
+ * @param page Mapped page
+ * @param[out] sample Sample
+ * @return false if nothing was published yet
+ */
+bool ds3231_timepage_read(const ds3231_timepage_t *page, ds3231_timepage_sample_t *sample);
+
+/**
+ * @brief Get the current RTC time
+ *
+ * Extrapolates the last sample with CLOCK_MONOTONIC, less the learned
+ * temperature drift of the RTC.
+ *
+ * @param page Mapped page
+ * @param[out] ts RTC time
+ * @return false if nothing was published yet
+ */
+bool ds3231_timepage_now(const ds3231_timepage_t *page, struct timespec *ts);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif  /* __DS3231_TIMEPAGE_H__ */
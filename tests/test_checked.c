@@ -0,0 +1,141 @@
+/*
+ * Test of the checked time read against the simulated DS3231
+ *
+ * Writes good and corrupted contents into the simulated time registers
+ * and counts the reads `ds3231_get_time_checked` takes: one for a good
+ * time, every attempt for a corrupted one. A single bit error injected
+ * into a read is read again.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_checked.c ds3231.c hal/hal.c hal/hal_sim.c -o test_checked
+ *     ./test_checked
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include "../ds3231.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+
+static i2c_dev_t m_dev = { .port = TEST_PORT, .ops = &hal_sim_ops };
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    const char *name;
+    uint8_t regs[7];  /* seconds to year, day of week 1 is Sunday */
+    bool valid;
+} time_case_t;
+
+static const time_case_t m_cases[] = {
+    { "2024-02-29 12:34:56",   { 0x56, 0x34, 0x12, 0x05, 0x29, 0x02, 0x24 }, true },
+    { "2000-01-01 00:00:00",   { 0x00, 0x00, 0x00, 0x07, 0x01, 0x01, 0x00 }, true },
+    { "2100-12-31 23:59:59",   { 0x59, 0x59, 0x23, 0x06, 0x31, 0x92, 0x00 }, true },
+    { "12-hour 12 AM",         { 0x56, 0x34, 0x52, 0x05, 0x29, 0x02, 0x24 }, true },
+    { "12-hour 11 PM",         { 0x56, 0x34, 0x71, 0x05, 0x29, 0x02, 0x24 }, true },
+
+    { "seconds nibble",        { 0x5a, 0x34, 0x12, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "minutes nibble",        { 0x56, 0x3b, 0x12, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "hours nibble",          { 0x56, 0x34, 0x0c, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "day of week nibble",    { 0x56, 0x34, 0x12, 0x0d, 0x29, 0x02, 0x24 }, false },
+    { "date nibble",           { 0x56, 0x34, 0x12, 0x05, 0x1f, 0x02, 0x24 }, false },
+    { "month nibble",          { 0x56, 0x34, 0x12, 0x05, 0x29, 0x0a, 0x24 }, false },
+    { "year low nibble",       { 0x56, 0x34, 0x12, 0x05, 0x29, 0x02, 0x2e }, false },
+    { "year high nibble",      { 0x56, 0x34, 0x12, 0x05, 0x29, 0x02, 0xa4 }, false },
+    { "month 0",               { 0x56, 0x34, 0x12, 0x05, 0x29, 0x00, 0x24 }, false },
+    { "month 13",              { 0x56, 0x34, 0x12, 0x05, 0x29, 0x13, 0x24 }, false },
+    { "day 32",                { 0x56, 0x34, 0x12, 0x05, 0x32, 0x01, 0x24 }, false },
+    { "day 31 of April",       { 0x56, 0x34, 0x12, 0x05, 0x31, 0x04, 0x24 }, false },
+    { "2023-02-29",            { 0x56, 0x34, 0x12, 0x05, 0x29, 0x02, 0x23 }, false },
+    { "12-hour 0 AM",          { 0x56, 0x34, 0x40, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "12-hour 13 AM",         { 0x56, 0x34, 0x53, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "12-hour 13 PM",         { 0x56, 0x34, 0x73, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "24-hour 24",            { 0x56, 0x34, 0x24, 0x05, 0x29, 0x02, 0x24 }, false },
+    { "day of week 0",         { 0x56, 0x34, 0x12, 0x00, 0x29, 0x02, 0x24 }, false },
+    { "weekday off by one",    { 0x56, 0x34, 0x12, 0x04, 0x29, 0x02, 0x24 }, false },
+    { "Monday is day 1",       { 0x56, 0x34, 0x12, 0x05, 0x01, 0x03, 0x24 }, false },
+};
+
+static void poke_time(const uint8_t *regs)
+{
+    hal_sim_reset(TEST_PORT);
+    for (uint8_t i = 0; i < 7; i++) {
+        hal_sim_poke(TEST_PORT, DS3231_ADDR_TIME + i, regs[i]);
+    }
+    hal_sim_reset_bus_usage(TEST_PORT);
+}
+
+static uint32_t reads(void)
+{
+    uint32_t transactions;
+
+    hal_sim_get_bus_usage(TEST_PORT, NULL, &transactions);
+    return transactions;
+}
+
+static void test_table(void)
+{
+    for (size_t i = 0; i < sizeof(m_cases) / sizeof(m_cases[0]); i++) {
+        const time_case_t *c = &m_cases[i];
+        struct tm time;
+
+        poke_time(c->regs);
+        bool ok = ds3231_get_time_checked(&m_dev, &time);
+        uint32_t n = reads();
+
+        if (ok != c->valid || n != (c->valid ? 1 : DS3231_READ_ATTEMPTS)) {
+            printf("%s: %s after %u reads\n", c->name, ok ? "accepted" : "rejected", (unsigned)n);
+            m_failures++;
+        }
+    }
+}
+
+/* A read with a flipped bit is read again, and the retry returns the time */
+static void test_bitflip(void)
+{
+    const uint8_t *regs = m_cases[0].regs;
+    bool retried = false;
+
+    for (uint32_t seed = 1; seed < 1000 && !retried; seed++) {
+        hal_sim_faults_t faults = { .seed = seed, .bitflip_ppm = 100000 };
+        hal_sim_fault_stats_t stats;
+        struct tm time;
+
+        poke_time(regs);
+        hal_sim_set_faults(TEST_PORT, &faults);
+        bool ok = ds3231_get_time_checked(&m_dev, &time);
+        hal_sim_get_fault_stats(TEST_PORT, &stats);
+
+        /* the first read caught a flip, the second one was clean */
+        if (ok && reads() == 2 && stats.bitflips == 1) {
+            retried = true;
+            CHECK(time.tm_year == 124 && time.tm_mon == 1 && time.tm_mday == 29);
+            CHECK(time.tm_hour == 12 && time.tm_min == 34 && time.tm_sec == 56);
+        }
+    }
+    CHECK(retried);
+    hal_sim_set_faults(TEST_PORT, NULL);
+}
+
+int main(void)
+{
+    if (ds3231_init_dev(&m_dev) != true) {
+        printf("cannot set up the simulated device\n");
+        return 1;
+    }
+
+    test_table();
+    test_bitflip();
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * Test of the aging offset calibration against the simulated DS3231
+ *
+ * Injects a frequency error into the simulated oscillator and runs the
+ * discipline on second edges against the simulated reference for a few
+ * simulated hours. The aging register must settle with the sign that
+ * cancels the error, and leave less than half a step of it.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_discipline.c ds3231_discipline.c ds3231_tempcomp.c ds3231.c hal/hal.c hal/hal_sim.c -o test_discipline
+ *     ./test_discipline
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include "../ds3231_discipline.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+
+/* Time between captured edges, 16 of them span the default hour */
+#define CAPTURE_PERIOD_S 225
+
+/* Simulated time within which the discipline must converge */
+#define CONVERGE_HOURS 4
+
+static i2c_dev_t m_dev = { .port = TEST_PORT, .ops = &hal_sim_ops };
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+static uint64_t ref_clock(void *arg)
+{
+    (void)arg;
+    return hal_sim_now_ns(TEST_PORT);
+}
+
+/* Frequency error left after the aging register, ppm */
+static double residual_ppm(double drift_ppm)
+{
+    int8_t aging = (int8_t)hal_sim_peek(TEST_PORT, DS3231_ADDR_AGING);
+
+    return drift_ppm - aging * (DS3231_AGING_PPB_PER_LSB / 1000.0);
+}
+
+static void test_drift(double drift_ppm)
+{
+    ds3231_discipline_t d;
+    unsigned adjustments = 0;
+
+    hal_sim_reset(TEST_PORT);
+    hal_sim_set_drift(TEST_PORT, drift_ppm);
+    CHECK(ds3231_clear_oscillator_stop_flag(&m_dev));
+    CHECK(ds3231_discipline_init(&d, &m_dev, ref_clock, NULL));
+    CHECK(d.aging == 0);
+
+    while (hal_sim_now_ns(TEST_PORT) < CONVERGE_HOURS * 3600 * NS_PER_SEC) {
+        bool adjusted;
+
+        CHECK(ds3231_discipline_capture(&d, 100000));
+        CHECK(ds3231_discipline_update(&d, &adjusted));
+        adjustments += adjusted;
+        hal_sim_advance(TEST_PORT, CAPTURE_PERIOD_S * NS_PER_SEC);
+    }
+
+    int8_t aging = (int8_t)hal_sim_peek(TEST_PORT, DS3231_ADDR_AGING);
+    double residual = residual_ppm(drift_ppm);
+
+    printf("%+.2f ppm: aging %d after %u adjustments, %+.3f ppm left\n", drift_ppm, aging, adjustments, residual);
+    CHECK(aging == d.aging);
+    CHECK(drift_ppm > 0 ? aging > 0 : aging < 0);
+    CHECK(residual < DS3231_AGING_PPB_PER_LSB / 2000.0 + 0.01);
+    CHECK(residual > -DS3231_AGING_PPB_PER_LSB / 2000.0 - 0.01);
+    CHECK(adjustments >= 1 && adjustments <= 3);
+}
+
+int main(void)
+{
+    if (ds3231_init_dev(&m_dev) != true) {
+        printf("cannot set up the simulated device\n");
+        return 1;
+    }
+
+    test_drift(3.0);
+    test_drift(-1.37);
+    test_drift(0.26);
+    test_drift(-9.8);
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Test of the consensus time against three simulated DS3231s
+ *
+ * RTC 0 keeps time, RTC 1 runs 50 ppm fast and RTC 2 was set 2 s ahead.
+ * RTC 2 must be voted out and marked as diverged, RTC 1 flagged for its
+ * drift by a fit over hours while it stays in the consensus, and
+ * the fused time must follow RTC 0. When RTC 0 then loses its oscillator
+ * the two left disagree, and the fusion follows RTC 1 of the previous
+ * consensus.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_fusion.c ds3231_fusion.c ds3231_monotonic.c ds3231.c hal/hal.c hal/hal_sim.c -lm -o test_fusion
+ *     ./test_fusion
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include "../ds3231_fusion.h"
+#include "../hal/hal_sim.h"
+
+#define RTCS 3
+#define NS_PER_SEC 1000000000ULL
+
+/* 2024-10-16 00:00:00 */
+#define BASE_EPOCH 1729036800ULL
+
+/* Syncs about a minute apart, not locked to the RTC second */
+#define SYNC_PERIOD_NS (60 * NS_PER_SEC)
+
+/* Time the drift fit gets, its deviation shrinks to a few ppm while RTC 1
+ * gains less than a second, keeping it apart from RTC 2 */
+#define FIT_HOURS 4
+
+#define DRIFT_PPM 50.0
+
+static i2c_dev_t m_devs[RTCS] = {
+    { .port = 0, .ops = &hal_sim_ops },
+    { .port = 1, .ops = &hal_sim_ops },
+    { .port = 2, .ops = &hal_sim_ops },
+};
+static uint64_t m_start_ns;
+static uint64_t m_sync_local;
+static uint32_t m_rng = 12345;
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+static uint32_t rnd(uint32_t n)
+{
+    m_rng = m_rng * 1103515245 + 12345;
+    return (uint32_t)(((uint64_t)(m_rng >> 8) * n) >> 24);
+}
+
+/* Every simulated device has its own reference time, the reads move each
+ * by its bus time. Port 0 is the local clock, the others catch up to it. */
+static uint64_t local_clock(void *arg)
+{
+    (void)arg;
+    return hal_sim_now_ns(0);
+}
+
+static void advance(uint64_t ns)
+{
+    hal_sim_advance(0, ns);
+    for (uint8_t port = 1; port < RTCS; port++) {
+        hal_sim_advance(port, hal_sim_now_ns(0) - hal_sim_now_ns(port));
+    }
+}
+
+/* Time kept by RTC 0 at a local time */
+static uint64_t true_ns(uint64_t local)
+{
+    return BASE_EPOCH * NS_PER_SEC + local - m_start_ns;
+}
+
+static int64_t abs64(int64_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+static bool sync(ds3231_fusion_t *f)
+{
+    advance(SYNC_PERIOD_NS + rnd(NS_PER_SEC));
+    m_sync_local = local_clock(NULL);
+    return ds3231_fusion_sync(f);
+}
+
+/* Fused time of the last sync minus the time of RTC 0 */
+static int64_t fused_error(const ds3231_fusion_t *f)
+{
+    return (int64_t)(f->fused_ns - true_ns(m_sync_local));
+}
+
+/* Time RTC 1 gained on RTC 0 by the last sync */
+static int64_t gained_ns(void)
+{
+    return (int64_t)(DRIFT_PPM * 1e-6 * (m_sync_local - m_start_ns));
+}
+
+static void setup(void)
+{
+    struct tm time;
+
+    for (uint8_t i = 0; i < RTCS; i++) {
+        hal_sim_reset(i);
+        CHECK(ds3231_init_dev(&m_devs[i]));
+    }
+    hal_sim_set_drift(1, DRIFT_PPM);
+
+    ds3231_epoch_to_tm(BASE_EPOCH, &time);
+    CHECK(ds3231_set_time(&m_devs[0], &time) && ds3231_set_time(&m_devs[1], &time));
+    ds3231_epoch_to_tm(BASE_EPOCH + 2, &time);
+    CHECK(ds3231_set_time(&m_devs[2], &time));
+    for (uint8_t i = 0; i < RTCS; i++) {
+        CHECK(ds3231_clear_oscillator_stop_flag(&m_devs[i]));
+    }
+    advance(0);
+    m_start_ns = hal_sim_now_ns(0);
+}
+
+int main(void)
+{
+    ds3231_monotonic_t clock;
+    ds3231_fusion_t f;
+    i2c_dev_t *devs[RTCS] = { &m_devs[0], &m_devs[1], &m_devs[2] };
+
+    setup();
+    ds3231_monotonic_init(&clock, local_clock, NULL);
+    CHECK(ds3231_fusion_init(&f, &clock, devs, RTCS));
+
+    /* a majority of two, the RTC ahead is out, diverged after the strikes */
+    for (int i = 0; i < DS3231_FUSION_STRIKES; i++) {
+        CHECK(sync(&f));
+        CHECK(f.used == 0x03);
+        CHECK(f.rtc[0].flags == 0 && f.rtc[1].flags == 0);
+        CHECK(f.rtc[2].flags & DS3231_FUSION_OUTLIER);
+        CHECK(f.rtc[2].offset_ns > (int64_t)NS_PER_SEC && f.rtc[2].offset_ns < 3 * (int64_t)NS_PER_SEC);
+        CHECK(!!(f.rtc[2].flags & DS3231_FUSION_DIVERGED) == (i == DS3231_FUSION_STRIKES - 1));
+        CHECK(abs64(fused_error(&f)) <= (int64_t)f.uncertainty_ns);
+        CHECK(f.uncertainty_ns <= NS_PER_SEC / 2);
+    }
+
+    /* the drift shows in the fit long before RTC 1 leaves the consensus,
+     * which it pulls ahead by its gain at most */
+    while (local_clock(NULL) - m_start_ns < FIT_HOURS * 3600 * NS_PER_SEC) {
+        CHECK(sync(&f));
+        CHECK(f.used == 0x03);
+        CHECK(abs64(fused_error(&f)) <= (int64_t)f.uncertainty_ns + gained_ns());
+    }
+    printf("rates %+.2f %+.2f %+.2f ppm, drift of RTC 1 %+.2f +- %.2f ppm\n",
+            f.rtc[0].rate_ppm, f.rtc[1].rate_ppm, f.rtc[2].rate_ppm, f.rtc[1].drift_ppm, f.rtc[1].sigma_ppm);
+    CHECK(f.rtc[1].flags == DS3231_FUSION_DRIFT);
+    CHECK(f.rtc[1].drift_ppm > DRIFT_PPM - 3 * f.rtc[1].sigma_ppm);
+    CHECK(f.rtc[1].drift_ppm < DRIFT_PPM + 3 * f.rtc[1].sigma_ppm);
+    CHECK(f.rtc[0].flags == 0);
+    CHECK(f.rtc[2].flags == (DS3231_FUSION_OUTLIER | DS3231_FUSION_DIVERGED));
+
+    /* RTC 0 stops, no majority of RTC 1 and 2, RTC 1 is followed. The
+     * median rate of two is their mean, either may be flagged for drift. */
+    hal_sim_stop_oscillator(0, 10 * NS_PER_SEC);
+    CHECK(sync(&f));
+    CHECK(f.used == 0x02);
+    CHECK(f.rtc[0].flags == DS3231_FUSION_OSF);
+    CHECK((f.rtc[1].flags & ~DS3231_FUSION_DRIFT) == 0);
+    CHECK(f.rtc[2].flags & DS3231_FUSION_DIVERGED);
+
+    /* ahead by what RTC 1 gained, within its second */
+    CHECK(abs64(fused_error(&f) - gained_ns()) <= (int64_t)f.uncertainty_ns);
+
+    /* served from the steered clock, no read */
+    hal_sim_reset_bus_usage(0);
+    CHECK(ds3231_fusion_now(&f) != 0);
+    uint32_t xfers;
+    hal_sim_get_bus_usage(0, NULL, &xfers);
+    CHECK(xfers == 0);
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Test of the mux channel cache against the simulated DS3231s
+ *
+ * A device on the port itself and two behind channels of the simulated
+ * mux all answer at `DS3231_ADDR`, so every read returns the aging
+ * register of the device it reached. Runs on port 0 with a cache and on
+ * port 1 without, which HAL_MUX_PORTS set to 1 leaves out.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops -DHAL_MUX_PORTS=1 tests/test_mux.c ds3231.c hal/hal.c hal/hal_sim.c -o test_mux
+ *     ./test_mux
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include "../ds3231.h"
+#include "../hal/hal_sim.h"
+
+#if HAL_MUX_PORTS + 3 > HAL_SIM_MAX_PORTS
+#error "build with -DHAL_MUX_PORTS=1"
+#endif
+
+#define MARK_DIRECT 0x40
+#define MARK_CH0    0x41
+#define MARK_CH1    0x42
+
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+static uint8_t mark(i2c_dev_t *dev)
+{
+    uint8_t val = 0;
+
+    CHECK(hal_i2c_read_reg(dev, DS3231_ADDR_AGING, &val, 1));
+    return val;
+}
+
+/* Channel C of port P reaches port P + 1 + C */
+static void setup_marks(uint8_t port)
+{
+    for (uint8_t i = 0; i < 3; i++) {
+        hal_sim_reset(port + i);
+        hal_sim_poke(port + i, DS3231_ADDR_AGING, MARK_DIRECT + i);
+    }
+}
+
+static void test_port(uint8_t port)
+{
+    i2c_dev_t direct = { .port = port, .ops = &hal_sim_ops };
+    i2c_dev_t ch0 = { .port = port, .mux_addr = HAL_SIM_MUX_ADDR, .mux_channel = 0, .ops = &hal_sim_ops };
+    i2c_dev_t ch1 = { .port = port, .mux_addr = HAL_SIM_MUX_ADDR, .mux_channel = 1, .ops = &hal_sim_ops };
+    hal_sim_faults_t nack = { .nack_ppm = 1000000 };
+    hal_sim_faults_t none = { 0 };
+    uint8_t val;
+
+    setup_marks(port);
+    CHECK(ds3231_init_dev(&direct) && ds3231_init_dev(&ch0) && ds3231_init_dev(&ch1));
+
+    /* a device without a mux after a muxed one is not answered by the channel */
+    for (int i = 0; i < 3; i++) {
+        CHECK(mark(&ch0) == MARK_CH0);
+        CHECK(mark(&direct) == MARK_DIRECT);
+        CHECK(mark(&ch1) == MARK_CH1);
+        CHECK(mark(&ch1) == MARK_CH1);
+        CHECK(mark(&direct) == MARK_DIRECT);
+    }
+
+    /* a failed transaction on a channel leaves its mux to be disabled */
+    CHECK(mark(&ch0) == MARK_CH0);
+    hal_sim_set_faults(port + 1, &nack);
+    CHECK(hal_i2c_read_reg(&ch0, DS3231_ADDR_AGING, &val, 1) == false);
+    hal_sim_set_faults(port + 1, &none);
+    CHECK(mark(&direct) == MARK_DIRECT);
+    CHECK(mark(&ch0) == MARK_CH0);
+
+    /* and so does an invalidated cache */
+    CHECK(mark(&ch1) == MARK_CH1);
+    hal_i2c_mux_invalidate(port);
+    CHECK(mark(&direct) == MARK_DIRECT);
+    CHECK(mark(&ch0) == MARK_CH0);
+}
+
+/* Consecutive transactions on a channel select it once, the mux write
+ * being the only one on the root port */
+static void test_cached(void)
+{
+    i2c_dev_t direct = { .port = 0, .ops = &hal_sim_ops };
+    i2c_dev_t ch1 = { .port = 0, .mux_addr = HAL_SIM_MUX_ADDR, .mux_channel = 1, .ops = &hal_sim_ops };
+    i2c_dev_t *devs[] = { &direct, &ch1 };
+    uint32_t xfers;
+
+    setup_marks(0);
+    CHECK(ds3231_init_dev(&direct) && ds3231_init_dev(&ch1));
+    CHECK(mark(&direct) == MARK_DIRECT);
+    hal_sim_reset_bus_usage(0);
+    CHECK(mark(&ch1) == MARK_CH1);
+    CHECK(mark(&ch1) == MARK_CH1);
+    hal_sim_get_bus_usage(0, NULL, &xfers);
+    CHECK(xfers == 1);
+
+    /* the selected channel goes first, the direct device disables it after */
+    hal_i2c_mux_order(devs, 2);
+    CHECK(devs[0] == &ch1 && devs[1] == &direct);
+}
+
+int main(void)
+{
+    test_port(0);
+    test_port(HAL_MUX_PORTS);
+    test_cached();
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
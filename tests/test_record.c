@@ -0,0 +1,186 @@
+/*
+ * Test of the record and replay backends against the simulated DS3231
+ *
+ * A session of driver calls is recorded from the simulated device, with
+ * timestamps from the simulated time, and replayed against a clock that
+ * only the replay delays and the stand-in for the driver's own work move.
+ * The replay must return the recorded data, keep the recorded pace, and
+ * count the transactions that differ from the recording or go past it.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_record.c ds3231.c hal/hal.c hal/hal_sim.c hal/hal_record.c hal/hal_clock.c -o test_record
+ *     ./test_record
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "../ds3231.h"
+#include "../hal/hal_clock.h"
+#include "../hal/hal_record.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+#define SESSION_POLLS 5
+
+/* Time the driver takes between calls on replay, shorter than any recorded gap */
+#define WORK_US 150
+
+static uint8_t m_buf[4096];
+static size_t m_len;
+static uint32_t m_replay_us;
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+static uint32_t sim_clock(void)
+{
+    return (uint32_t)(hal_sim_now_ns(TEST_PORT) / 1000);
+}
+
+static uint32_t replay_clock(void)
+{
+    return m_replay_us;
+}
+
+static bool sink(void *arg, const void *data, size_t size)
+{
+    (void)arg;
+    if (sizeof(m_buf) - m_len < size) {
+        return false;
+    }
+    memcpy(m_buf + m_len, data, size);
+    m_len += size;
+    return true;
+}
+
+static void delay(void *arg, uint32_t us)
+{
+    (void)arg;
+    m_replay_us += us;
+}
+
+/* The same calls on record and on replay, `work` moves the replay clock */
+static bool session(i2c_dev_t *dev, struct tm *times, int8_t *age, bool work)
+{
+    struct tm time = { .tm_sec = 58, .tm_min = 59, .tm_hour = 23, .tm_mday = 28, .tm_mon = 1, .tm_year = 124 };
+    bool ok = ds3231_set_time(dev, &time);
+
+    for (int i = 0; i < SESSION_POLLS; i++) {
+        if (work) {
+            m_replay_us += WORK_US;
+        } else {
+            hal_sim_advance(TEST_PORT, NS_PER_SEC + i * NS_PER_SEC / 7);
+        }
+        ok = ds3231_get_time(dev, &times[i]) && ok;
+    }
+    return ds3231_set_aging_offset(dev, -5) && ds3231_get_aging_offset(dev, age) && ok;
+}
+
+/* Start of the first entry to the end of the last one */
+static uint32_t recorded_span(void)
+{
+    hal_record_entry_t first;
+    hal_record_entry_t last;
+    size_t pos = sizeof(hal_record_header_t);
+
+    memcpy(&first, m_buf + pos, sizeof(first));
+    while (pos < m_len) {
+        memcpy(&last, m_buf + pos, sizeof(last));
+        pos += sizeof(last) + last.len;
+    }
+    return last.timestamp_us + last.duration_us - first.timestamp_us;
+}
+
+static void test_round_trip(void)
+{
+    hal_record_t rec;
+    hal_replay_t rp;
+    i2c_dev_t dev = { .port = TEST_PORT, .ops = &hal_record_ops, .ctx = &rec };
+    struct tm recorded[SESSION_POLLS];
+    struct tm replayed[SESSION_POLLS];
+    int8_t age = 0;
+
+    hal_clock_set_source(sim_clock);
+    CHECK(hal_record_start(&rec, &hal_sim_ops, NULL, sink, NULL));
+    CHECK(ds3231_init_dev(&dev));
+    CHECK(session(&dev, recorded, &age, false));
+    CHECK(rec.error == false);
+    CHECK(age == -5);
+    CHECK(recorded[SESSION_POLLS - 1].tm_mon == 1 && recorded[SESSION_POLLS - 1].tm_mday == 29);
+
+    hal_clock_set_source(replay_clock);
+    m_replay_us = 0;
+    age = 0;
+    dev = (i2c_dev_t){ .port = TEST_PORT, .ops = &hal_replay_ops, .ctx = &rp };
+    CHECK(hal_replay_open(&rp, m_buf, m_len, delay, NULL));
+    CHECK(ds3231_init_dev(&dev));
+    CHECK(session(&dev, replayed, &age, true));
+    CHECK(hal_replay_done(&rp));
+    CHECK(rp.transactions == rec.entries);
+    CHECK(rp.mismatches == 0 && rp.overruns == 0);
+    CHECK(memcmp(recorded, replayed, sizeof(recorded)) == 0);
+    CHECK(age == -5);
+
+    /* the driver's work is taken out of the gaps, not added to them */
+    printf("recorded %u us, replayed in %u us\n", (unsigned)recorded_span(), (unsigned)m_replay_us);
+    CHECK(m_replay_us == recorded_span());
+
+    /* one more transaction than recorded */
+    CHECK(ds3231_get_aging_offset(&dev, &age) == false);
+    CHECK(rp.overruns == 1 && rp.transactions == rec.entries);
+}
+
+static void test_mismatch(void)
+{
+    hal_replay_t rp;
+    i2c_dev_t dev = { .port = TEST_PORT, .ops = &hal_replay_ops, .ctx = &rp };
+    struct tm time = { .tm_sec = 59, .tm_min = 59, .tm_hour = 23, .tm_mday = 28, .tm_mon = 1, .tm_year = 124 };
+    struct tm read;
+
+    hal_clock_set_source(NULL);
+    CHECK(hal_replay_open(&rp, m_buf, m_len, NULL, NULL));
+    CHECK(ds3231_init_dev(&dev));
+
+    /* a different payload, then a read where a read was recorded */
+    CHECK(ds3231_set_time(&dev, &time) == false);
+    CHECK(rp.mismatches == 1 && rp.transactions == 0);
+    CHECK(ds3231_get_time(&dev, &read));
+    CHECK(rp.mismatches == 1 && rp.transactions == 1);
+
+    /* a write where a read was recorded */
+    CHECK(ds3231_set_aging_offset(&dev, 0) == false);
+    CHECK(rp.mismatches == 2 && rp.overruns == 0);
+
+    /* a recording cut short */
+    CHECK(hal_replay_open(&rp, m_buf, m_len / 2, NULL, NULL));
+    for (int i = 0; i < 100 && rp.overruns == 0; i++) {
+        ds3231_get_time(&dev, &read);
+    }
+    CHECK(rp.overruns == 1);
+    CHECK(ds3231_get_time(&dev, &read) == false);
+    CHECK(rp.overruns == 2);
+
+    m_buf[0] ^= 1;
+    CHECK(hal_replay_open(&rp, m_buf, m_len, NULL, NULL) == false);
+    m_buf[0] ^= 1;
+}
+
+int main(void)
+{
+    hal_sim_reset(TEST_PORT);
+
+    test_round_trip();
+    test_mismatch();
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * Test of the /dev/rtc bridge against the simulated DS3231
+ *
+ * Serves the simulated device from a thread and drives it through the
+ * client calls over a socket, no hardware needed.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_rtcdev.c linux/ds3231_rtcdev.c ds3231.c hal/hal.c hal/hal_sim.c -lpthread -o test_rtcdev
+ *     ./test_rtcdev
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../linux/ds3231_rtcdev.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t m_stop;
+static char m_path[64];
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+/* The server thread and the test share the simulated device, every access
+ * goes through the lock */
+static bool locked_init(const i2c_dev_t *dev)
+{
+    pthread_mutex_lock(&m_lock);
+    bool res = hal_sim_ops.init(dev);
+    pthread_mutex_unlock(&m_lock);
+    return res;
+}
+
+static bool locked_free(const i2c_dev_t *dev)
+{
+    pthread_mutex_lock(&m_lock);
+    bool res = hal_sim_ops.free(dev);
+    pthread_mutex_unlock(&m_lock);
+    return res;
+}
+
+static bool locked_write_reg(const i2c_dev_t *dev, uint8_t reg, const void *out_data, size_t out_size, uint8_t *retries)
+{
+    pthread_mutex_lock(&m_lock);
+    bool res = hal_sim_ops.write_reg(dev, reg, out_data, out_size, retries);
+    pthread_mutex_unlock(&m_lock);
+    return res;
+}
+
+static bool locked_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size, uint8_t *retries)
+{
+    pthread_mutex_lock(&m_lock);
+    bool res = hal_sim_ops.read_reg(dev, reg, in_data, in_size, retries);
+    pthread_mutex_unlock(&m_lock);
+    return res;
+}
+
+static const hal_ops_t m_locked_ops = {
+    .name      = "locked sim",
+    .init      = locked_init,
+    .free      = locked_free,
+    .write_reg = locked_write_reg,
+    .read_reg  = locked_read_reg,
+};
+
+static void advance(uint64_t ns)
+{
+    pthread_mutex_lock(&m_lock);
+    hal_sim_advance(TEST_PORT, ns);
+    pthread_mutex_unlock(&m_lock);
+}
+
+static uint8_t peek(uint8_t reg)
+{
+    pthread_mutex_lock(&m_lock);
+    uint8_t val = hal_sim_peek(TEST_PORT, reg);
+    pthread_mutex_unlock(&m_lock);
+    return val;
+}
+
+static void *serve(void *arg)
+{
+    ds3231_rtcdev_serve(arg, m_path, &m_stop);
+    return NULL;
+}
+
+static bool connect_retry(ds3231_rtcdev_t *rtc)
+{
+    for (int i = 0; i < 100; i++) {
+        if (ds3231_rtcdev_open(rtc, m_path)) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+static void test_read_time(ds3231_rtcdev_t *rtc)
+{
+    struct rtc_time set = {
+        .tm_sec = 58, .tm_min = 59, .tm_hour = 23,
+        .tm_mday = 31, .tm_mon = 11, .tm_year = 124
+    };
+    struct rtc_time get;
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_SET_TIME, &set) == 0);
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_RD_TIME, &get) == 0);
+    CHECK(get.tm_year == 124 && get.tm_mon == 11 && get.tm_mday == 31);
+    CHECK(get.tm_hour == 23 && get.tm_min == 59 && get.tm_sec == 58);
+    CHECK(get.tm_wday == 2 && get.tm_yday == 365);
+
+    /* carries into the next year on the simulated oscillator */
+    advance(3 * NS_PER_SEC);
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_RD_TIME, &get) == 0);
+    CHECK(get.tm_year == 125 && get.tm_mon == 0 && get.tm_mday == 1);
+    CHECK(get.tm_hour == 0 && get.tm_min == 0 && get.tm_sec == 1);
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_IRQP_READ, &get) == -ENOTTY);
+}
+
+static void test_alarm(ds3231_rtcdev_t *rtc)
+{
+    struct rtc_time now = {
+        .tm_sec = 0, .tm_min = 30, .tm_hour = 12,
+        .tm_mday = 16, .tm_mon = 9, .tm_year = 124
+    };
+    struct rtc_time alarm = { .tm_sec = 2, .tm_min = 30, .tm_hour = 12 };
+    struct rtc_time get;
+    unsigned long data;
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_SET_TIME, &now) == 0);
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_ALM_SET, &alarm) == 0);
+
+    /* ALARM1 matching seconds, minutes and hours */
+    CHECK(peek(DS3231_ADDR_ALARM1) == 0x02);
+    CHECK(peek(DS3231_ADDR_ALARM1 + 1) == 0x30);
+    CHECK(peek(DS3231_ADDR_ALARM1 + 2) == 0x12);
+    CHECK(peek(DS3231_ADDR_ALARM1 + 3) & 0x80);
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_ALM_READ, &get) == 0);
+    CHECK(get.tm_hour == 12 && get.tm_min == 30 && get.tm_sec == 2);
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_AIE_ON, NULL) == 0);
+    CHECK(peek(DS3231_ADDR_CONTROL) & DS3231_ALARM_1);
+
+    /* let the server see the current second, then pass the alarm */
+    usleep(100000);
+    advance(2 * NS_PER_SEC);
+    CHECK(ds3231_rtcdev_read(rtc, &data) == 0);
+    CHECK((data & 0xff) == (RTC_IRQF | RTC_AF));
+    CHECK(data >> 8 >= 1);
+    CHECK(!(peek(DS3231_ADDR_STATUS) & DS3231_STAT_ALARM_1));
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_AIE_OFF, NULL) == 0);
+    CHECK(!(peek(DS3231_ADDR_CONTROL) & DS3231_ALARM_1));
+}
+
+static void test_update_irq(ds3231_rtcdev_t *rtc, ds3231_rtcdev_t *other)
+{
+    unsigned long data;
+
+    CHECK(ds3231_rtcdev_open(other, m_path));
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_UIE_ON, NULL) == 0);
+    usleep(100000);
+    for (int i = 0; i < 3; i++) {
+        advance(NS_PER_SEC);
+        CHECK(ds3231_rtcdev_read(rtc, &data) == 0);
+        CHECK((data & 0xff) == (RTC_IRQF | RTC_UF));
+        CHECK(data >> 8 >= 1);
+    }
+
+    /* update interrupts go to the clients that asked for them only */
+    struct rtc_time get;
+    CHECK(ds3231_rtcdev_ioctl(other, RTC_RD_TIME, &get) == 0);
+    CHECK(other->pending == 0);
+
+    CHECK(ds3231_rtcdev_ioctl(rtc, RTC_UIE_OFF, NULL) == 0);
+}
+
+int main(void)
+{
+    i2c_dev_t dev = { .port = TEST_PORT, .ops = &m_locked_ops };
+    ds3231_rtcdev_t rtc, other;
+    pthread_t thread;
+
+    snprintf(m_path, sizeof(m_path), "/tmp/ds3231-rtc-test.%d", (int)getpid());
+    hal_sim_reset(TEST_PORT);
+    if (ds3231_init_dev(&dev) != true
+            || pthread_create(&thread, NULL, serve, &dev) != 0) {
+        printf("cannot start the server\n");
+        return 1;
+    }
+    if (connect_retry(&rtc) != true) {
+        printf("cannot connect to %s\n", m_path);
+        return 1;
+    }
+
+    test_read_time(&rtc);
+    test_alarm(&rtc);
+    test_update_irq(&rtc, &other);
+
+    /* a closed connection wakes the server up to see the stop request */
+    m_stop = 1;
+    ds3231_rtcdev_close(&other);
+    pthread_join(thread, NULL);
+    ds3231_rtcdev_close(&rtc);
+    ds3231_free(&dev);
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
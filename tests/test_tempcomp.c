@@ -0,0 +1,161 @@
+/*
+ * Test of the temperature compensation table against the simulated DS3231
+ *
+ * The simulated oscillator gets a frequency error that follows the
+ * temperature. The discipline measures it against the simulated reference
+ * and learns it into the table. The table is then saved, checked for
+ * corruption and loaded back, and looked up and applied.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_tempcomp.c ds3231_tempcomp.c ds3231_discipline.c ds3231.c hal/hal.c hal/hal_sim.c -o test_tempcomp
+ *     ./test_tempcomp
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "../ds3231_discipline.h"
+#include "../ds3231_tempcomp.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+
+/* Largest difference between a learned bin and the simulated error, ppb */
+#define LEARN_TOLERANCE_PPB 20
+
+static i2c_dev_t m_dev = { .port = TEST_PORT, .ops = &hal_sim_ops };
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+static const int8_t m_temps[] = { -10, 5, 20, 35, 50 };
+
+/* Parabolic residual of a TCXO, ppb at a temperature in degrees Celsius */
+static int32_t model_ppb(int32_t temp)
+{
+    return -3 * (temp - 25) * (temp - 25) + 150;
+}
+
+static uint64_t ref_clock(void *arg)
+{
+    (void)arg;
+    return hal_sim_now_ns(TEST_PORT);
+}
+
+static int32_t abs32(int32_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+/* Let the discipline measure the error at one temperature until it learns it */
+static void learn_at(ds3231_discipline_t *d, int8_t temp)
+{
+    bool learned = false;
+
+    hal_sim_set_temp(TEST_PORT, temp * 4);
+    hal_sim_set_drift(TEST_PORT, model_ppb(temp) / 1000.0);
+    /* the next conversion picks the temperature up */
+    hal_sim_advance(TEST_PORT, 65 * NS_PER_SEC);
+    ds3231_discipline_reset(d);
+
+    for (int i = 0; i < 40 && !learned; i++) {
+        CHECK(ds3231_discipline_capture(d, 100000));
+        CHECK(ds3231_discipline_update(d, &learned));
+        hal_sim_advance(TEST_PORT, 225 * NS_PER_SEC);
+    }
+    CHECK(learned);
+    CHECK(d->temp == temp * 4);
+}
+
+static void test_learn(ds3231_tempcomp_t *tc)
+{
+    ds3231_discipline_t d;
+
+    CHECK(ds3231_discipline_init(&d, &m_dev, ref_clock, NULL));
+    d.tempcomp = tc;
+
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < sizeof(m_temps); i++) {
+            learn_at(&d, m_temps[i]);
+        }
+    }
+
+    /* learned instead of written to the aging register */
+    CHECK(hal_sim_peek(TEST_PORT, DS3231_ADDR_AGING) == 0);
+
+    for (size_t i = 0; i < sizeof(m_temps); i++) {
+        int32_t ppb = ds3231_tempcomp_lookup(tc, m_temps[i] * 4);
+        CHECK(abs32(ppb - model_ppb(m_temps[i])) <= LEARN_TOLERANCE_PPB);
+    }
+
+    /* linear between the learned bins, flat beyond them */
+    int32_t mid = (ds3231_tempcomp_lookup(tc, 20 * 4) + ds3231_tempcomp_lookup(tc, 35 * 4)) / 2;
+    CHECK(abs32(ds3231_tempcomp_lookup(tc, 110) - mid) <= 1);
+    CHECK(ds3231_tempcomp_lookup(tc, -30 * 4) == ds3231_tempcomp_lookup(tc, -10 * 4));
+    CHECK(ds3231_tempcomp_lookup(tc, 70 * 4) == ds3231_tempcomp_lookup(tc, 50 * 4));
+}
+
+static void test_blob(const ds3231_tempcomp_t *tc)
+{
+    uint8_t blob[DS3231_TEMPCOMP_BLOB_SIZE];
+    ds3231_tempcomp_t copy;
+
+    CHECK(ds3231_tempcomp_save(tc, blob, sizeof(blob) - 1) == 0);
+    CHECK(ds3231_tempcomp_save(tc, blob, sizeof(blob)) == DS3231_TEMPCOMP_BLOB_SIZE);
+
+    ds3231_tempcomp_init(&copy);
+    CHECK(ds3231_tempcomp_load(&copy, blob, sizeof(blob)));
+    CHECK(memcmp(&copy, tc, sizeof(copy)) == 0);
+    for (int16_t raw = -50 * 4; raw <= 90 * 4; raw++) {
+        CHECK(ds3231_tempcomp_lookup(&copy, raw) == ds3231_tempcomp_lookup(tc, raw));
+    }
+
+    /* every single bit error is caught by the CRC or the header checks */
+    for (size_t i = 0; i < sizeof(blob); i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            blob[i] ^= 1 << bit;
+            CHECK(ds3231_tempcomp_load(&copy, blob, sizeof(blob)) == false);
+            blob[i] ^= 1 << bit;
+        }
+    }
+    CHECK(ds3231_tempcomp_load(&copy, blob, sizeof(blob) - 1) == false);
+    CHECK(memcmp(&copy, tc, sizeof(copy)) == 0);
+}
+
+static void test_correct(const ds3231_tempcomp_t *tc)
+{
+    int32_t ppb = ds3231_tempcomp_lookup(tc, 50 * 4);
+    uint64_t elapsed = 1000 * NS_PER_SEC;
+
+    /* a slow RTC counts less than the true interval */
+    CHECK(ppb < 0);
+    CHECK(ds3231_tempcomp_correct(tc, 50 * 4, elapsed) == elapsed - (int64_t)ppb * 1000);
+    CHECK(ds3231_tempcomp_correct(tc, 50 * 4, NS_PER_SEC / 2) == NS_PER_SEC / 2 - ppb / 2);
+}
+
+int main(void)
+{
+    ds3231_tempcomp_t tc;
+
+    hal_sim_reset(TEST_PORT);
+    if (ds3231_init_dev(&m_dev) != true || ds3231_clear_oscillator_stop_flag(&m_dev) != true) {
+        printf("cannot set up the simulated device\n");
+        return 1;
+    }
+    ds3231_tempcomp_init(&tc);
+
+    test_learn(&tc);
+    test_blob(&tc);
+    test_correct(&tc);
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Round trip test of the time calls on the simulated DS3231
+ *
+ * Sets and reads back times over the whole range 2000 to 2199 through
+ * `ds3231_set_time`, `ds3231_get_time`, `ds3231_get_epoch` and
+ * `ds3231_fast_get_time`, then lets the simulated oscillator carry over
+ * the century and the 2100 leap day.
+ *
+ * By default every day is checked at its first and last second and at two
+ * seconds that move from day to day, and every second of the days around
+ * the century and the 2100 leap day. `all` checks every second of the
+ * range, which takes tens of minutes. The expected times come from the
+ * host `gmtime_r` and `timegm`, which also check the driver's own epoch
+ * conversions, so the host needs a 64-bit `time_t`.
+ *
+ *     cc -O2 -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_time.c ds3231.c hal/hal.c hal/hal_sim.c -o test_time
+ *     ./test_time [all]
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#define _DEFAULT_SOURCE  /* timegm */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../ds3231.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+#define SEC_PER_DAY 86400
+
+/* Days since the Unix epoch */
+#define DAY_2000_01_01 10957
+#define DAY_2099_12_31 47481
+#define DAY_2100_01_01 47482
+#define DAY_2100_02_28 47540
+#define DAY_2100_03_01 47541
+#define DAY_2199_12_31 84005
+
+/* the host conversions must reach 2199 */
+typedef char time_t_64_bit[sizeof(time_t) >= 8 ? 1 : -1];
+
+static i2c_dev_t m_dev = { .port = TEST_PORT, .ops = &hal_sim_ops };
+static ds3231_fast_t m_fast;
+static unsigned long m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            if (m_failures++ < 20) { \
+                printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            } \
+        } \
+    } while (0)
+
+static bool same_time(const struct tm *a, const struct tm *b)
+{
+    return a->tm_sec == b->tm_sec && a->tm_min == b->tm_min && a->tm_hour == b->tm_hour
+        && a->tm_mday == b->tm_mday && a->tm_mon == b->tm_mon && a->tm_year == b->tm_year
+        && a->tm_wday == b->tm_wday && a->tm_yday == b->tm_yday;
+}
+
+/* Broken-down UTC from the host, checked against the driver's conversions */
+static void host_tm(time_t epoch, struct tm *time)
+{
+    struct tm own, copy;
+
+    CHECK(gmtime_r(&epoch, time) != NULL);
+    ds3231_epoch_to_tm(epoch, &own);
+    CHECK(same_time(&own, time));
+    copy = *time;
+    CHECK(ds3231_tm_to_epoch(time) == epoch && timegm(&copy) == epoch);
+}
+
+static void check_read(time_t epoch)
+{
+    struct tm want, time;
+    time_t got;
+
+    host_tm(epoch, &want);
+
+    CHECK(ds3231_get_time(&m_dev, &time) && same_time(&time, &want));
+    CHECK(ds3231_get_epoch(&m_dev, &got) && got == epoch);
+    CHECK(ds3231_fast_get_time(&m_fast, &time) && same_time(&time, &want));
+}
+
+static void round_trip(time_t epoch)
+{
+    struct tm time;
+
+    host_tm(epoch, &time);
+    time.tm_wday = -1;  /* derived from the date */
+    CHECK(ds3231_set_time(&m_dev, &time));
+    check_read(epoch);
+}
+
+static void round_trip_days(int32_t first, int32_t last, bool every_second)
+{
+    for (int32_t day = first; day <= last; day++) {
+        time_t base = (time_t)day * SEC_PER_DAY;
+
+        if (every_second) {
+            for (int32_t s = 0; s < SEC_PER_DAY; s++) {
+                round_trip(base + s);
+            }
+        } else {
+            round_trip(base);
+            round_trip(base + SEC_PER_DAY - 1);
+            round_trip(base + (day * 7919) % SEC_PER_DAY);
+            round_trip(base + (day * 104729 + SEC_PER_DAY / 2) % SEC_PER_DAY);
+        }
+    }
+}
+
+static void test_out_of_range(void)
+{
+    struct tm time;
+
+    host_tm((time_t)DAY_2000_01_01 * SEC_PER_DAY - 1, &time);
+    CHECK(ds3231_set_time(&m_dev, &time) == false);
+    host_tm((time_t)(DAY_2199_12_31 + 1) * SEC_PER_DAY, &time);
+    CHECK(ds3231_set_time(&m_dev, &time) == false);
+}
+
+/* The oscillator carries 2099-12-31 into 2100 with the century flag */
+static void test_century_carry(void)
+{
+    time_t epoch = (time_t)DAY_2100_01_01 * SEC_PER_DAY;
+
+    round_trip(epoch - 1);
+    hal_sim_advance(TEST_PORT, NS_PER_SEC);
+    CHECK(hal_sim_peek(TEST_PORT, 5) == (DS3231_CENTURY_FLAG | 0x01));
+    CHECK(hal_sim_peek(TEST_PORT, 6) == 0x00);
+    check_read(epoch);
+}
+
+/* The chip counts 2100-02-29, it reads as 2100-03-01 without a write to
+ * the RTC, and stays a day behind unless corrected during that day */
+static void test_leap_2100(void)
+{
+    time_t march1 = (time_t)DAY_2100_03_01 * SEC_PER_DAY;
+    ds3231_snapshot_t snap;
+    struct tm time, want;
+    uint32_t xfers;
+
+    round_trip(march1 - 1);
+    hal_sim_advance(TEST_PORT, NS_PER_SEC);
+    CHECK(hal_sim_peek(TEST_PORT, 4) == 0x29 && hal_sim_peek(TEST_PORT, 5) == (DS3231_CENTURY_FLAG | 0x02));
+
+    hal_sim_reset_bus_usage(TEST_PORT);
+    check_read(march1);
+    host_tm(march1, &want);
+    CHECK(ds3231_get_snapshot(&m_dev, &snap) && same_time(&snap.time, &want));
+    CHECK(ds3231_get_time_checked(&m_dev, &time) && same_time(&time, &want));
+    hal_sim_get_bus_usage(TEST_PORT, NULL, &xfers);
+    CHECK(xfers == 5);
+    CHECK(hal_sim_peek(TEST_PORT, 4) == 0x29);
+
+    /* uncorrected, the next day reads as 2100-03-01 again */
+    hal_sim_advance(TEST_PORT, SEC_PER_DAY * NS_PER_SEC);
+    CHECK(ds3231_get_time(&m_dev, &time) && time.tm_mon == 2 && time.tm_mday == 1);
+
+    /* corrected during the leap day, the seconds keep running */
+    round_trip(march1 - 1);
+    hal_sim_advance(TEST_PORT, 3 * NS_PER_SEC);
+    CHECK(ds3231_fix_leap_2100(&m_dev));
+    CHECK(hal_sim_peek(TEST_PORT, 4) == 0x01 && hal_sim_peek(TEST_PORT, 5) == (DS3231_CENTURY_FLAG | 0x03));
+    check_read(march1 + 2);
+    hal_sim_advance(TEST_PORT, SEC_PER_DAY * NS_PER_SEC);
+    check_read(march1 + SEC_PER_DAY + 2);
+
+    /* nothing to correct on other days */
+    hal_sim_reset_bus_usage(TEST_PORT);
+    CHECK(ds3231_fix_leap_2100(&m_dev));
+    hal_sim_get_bus_usage(TEST_PORT, NULL, &xfers);
+    CHECK(xfers == 1);
+}
+
+int main(int argc, char **argv)
+{
+    bool all = argc > 1 && strcmp(argv[1], "all") == 0;
+
+    hal_sim_reset(TEST_PORT);
+    if (ds3231_init_dev(&m_dev) != true || ds3231_fast_init(&m_fast, &m_dev) != true) {
+        printf("cannot set up the simulated device\n");
+        return 1;
+    }
+
+    round_trip_days(DAY_2000_01_01, DAY_2199_12_31, all);
+    if (!all) {
+        round_trip_days(DAY_2000_01_01, DAY_2000_01_01, true);
+        round_trip_days(DAY_2099_12_31, DAY_2100_01_01, true);
+        round_trip_days(DAY_2100_02_28, DAY_2100_03_01, true);
+        round_trip_days(DAY_2199_12_31, DAY_2199_12_31, true);
+    }
+    test_out_of_range();
+    test_century_carry();
+    test_leap_2100();
+
+    ds3231_free(&m_dev);
+
+    if (m_failures) {
+        printf("FAILED, %lu checks\n", m_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Test of the 32kHz timebase against the simulated DS3231
+ *
+ * The simulated 32kHz output runs off the drifting oscillator like the
+ * seconds, and host latency spikes between the counter samples and the
+ * reads stand in for interrupts and scheduling. The timebase must never
+ * run ahead of the RTC, and repeated syncs must narrow its lag to about
+ * the bus time of a poll, on a drifting clock as well. A prepared alarm
+ * flag clearing write must not turn the output off under it.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_timebase.c ds3231_timebase.c ds3231.c hal/hal.c hal/hal_sim.c -o test_timebase
+ *     ./test_timebase
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include "../ds3231_timebase.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+#define EDGE_NS (NS_PER_SEC / DS3231_TIMEBASE_HZ + 1)
+
+/* A one byte read at 100 kHz, 4 bytes and 3 conditions, is 13 edges long */
+#define POLL_EDGES 13
+
+static i2c_dev_t m_dev = { .port = TEST_PORT, .clk_speed = HAL_I2C_SPEED_STANDARD, .ops = &hal_sim_ops };
+static ds3231_timebase_t m_tb;
+static uint32_t m_rng = 12345;
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+static uint32_t rnd(uint32_t n)
+{
+    m_rng = m_rng * 1103515245 + 12345;
+    return (uint32_t)(((uint64_t)(m_rng >> 8) * n) >> 24);
+}
+
+static uint8_t rtc_sec(void)
+{
+    uint8_t sec = hal_sim_peek(TEST_PORT, DS3231_ADDR_TIME);
+
+    return (sec >> 4) * 10 + (sec & 0x0f);
+}
+
+static uint8_t tb_sec(void)
+{
+    time_t sec;
+
+    CHECK(ds3231_timebase_now(&m_tb, &sec, NULL));
+    return sec % 60;
+}
+
+static bool sync(void)
+{
+    for (int i = 0; i < 5; i++) {
+        if (ds3231_timebase_sync(&m_tb, 100000)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Edges the timebase turns over to the next second after the RTC,
+ * failing if it turns over first */
+static int lag(void)
+{
+    uint8_t start = rtc_sec();
+    int edges = 0;
+
+    while (rtc_sec() == start) {
+        CHECK(tb_sec() == start);
+        hal_sim_advance(TEST_PORT, EDGE_NS);
+    }
+    while (tb_sec() != rtc_sec() && edges < DS3231_TIMEBASE_HZ) {
+        hal_sim_advance(TEST_PORT, EDGE_NS);
+        edges++;
+    }
+    return edges;
+}
+
+static void test_single_sync(void)
+{
+    CHECK(sync());
+    int l = lag();
+    CHECK(l <= (int)m_tb.window + 1);
+    printf("one sync: lag %d edges, window %u\n", l, (unsigned)m_tb.window);
+}
+
+static void test_refined(void)
+{
+    for (int i = 0; i < 40; i++) {
+        hal_sim_advance(TEST_PORT, rnd(NS_PER_SEC));
+        CHECK(sync());
+    }
+    int l = lag();
+    CHECK(m_tb.window <= POLL_EDGES + 2);
+    CHECK(l <= (int)m_tb.window + 1);
+    printf("40 syncs: lag %d edges, window %u\n", l, (unsigned)m_tb.window);
+}
+
+/* The count and the seconds share the oscillator, hours of drift do not
+ * move them apart */
+static void test_drift(void)
+{
+    for (int h = 0; h < 6; h++) {
+        hal_sim_advance(TEST_PORT, 3600 * NS_PER_SEC + rnd(NS_PER_SEC));
+        CHECK(lag() <= (int)m_tb.window + 1);
+    }
+    CHECK(sync());
+    CHECK(lag() <= (int)m_tb.window + 1);
+}
+
+/* A time set moves the seconds off the count boundary, a sync starts over */
+static void test_time_set(void)
+{
+    struct tm time = { .tm_sec = 10, .tm_min = 0, .tm_hour = 12, .tm_mday = 1, .tm_mon = 5, .tm_year = 125 };
+
+    hal_sim_advance(TEST_PORT, NS_PER_SEC / 3);
+    CHECK(ds3231_set_time(&m_dev, &time));
+    CHECK(sync());
+    int l = lag();
+    CHECK(l <= (int)m_tb.window + 1);
+}
+
+static bool output_on(void)
+{
+    return hal_sim_peek(TEST_PORT, DS3231_ADDR_STATUS) & DS3231_STAT_32KHZ;
+}
+
+/* A clearing write prepared with the output off turns it off again, the
+ * count stops and the next sync refuses. Enabled through the prepared
+ * transfers, the output stays on. */
+static void test_fast_clear(void)
+{
+    ds3231_fast_t f;
+
+    CHECK(ds3231_disable_32khz(&m_dev) && ds3231_fast_init(&f, &m_dev));
+    CHECK(ds3231_enable_32khz(&m_dev) && output_on());
+    CHECK(ds3231_fast_clear_alarm_flags(&f) && !output_on());
+    CHECK(sync() == false && !m_tb.valid);
+
+    CHECK(ds3231_fast_set_32khz(&f, true) && output_on());
+    CHECK(ds3231_fast_clear_alarm_flags(&f) && output_on());
+    CHECK(sync());
+    CHECK(lag() <= (int)m_tb.window + 1);
+}
+
+int main(void)
+{
+    struct tm time = { .tm_sec = 0, .tm_min = 0, .tm_hour = 0, .tm_mday = 16, .tm_mon = 9, .tm_year = 124 };
+    hal_sim_faults_t faults = { .spike_ppm = 300000, .spike_ns = 150000 };
+
+    hal_sim_reset(TEST_PORT);
+    hal_sim_set_drift(TEST_PORT, 50.0);
+    if (ds3231_init_dev(&m_dev) != true || ds3231_set_time(&m_dev, &time) != true
+            || ds3231_clear_oscillator_stop_flag(&m_dev) != true
+            || ds3231_timebase_init(&m_tb, &m_dev, TEST_PORT, 0) != true) {
+        printf("cannot set up the simulated device\n");
+        return 1;
+    }
+    hal_sim_set_faults(TEST_PORT, &faults);
+
+    test_single_sync();
+    test_refined();
+    test_drift();
+    test_time_set();
+    test_fast_clear();
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * Test of the wake scheduler against the simulated DS3231
+ *
+ * Plans wake-ups for short and long sleeps, batches of deadlines and a
+ * sleep past the alarm range, then lets the simulated RTC reach the armed
+ * alarm. INT/SQW is not simulated, it is taken as asserted while INTCN is
+ * set and an alarm flag is set with its interrupt enabled.
+ *
+ *     cc -I. -DHAL_DEFAULT_OPS=hal_sim_ops tests/test_wake.c ds3231_wake.c ds3231.c hal/hal.c hal/hal_sim.c -o test_wake
+ *     ./test_wake
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include "../ds3231_wake.h"
+#include "../hal/hal_sim.h"
+
+#define TEST_PORT 0
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_MS  1000000ULL
+
+/* 2024-10-16 00:00:00 */
+#define BASE_EPOCH 1729036800ULL
+
+/* An nRF52 style host, waking from System OFF on INT/SQW */
+static const ds3231_wake_config_t m_config = {
+    .timer_sleep_na = 3000,
+    .alarm_sleep_na = 400,
+    .active_na = 3000000,
+    .timer_wake_ns = 20000,
+    .alarm_wake_ns = 5 * NS_PER_MS,
+    .alarm_program_ns = 1 * NS_PER_MS,
+    .timer_max_ns = 512 * NS_PER_SEC,
+};
+
+static i2c_dev_t m_dev = { .port = TEST_PORT, .ops = &hal_sim_ops };
+static uint64_t m_start_ns;
+static int m_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            m_failures++; \
+        } \
+    } while (0)
+
+/* The simulated RTC started counting at `BASE_EPOCH` when its time was set */
+static uint64_t now(void)
+{
+    return BASE_EPOCH * NS_PER_SEC + hal_sim_now_ns(TEST_PORT) - m_start_ns;
+}
+
+static void setup(ds3231_wake_t *w)
+{
+    struct tm time;
+
+    hal_sim_reset(TEST_PORT);
+    ds3231_epoch_to_tm(BASE_EPOCH, &time);
+    CHECK(ds3231_set_time(&m_dev, &time));
+    CHECK(ds3231_clear_oscillator_stop_flag(&m_dev));
+    m_start_ns = hal_sim_now_ns(TEST_PORT);
+    ds3231_wake_init(w, &m_dev, &m_config);
+}
+
+static bool alarm1_int_enabled(void)
+{
+    return hal_sim_peek(TEST_PORT, DS3231_ADDR_CONTROL) & DS3231_CTRL_ALARM1_INT;
+}
+
+static bool alarm1_flag(void)
+{
+    return hal_sim_peek(TEST_PORT, DS3231_ADDR_STATUS) & DS3231_STAT_ALARM_1;
+}
+
+static bool int_asserted(void)
+{
+    uint8_t ctrl = hal_sim_peek(TEST_PORT, DS3231_ADDR_CONTROL);
+    uint8_t stat = hal_sim_peek(TEST_PORT, DS3231_ADDR_STATUS);
+
+    return (ctrl & DS3231_CTRL_ALARM_INTS) && (ctrl & stat & DS3231_ALARM_BOTH);
+}
+
+static int alarm1_field(uint8_t i, uint8_t mask)
+{
+    uint8_t val = hal_sim_peek(TEST_PORT, DS3231_ADDR_ALARM1 + i) & mask;
+
+    return (val >> 4) * 10 + (val & 0x0f);
+}
+
+/* Epoch second ALARM1 is set to, the first date it matches from the base */
+static uint64_t alarm1_epoch(void)
+{
+    int mday = alarm1_field(3, 0x3f);
+    uint64_t sec = BASE_EPOCH + alarm1_field(2, 0x3f) * 3600 + alarm1_field(1, 0x7f) * 60 + alarm1_field(0, 0x7f);
+
+    for (int d = 0; d < 32; d++) {
+        struct tm day;
+
+        ds3231_epoch_to_tm((time_t)(sec + d * 86400ULL), &day);
+        if (day.tm_mday == mday) {
+            return sec + d * 86400ULL;
+        }
+    }
+    return 0;
+}
+
+static void test_choice(void)
+{
+    ds3231_wake_t w;
+    ds3231_wake_plan_t plan;
+    uint64_t t;
+
+    /* a short sleep stays on the timer, woken up by its latency early */
+    setup(&w);
+    t = now();
+    CHECK(ds3231_wake_add(&w, t + 50 * NS_PER_MS, 0, 1));
+    CHECK(ds3231_wake_plan(&w, t, &plan));
+    CHECK(plan.source == DS3231_WAKE_TIMER && plan.count == 1);
+    CHECK(plan.wake_ns == t + 50 * NS_PER_MS);
+    CHECK(plan.fire_ns == plan.wake_ns - m_config.timer_wake_ns);
+    CHECK(!alarm1_int_enabled());
+
+    /* an hour goes to the RTC, on the last edge leaving the wake latency */
+    setup(&w);
+    t = now();
+    CHECK(ds3231_wake_add(&w, t + 3600 * NS_PER_SEC, 0, 1));
+    CHECK(ds3231_wake_plan(&w, t, &plan));
+    CHECK(plan.source == DS3231_WAKE_ALARM && plan.count == 1);
+    CHECK(plan.fire_ns % NS_PER_SEC == 0);
+    CHECK(plan.fire_ns + m_config.alarm_wake_ns <= plan.wake_ns);
+    CHECK(plan.fire_ns + m_config.alarm_wake_ns + NS_PER_SEC > plan.wake_ns);
+    CHECK(alarm1_epoch() * NS_PER_SEC == plan.fire_ns);
+    CHECK(alarm1_int_enabled() && !alarm1_flag());
+    CHECK(w.alarm_wakes == 1 && w.timer_wakes == 0);
+}
+
+static void test_batch(void)
+{
+    ds3231_wake_t w;
+    ds3231_wake_plan_t plan;
+    uint32_t ids[4];
+    uint64_t t;
+
+    /* the most urgent deadline sets the wake-up, those due by then share it */
+    setup(&w);
+    t = now();
+    CHECK(ds3231_wake_add(&w, t + 3600 * NS_PER_SEC, 600 * NS_PER_SEC, 1));
+    CHECK(ds3231_wake_add(&w, t + 7200 * NS_PER_SEC, 0, 3));
+    CHECK(ds3231_wake_add(&w, t + 3900 * NS_PER_SEC, 0, 2));
+    CHECK(ds3231_wake_plan(&w, t, &plan));
+    CHECK(plan.source == DS3231_WAKE_ALARM);
+    CHECK(plan.wake_ns == t + 3900 * NS_PER_SEC);
+    CHECK(plan.count == 2);
+
+    CHECK(ds3231_wake_due(&w, plan.wake_ns, ids, 4) == 2);
+    CHECK(ids[0] == 1 && ids[1] == 2);
+    CHECK(w.count == 1 && w.entries[0].id == 3);
+}
+
+/* ALARM1 matches the date, a sleep of two months wakes up after 27 days */
+static void test_clamp(void)
+{
+    ds3231_wake_t w;
+    ds3231_wake_plan_t plan;
+    uint64_t t;
+
+    setup(&w);
+    t = now();
+    CHECK(ds3231_wake_add(&w, t + 60 * 86400 * NS_PER_SEC, 0, 1));
+    CHECK(ds3231_wake_plan(&w, t, &plan));
+    CHECK(plan.source == DS3231_WAKE_ALARM && plan.count == 1);
+    CHECK(plan.fire_ns / NS_PER_SEC == t / NS_PER_SEC + DS3231_WAKE_ALARM_MAX_S);
+    CHECK(alarm1_epoch() * NS_PER_SEC == plan.fire_ns);
+}
+
+/* The alarm fires, the wake-up clears its flag and releases INT/SQW, and
+ * the rest of the sleep goes to the timer */
+static void test_fire(void)
+{
+    ds3231_wake_t w;
+    ds3231_wake_plan_t plan;
+    uint32_t id;
+
+    setup(&w);
+    CHECK(ds3231_wake_add(&w, now() + 600 * NS_PER_SEC + 300 * NS_PER_MS, 0, 7));
+    CHECK(ds3231_wake_plan(&w, now(), &plan));
+    CHECK(plan.source == DS3231_WAKE_ALARM);
+    CHECK(!int_asserted());
+
+    hal_sim_advance(TEST_PORT, plan.fire_ns - now() - NS_PER_MS);
+    CHECK(!alarm1_flag() && !int_asserted());
+    hal_sim_advance(TEST_PORT, 2 * NS_PER_MS);
+    CHECK(alarm1_flag() && int_asserted());
+
+    /* woken up by the latency later, early for the deadline */
+    hal_sim_advance(TEST_PORT, m_config.alarm_wake_ns);
+    CHECK(ds3231_wake_due(&w, now(), &id, 1) == 0);
+    CHECK(!alarm1_flag() && !int_asserted());
+    CHECK(!w.alarm_armed && w.flag_clear);
+
+    CHECK(ds3231_wake_plan(&w, now(), &plan));
+    CHECK(plan.source == DS3231_WAKE_TIMER && plan.count == 1);
+    hal_sim_advance(TEST_PORT, plan.wake_ns - now());
+    CHECK(ds3231_wake_due(&w, now(), &id, 1) == 1 && id == 7);
+    CHECK(!int_asserted());
+}
+
+/* A timer plan after an alarm plan disarms the alarm, which then never
+ * asserts INT/SQW */
+static void test_disarm(void)
+{
+    ds3231_wake_t w;
+    ds3231_wake_plan_t plan;
+    uint64_t t;
+
+    setup(&w);
+    t = now();
+    CHECK(ds3231_wake_add(&w, t + 3600 * NS_PER_SEC, 0, 1));
+    CHECK(ds3231_wake_plan(&w, t, &plan));
+    CHECK(plan.source == DS3231_WAKE_ALARM && alarm1_int_enabled());
+    uint64_t fire_ns = plan.fire_ns;
+
+    CHECK(ds3231_wake_add(&w, t + 100 * NS_PER_MS, 0, 2));
+    CHECK(ds3231_wake_plan(&w, now(), &plan));
+    CHECK(plan.source == DS3231_WAKE_TIMER && plan.count == 1);
+    CHECK(!alarm1_int_enabled() && !w.alarm_armed && !w.ints_enabled);
+
+    hal_sim_advance(TEST_PORT, fire_ns + NS_PER_SEC - now());
+    CHECK(alarm1_flag() && !int_asserted());
+
+    /* the flag it left is cleared before the alarm is armed again */
+    uint32_t ids[2];
+    CHECK(ds3231_wake_due(&w, now(), ids, 2) == 2);
+    CHECK(alarm1_flag() && w.flag_clear == false);
+    CHECK(ds3231_wake_add(&w, now() + 3600 * NS_PER_SEC, 0, 3));
+    CHECK(ds3231_wake_plan(&w, now(), &plan));
+    CHECK(plan.source == DS3231_WAKE_ALARM);
+    CHECK(alarm1_int_enabled() && !alarm1_flag() && !int_asserted());
+}
+
+int main(void)
+{
+    if (ds3231_init_dev(&m_dev) != true) {
+        printf("cannot set up the simulated device\n");
+        return 1;
+    }
+
+    test_choice();
+    test_batch();
+    test_clamp();
+    test_fire();
+    test_disarm();
+
+    printf("%s\n", m_failures ? "FAILED" : "OK");
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * Benchmark of the DS3231 driver entry points on the simulated bus
+ *
+ * Runs every public `ds3231_*` call of ds3231.h and ds3231_tz.h against
+ * hal/hal_sim.c for each bus configuration and reports per call the bus
+ * time from the timing model, the host CPU time and the number of I2C
+ * transactions. The time zone calls use a table of CET/CEST-like rules
+ * built at startup, 400 transitions like a generated European zone.
+ *
+ * Left out are `ds3231_init`, which only fills the descriptor before
+ * `ds3231_init_dev`, `ds3231_alarm_cache_init`, `ds3231_tz_lookup` and
+ * `ds3231_tz_abbr`, which `ds3231_tz_localtime` covers, and the modules
+ * built on the driver, whose bus cost is that of the calls they make.
+ *
+ *     cc -O2 -I. -DHAL_DEFAULT_OPS=hal_sim_ops tools/ds3231_bench.c ds3231.c ds3231_tz.c hal/hal.c hal/hal_sim.c -o ds3231_bench
+ *     ./ds3231_bench [iterations]
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../ds3231.h"
+#include "../ds3231_tz.h"
+#include "../hal/hal_sim.h"
+
+#define BENCH_PORT 0
+#define BENCH_DEFAULT_ITERATIONS 10000
+
+/* Transitions of the time zone table, two a year */
+#define BENCH_TZ_FIRST_YEAR 2000
+#define BENCH_TZ_YEARS      200
+
+typedef struct {
+    const char *name;
+    bool (*run)(i2c_dev_t *dev);
+} bench_t;
+
+typedef struct {
+    const char *name;
+    uint32_t freq_hz;
+    uint32_t stretch_ns;
+} bench_bus_t;
+
+static struct tm m_time = {
+    .tm_sec = 30, .tm_min = 15, .tm_hour = 12, .tm_wday = 3,
+    .tm_mday = 16, .tm_mon = 9, .tm_year = 124
+};
+
+/* Per-device state of the cached and prepared calls, reset before each bench */
+static ds3231_alarm_cache_t m_cache;
+static ds3231_fast_t m_fast;
+static unsigned m_toggle;
+
+static int64_t m_tz_times[2 * BENCH_TZ_YEARS];
+static uint8_t m_tz_indices[2 * BENCH_TZ_YEARS];
+static const ds3231_tz_type_t m_tz_types[] = {
+    { .utoff = 3600, .isdst = 0, .abbr = 0 },
+    { .utoff = 7200, .isdst = 1, .abbr = 4 },
+};
+static const ds3231_tz_t m_tz = {
+    .name    = "bench/CET",
+    .count   = 2 * BENCH_TZ_YEARS,
+    .times   = m_tz_times,
+    .indices = m_tz_indices,
+    .types   = m_tz_types,
+    .abbrs   = "CET\0CEST\0",
+};
+
+/* Last Sunday of a month at 01:00 UTC */
+static time_t last_sunday(int year, int mon)
+{
+    struct tm time = { .tm_hour = 1, .tm_mday = 31, .tm_mon = mon, .tm_year = year - 1900 };
+    time_t t = ds3231_tm_to_epoch(&time);
+
+    ds3231_epoch_to_tm(t, &time);
+    return t - time.tm_wday * 86400;
+}
+
+static void bench_tz_init(void)
+{
+    for (int i = 0; i < BENCH_TZ_YEARS; i++) {
+        m_tz_times[2 * i] = last_sunday(BENCH_TZ_FIRST_YEAR + i, 2);
+        m_tz_indices[2 * i] = 1;
+        m_tz_times[2 * i + 1] = last_sunday(BENCH_TZ_FIRST_YEAR + i, 9);
+        m_tz_indices[2 * i + 1] = 0;
+    }
+}
+
+static bool run_init(i2c_dev_t *dev)
+{
+    return ds3231_init_dev(dev);
+}
+
+static bool run_free(i2c_dev_t *dev)
+{
+    return ds3231_free(dev);
+}
+
+static bool run_set_time(i2c_dev_t *dev)
+{
+    return ds3231_set_time(dev, &m_time);
+}
+
+static bool run_get_time(i2c_dev_t *dev)
+{
+    struct tm time;
+    return ds3231_get_time(dev, &time);
+}
+
+static bool run_get_epoch(i2c_dev_t *dev)
+{
+    time_t epoch;
+    return ds3231_get_epoch(dev, &epoch);
+}
+
+/* Conversions without bus traffic, a different day each call */
+static bool run_tm_to_epoch(i2c_dev_t *dev)
+{
+    struct tm time = m_time;
+
+    (void)dev;
+    time.tm_mday = 1 + m_toggle++ % 28;
+    return ds3231_tm_to_epoch(&time) > 0;
+}
+
+static bool run_epoch_to_tm(i2c_dev_t *dev)
+{
+    struct tm time;
+
+    (void)dev;
+    ds3231_epoch_to_tm(946684800 + (time_t)(m_toggle++ % 73000) * 86400, &time);
+    return time.tm_year >= 100;
+}
+
+static bool run_fix_leap_2100(i2c_dev_t *dev)
+{
+    return ds3231_fix_leap_2100(dev);
+}
+
+static bool run_get_time_checked(i2c_dev_t *dev)
+{
+    struct tm time;
+    return ds3231_get_time_checked(dev, &time);
+}
+
+static bool run_get_snapshot(i2c_dev_t *dev)
+{
+    ds3231_snapshot_t snap;
+    return ds3231_get_snapshot(dev, &snap);
+}
+
+static bool run_fast_get_time(i2c_dev_t *dev)
+{
+    struct tm time;
+    (void)dev;
+    return ds3231_fast_get_time(&m_fast, &time);
+}
+
+static bool run_fast_get_status(i2c_dev_t *dev)
+{
+    uint8_t status;
+    (void)dev;
+    return ds3231_fast_get_status(&m_fast, &status);
+}
+
+static bool run_fast_clear_alarm_flags(i2c_dev_t *dev)
+{
+    (void)dev;
+    return ds3231_fast_clear_alarm_flags(&m_fast);
+}
+
+static bool run_set_alarm1(i2c_dev_t *dev)
+{
+    return ds3231_set_alarm(dev, DS3231_ALARM_1, &m_time, DS3231_ALARM1_MATCH_SECMINHOUR,
+        NULL, DS3231_ALARM2_EVERY_MIN);
+}
+
+static bool run_set_alarm2(i2c_dev_t *dev)
+{
+    return ds3231_set_alarm(dev, DS3231_ALARM_2, NULL, DS3231_ALARM1_EVERY_SECOND,
+        &m_time, DS3231_ALARM2_MATCH_MINHOUR);
+}
+
+static bool run_set_alarm_both(i2c_dev_t *dev)
+{
+    return ds3231_set_alarm(dev, DS3231_ALARM_BOTH, &m_time, DS3231_ALARM1_MATCH_SECMINHOURDATE,
+        &m_time, DS3231_ALARM2_MATCH_MINHOURDATE);
+}
+
+/* Same alarm every call, only the first one writes */
+static bool run_set_alarm_cached_same(i2c_dev_t *dev)
+{
+    return ds3231_set_alarm_cached(dev, &m_cache, DS3231_ALARM_1, &m_time, DS3231_ALARM1_MATCH_SECMINHOUR,
+        NULL, DS3231_ALARM2_EVERY_MIN);
+}
+
+/* Alarm moving by a second every call, only the seconds register is written */
+static bool run_set_alarm_cached_sec(i2c_dev_t *dev)
+{
+    struct tm time = m_time;
+
+    time.tm_sec = m_toggle++ % 60;
+    return ds3231_set_alarm_cached(dev, &m_cache, DS3231_ALARM_1, &time, DS3231_ALARM1_MATCH_SECMINHOUR,
+        NULL, DS3231_ALARM2_EVERY_MIN);
+}
+
+static bool run_alarm_cache_load(i2c_dev_t *dev)
+{
+    return ds3231_alarm_cache_load(dev, &m_cache);
+}
+
+static bool run_get_osf(i2c_dev_t *dev)
+{
+    bool flag;
+    return ds3231_get_oscillator_stop_flag(dev, &flag);
+}
+
+static bool run_clear_osf(i2c_dev_t *dev)
+{
+    return ds3231_clear_oscillator_stop_flag(dev);
+}
+
+static bool run_get_alarm_flags(i2c_dev_t *dev)
+{
+    ds3231_alarm_t alarms;
+    return ds3231_get_alarm_flags(dev, &alarms);
+}
+
+static bool run_clear_alarm_flags(i2c_dev_t *dev)
+{
+    return ds3231_clear_alarm_flags(dev, DS3231_ALARM_BOTH);
+}
+
+static bool run_enable_alarm_ints(i2c_dev_t *dev)
+{
+    return ds3231_enable_alarm_ints(dev, DS3231_ALARM_1);
+}
+
+static bool run_disable_alarm_ints(i2c_dev_t *dev)
+{
+    return ds3231_disable_alarm_ints(dev, DS3231_ALARM_1);
+}
+
+static bool run_enable_32khz(i2c_dev_t *dev)
+{
+    return ds3231_enable_32khz(dev);
+}
+
+static bool run_disable_32khz(i2c_dev_t *dev)
+{
+    return ds3231_disable_32khz(dev);
+}
+
+static bool run_enable_squarewave(i2c_dev_t *dev)
+{
+    return ds3231_enable_squarewave(dev);
+}
+
+static bool run_disable_squarewave(i2c_dev_t *dev)
+{
+    return ds3231_disable_squarewave(dev);
+}
+
+static bool run_set_squarewave_freq(i2c_dev_t *dev)
+{
+    return ds3231_set_squarewave_freq(dev, DS3231_SQWAVE_1024HZ);
+}
+
+static bool run_power_run(i2c_dev_t *dev)
+{
+    return ds3231_set_power_profile(dev, DS3231_POWER_RUN, DS3231_ALARM_NONE);
+}
+
+static bool run_power_sleep(i2c_dev_t *dev)
+{
+    return ds3231_set_power_profile(dev, DS3231_POWER_SLEEP, DS3231_ALARM_1);
+}
+
+static bool run_power_shelf(i2c_dev_t *dev)
+{
+    return ds3231_set_power_profile(dev, DS3231_POWER_SHELF, DS3231_ALARM_NONE);
+}
+
+static bool run_get_raw_temp(i2c_dev_t *dev)
+{
+    int16_t temp;
+    return ds3231_get_raw_temp(dev, &temp);
+}
+
+static bool run_get_temp_integer(i2c_dev_t *dev)
+{
+    int8_t temp;
+    return ds3231_get_temp_integer(dev, &temp);
+}
+
+static bool run_get_temp_float(i2c_dev_t *dev)
+{
+    float temp;
+    return ds3231_get_temp_float(dev, &temp);
+}
+
+static bool run_get_aging_offset(i2c_dev_t *dev)
+{
+    int8_t age;
+    return ds3231_get_aging_offset(dev, &age);
+}
+
+static bool run_set_aging_offset(i2c_dev_t *dev)
+{
+    return ds3231_set_aging_offset(dev, 0);
+}
+
+static bool run_tz_localtime(i2c_dev_t *dev)
+{
+    struct tm local;
+
+    (void)dev;
+    return ds3231_tz_localtime(&m_tz, 946684800 + (time_t)(m_toggle++ % 73000) * 86400, &local) != NULL;
+}
+
+static bool run_tz_to_utc(i2c_dev_t *dev)
+{
+    (void)dev;
+    return ds3231_tz_to_utc(&m_tz, &m_time) > 0;
+}
+
+static bool run_get_localtime(i2c_dev_t *dev)
+{
+    struct tm local;
+    return ds3231_get_localtime(dev, &m_tz, &local);
+}
+
+static bool run_set_localtime(i2c_dev_t *dev)
+{
+    return ds3231_set_localtime(dev, &m_tz, &m_time);
+}
+
+static const bench_t m_benches[] = {
+    { "init",                       run_init },
+    { "free",                       run_free },
+    { "set_time",                   run_set_time },
+    { "get_time",                   run_get_time },
+    { "get_epoch",                  run_get_epoch },
+    { "tm_to_epoch",                run_tm_to_epoch },
+    { "epoch_to_tm",                run_epoch_to_tm },
+    { "fix_leap_2100",              run_fix_leap_2100 },
+    { "get_time_checked",           run_get_time_checked },
+    { "get_snapshot",               run_get_snapshot },
+    { "fast_get_time",              run_fast_get_time },
+    { "fast_get_status",            run_fast_get_status },
+    { "fast_clear_alarm_flags",     run_fast_clear_alarm_flags },
+    { "set_alarm(1)",               run_set_alarm1 },
+    { "set_alarm(2)",               run_set_alarm2 },
+    { "set_alarm(both)",            run_set_alarm_both },
+    { "set_alarm_cached(same)",     run_set_alarm_cached_same },
+    { "set_alarm_cached(sec)",      run_set_alarm_cached_sec },
+    { "alarm_cache_load",           run_alarm_cache_load },
+    { "get_oscillator_stop_flag",   run_get_osf },
+    { "clear_oscillator_stop_flag", run_clear_osf },
+    { "get_alarm_flags",            run_get_alarm_flags },
+    { "clear_alarm_flags",          run_clear_alarm_flags },
+    { "enable_alarm_ints",          run_enable_alarm_ints },
+    { "disable_alarm_ints",         run_disable_alarm_ints },
+    { "enable_32khz",               run_enable_32khz },
+    { "disable_32khz",              run_disable_32khz },
+    { "enable_squarewave",          run_enable_squarewave },
+    { "disable_squarewave",         run_disable_squarewave },
+    { "set_squarewave_freq",        run_set_squarewave_freq },
+    { "set_power_profile(run)",     run_power_run },
+    { "set_power_profile(sleep)",   run_power_sleep },
+    { "set_power_profile(shelf)",   run_power_shelf },
+    { "get_raw_temp",               run_get_raw_temp },
+    { "get_temp_integer",           run_get_temp_integer },
+    { "get_temp_float",             run_get_temp_float },
+    { "get_aging_offset",           run_get_aging_offset },
+    { "set_aging_offset",           run_set_aging_offset },
+    { "tz_localtime",               run_tz_localtime },
+    { "tz_to_utc",                  run_tz_to_utc },
+    { "get_localtime",              run_get_localtime },
+    { "set_localtime",              run_set_localtime },
+};
+
+static const bench_bus_t m_buses[] = {
+    { "100 kHz",           100000, 0 },
+    { "400 kHz",           400000, 0 },
+    { "400 kHz, 2us str.", 400000, 2000 },
+};
+
+static uint64_t cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_ITERATIONS;
+    i2c_dev_t dev = { .port = BENCH_PORT, .addr = DS3231_ADDR, .ops = &hal_sim_ops };
+
+    if (iterations == 0) {
+        iterations = 1;
+    }
+    bench_tz_init();
+
+    for (size_t b = 0; b < sizeof(m_buses) / sizeof(m_buses[0]); b++) {
+        printf("%s, %u iterations\n", m_buses[b].name, iterations);
+        printf("%-28s %12s %12s %8s\n", "call", "bus us", "cpu ns", "xfers");
+
+        for (size_t i = 0; i < sizeof(m_benches) / sizeof(m_benches[0]); i++) {
+            uint64_t bus_ns;
+            uint32_t xfers;
+            bool ok = true;
+
+            hal_sim_reset(BENCH_PORT);
+            ds3231_alarm_cache_init(&m_cache);
+            m_toggle = 0;
+            ok &= ds3231_fast_init(&m_fast, &dev);
+            hal_sim_set_bus(BENCH_PORT, m_buses[b].freq_hz, m_buses[b].stretch_ns);
+            hal_sim_reset_bus_usage(BENCH_PORT);
+
+            uint64_t start = cpu_ns();
+            for (unsigned n = 0; n < iterations; n++) {
+                ok &= m_benches[i].run(&dev);
+            }
+            uint64_t cpu = cpu_ns() - start;
+            hal_sim_get_bus_usage(BENCH_PORT, &bus_ns, &xfers);
+
+            printf("%-28s %12.1f %12.1f %8.2f%s\n", m_benches[i].name,
+                bus_ns / 1000.0 / iterations, (double)cpu / iterations,
+                (double)xfers / iterations, ok ? "" : "  FAILED");
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Code and data size of the driver per feature group (see DS3231_CFG_* in ds3231.h)
+#
+#     tools/ds3231_size.sh
+#     CC=arm-none-eabi-gcc CFLAGS="-mcpu=cortex-m0 -mthumb" tools/ds3231_size.sh
+#
+# Builds ds3231.c with every group, with each group compiled out and with
+# all of them out, and prints the size and the saving of each build. Run
+# from the top of the repository. Linking with -ffunction-sections and
+# --gc-sections drops unused functions as well, the groups also remove
+# the helpers they share and catch calls into a group that is left out
+# at compile time.
+#
+# Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+#
+# MIT Licensed as described in the file LICENSE
+
+set -e
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-}
+case "$CC" in
+    *gcc) SIZE=${SIZE:-${CC%gcc}size} ;;
+    *) SIZE=${SIZE:-size} ;;
+esac
+
+FEATURES="ALARMS FLAGS SQUAREWAVE 32KHZ POWER TEMPERATURE TEMP_FLOAT AGING CHECKED FAST"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# text + data + bss of ds3231.c built with the given defines
+build() {
+    $CC -Os -ffunction-sections -fdata-sections -I. $CFLAGS "$@" -c ds3231.c -o "$TMP/ds3231.o"
+    $SIZE "$TMP/ds3231.o" | awk 'NR == 2 { print $1, $2, $3 }'
+}
+
+set -- $(build)
+FULL=$(($1 + $2 + $3))
+printf '%-16s %6s %6s %6s %7s\n' build text data bss saved
+printf '%-16s %6d %6d %6d %7s\n' all "$1" "$2" "$3" -
+
+ALL_OFF=
+for g in $FEATURES; do
+    ALL_OFF="$ALL_OFF -DDS3231_CFG_$g=0"
+    set -- $(build "-DDS3231_CFG_$g=0")
+    printf '%-16s %6d %6d %6d %7d\n' "-$g" "$1" "$2" "$3" $((FULL - $1 - $2 - $3))
+done
+
+set -- $(build $ALL_OFF)
+printf '%-16s %6d %6d %6d %7d\n' "time only" "$1" "$2" "$3" $((FULL - $1 - $2 - $3))
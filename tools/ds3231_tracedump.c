@@ -0,0 +1,158 @@
+/*
+ * Decoder for I2C transaction trace dumps
+ *
+ * Reads a dump written by hal_trace_dump (see hal/hal_trace.h) and prints
+ * a human readable timeline, or Chrome trace event JSON with `-j` for
+ * chrome://tracing or Perfetto.
+ *
+ *     cc -O2 -I. tools/ds3231_tracedump.c -o ds3231_tracedump
+ *     ds3231_tracedump [-j] dump.bin
+ *
+ * Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+ *
+ * MIT Licensed as described in the file LICENSE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ds3231.h"
+#include "../hal/hal_trace.h"
+
+typedef struct {
+    uint8_t addr;
+    const char *name;
+} reg_name_t;
+
+static const reg_name_t m_regs[] = {
+    { DS3231_ADDR_TIME,    "TIME" },
+    { DS3231_ADDR_ALARM1,  "ALARM1" },
+    { DS3231_ADDR_ALARM2,  "ALARM2" },
+    { DS3231_ADDR_CONTROL, "CONTROL" },
+    { DS3231_ADDR_STATUS,  "STATUS" },
+    { DS3231_ADDR_AGING,   "AGING" },
+    { DS3231_ADDR_TEMP,    "TEMP" },
+};
+
+/* Name of the register block a DS3231 register belongs to, e.g. TIME+1 */
+static void reg_name(uint8_t addr, uint8_t reg, char *buf, size_t size)
+{
+    const reg_name_t *best = NULL;
+
+    if (addr == DS3231_ADDR) {
+        for (size_t i = 0; i < sizeof(m_regs) / sizeof(m_regs[0]); i++) {
+            if (m_regs[i].addr <= reg) {
+                best = &m_regs[i];
+            }
+        }
+    }
+
+    if (best == NULL) {
+        snprintf(buf, size, "0x%02x", reg);
+    } else if (best->addr == reg) {
+        snprintf(buf, size, "%s", best->name);
+    } else {
+        snprintf(buf, size, "%s+%u", best->name, reg - best->addr);
+    }
+}
+
+static void hex(const hal_trace_record_t *rec, char *buf, size_t size)
+{
+    size_t n = rec->len < HAL_TRACE_DATA_BYTES ? rec->len : HAL_TRACE_DATA_BYTES;
+    size_t pos = 0;
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < n && pos + 4 < size; i++) {
+        pos += snprintf(buf + pos, size - pos, "%s%02x", i ? " " : "", rec->data[i]);
+    }
+    if (rec->len > n && pos + 4 < size) {
+        snprintf(buf + pos, size - pos, " ..");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    const char *path = NULL;
+    hal_trace_header_t header;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) {
+            json = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-j] dump.bin\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != HAL_TRACE_MAGIC
+            || header.version != HAL_TRACE_VERSION || header.record_size != sizeof(hal_trace_record_t)) {
+        fprintf(stderr, "%s: not a trace dump\n", path);
+        return 1;
+    }
+
+    if (json) {
+        printf("{\"traceEvents\":[");
+    } else {
+        printf("%u records, %u written since clear\n", header.count, header.total);
+    }
+
+    int64_t base = 0, ts = 0;
+    uint32_t last = 0;
+    for (unsigned i = 0; i < header.count; i++) {
+        hal_trace_record_t rec;
+        char name[16], data[HAL_TRACE_DATA_BYTES * 3 + 4];
+
+        if (fread(&rec, sizeof(rec), 1, f) != 1) {
+            fprintf(stderr, "%s: truncated\n", path);
+            break;
+        }
+
+        /* unwrap the 32-bit microsecond timestamps, relative to the first record.
+         * Records are stamped with their start but ordered by their end, a
+         * nested transaction can start before the previous record */
+        if (i == 0) {
+            base = rec.timestamp_us;
+            ts = base;
+        } else {
+            ts += (int32_t)(rec.timestamp_us - last);
+        }
+        last = rec.timestamp_us;
+
+        bool write = rec.flags & HAL_TRACE_WRITE;
+        bool ok = !(rec.flags & HAL_TRACE_FAILED);
+        unsigned retries = (rec.flags & HAL_TRACE_RETRY_MASK) >> HAL_TRACE_RETRY_SHIFT;
+        unsigned port = (rec.flags & HAL_TRACE_PORT_MASK) >> HAL_TRACE_PORT_SHIFT;
+        reg_name(rec.addr, rec.reg, name, sizeof(name));
+        hex(&rec, data, sizeof(data));
+
+        if (json) {
+            printf("%s\n{\"name\":\"%s %s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%u,\"pid\":%u,\"tid\":%u,"
+                "\"args\":{\"reg\":\"0x%02x\",\"len\":%u,\"data\":\"%s\",\"ok\":%s,\"retries\":%u}}",
+                i ? "," : "", write ? "W" : "R", name, (long long)(ts - base), rec.duration_us,
+                port, rec.addr, rec.reg, rec.len, data, ok ? "true" : "false", retries);
+        } else {
+            printf("%12.6f %6uus i2c%u 0x%02x %s %-10s [%3u] %-20s %s",
+                (ts - base) / 1e6, rec.duration_us, port, rec.addr, write ? "W" : "R",
+                name, rec.len, data, ok ? "ok" : "FAILED");
+            if (retries) {
+                printf(" (%u retries)", retries);
+            }
+            printf("\n");
+        }
+    }
+
+    if (json) {
+        printf("\n]}\n");
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""
+Generate a DS3231 time zone table (see ds3231_tz.h) from the host zoneinfo
+
+    tools/ds3231_tzgen.py [--from YEAR] [--to YEAR] [--symbol NAME] ZONE > tz_zone.c
+
+Transitions are expanded explicitly from the first to the last year, the
+rules TZif keeps in its footer included, so the target needs no rule logic.
+Build the output with the driver and declare the generated table where it
+is used, e.g. `extern const ds3231_tz_t ds3231_tz_europe_berlin;`.
+
+Copyright (C) 2020 HexRx <bps.programmer@gmail.com>
+
+MIT Licensed as described in the file LICENSE
+"""
+
+import argparse
+import re
+import sys
+from datetime import datetime, timezone
+from zoneinfo import ZoneInfo
+
+DAY = 86400
+
+
+def local_type(zone, ts):
+    """(utoff, isdst, abbr) in effect at UTC seconds ts"""
+    dt = datetime.fromtimestamp(ts, timezone.utc).astimezone(zone)
+    return (int(dt.utcoffset().total_seconds()), 1 if dt.dst() else 0, dt.tzname())
+
+
+def transitions(zone, start, end):
+    """Times in [start, end) at which the local time type changes"""
+    result = []
+    prev = local_type(zone, start)
+    ts = start
+    while ts < end:
+        nxt = min(ts + DAY, end)
+        cur = local_type(zone, nxt)
+        if cur != prev:
+            # bisect down to the second, at most one change per day
+            lo, hi = ts, nxt
+            while hi - lo > 1:
+                mid = (lo + hi) // 2
+                if local_type(zone, mid) == prev:
+                    lo = mid
+                else:
+                    hi = mid
+            result.append((hi, cur))
+            prev = cur
+        ts = nxt
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("zone", help="zone name, e.g. Europe/Berlin")
+    parser.add_argument("--from", dest="first", type=int, default=2000, help="first year (2000)")
+    parser.add_argument("--to", dest="last", type=int, default=2199, help="last year (2199)")
+    parser.add_argument("--symbol", help="name of the ds3231_tz_t, derived from the zone by default")
+    args = parser.parse_args()
+
+    zone = ZoneInfo(args.zone)
+    symbol = args.symbol or "ds3231_tz_" + re.sub(r"[^0-9a-zA-Z]+", "_", args.zone).lower()
+    start = int(datetime(args.first, 1, 1, tzinfo=timezone.utc).timestamp())
+    end = int(datetime(args.last + 1, 1, 1, tzinfo=timezone.utc).timestamp())
+
+    initial = local_type(zone, start)
+    trans = transitions(zone, start, end)
+
+    types = [initial]
+    for _, t in trans:
+        if t not in types:
+            types.append(t)
+    if len(trans) > 0xffff or len(types) > 0xff:
+        sys.exit("too many transitions or types, narrow the years")
+
+    abbrs = ""
+    abbr_index = {}
+    for _, _, name in types:
+        if name not in abbr_index:
+            abbr_index[name] = len(abbrs)
+            abbrs += name + "\0"
+
+    out = sys.stdout
+    out.write("/*\n * %s, %d to %d\n *\n * Generated by tools/ds3231_tzgen.py, do not edit\n*/\n\n"
+              % (args.zone, args.first, args.last))
+    out.write('#include "ds3231_tz.h"\n\n')
+
+    if trans:
+        out.write("static const int64_t %s_times[] = {\n" % symbol)
+        for ts, _ in trans:
+            out.write("    %d, /* %s */\n" % (ts, datetime.fromtimestamp(ts, timezone.utc).strftime("%Y-%m-%d %H:%M:%S")))
+        out.write("};\n\n")
+        out.write("static const uint8_t %s_indices[] = {\n" % symbol)
+        row = [str(types.index(t)) for _, t in trans]
+        for i in range(0, len(row), 16):
+            out.write("    %s,\n" % ", ".join(row[i:i + 16]))
+        out.write("};\n\n")
+
+    out.write("static const ds3231_tz_type_t %s_types[] = {\n" % symbol)
+    for utoff, isdst, name in types:
+        out.write("    { %d, %d, %d }, /* %s */\n" % (utoff, isdst, abbr_index[name], name))
+    out.write("};\n\n")
+
+    out.write("const ds3231_tz_t %s = {\n" % symbol)
+    out.write('    .name = "%s",\n' % args.zone)
+    out.write("    .count = %d,\n" % len(trans))
+    out.write("    .times = %s,\n" % ("%s_times" % symbol if trans else "NULL"))
+    out.write("    .indices = %s,\n" % ("%s_indices" % symbol if trans else "NULL"))
+    out.write("    .types = %s_types,\n" % symbol)
+    out.write('    .abbrs = "%s",\n' % abbrs.replace("\0", "\\000"))
+    out.write("};\n")
+
+
+if __name__ == "__main__":
+    main()